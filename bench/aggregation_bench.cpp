@@ -0,0 +1,89 @@
+// Measures remote stores and loads per second with message aggregation on and off.
+// Rank 0 issues 8-byte stores and loads to an array on rank 1, keeping a window of them in flight.
+//
+// usage: aggregation_bench [number of operations] [window]
+
+#include "../load_store_library.cpp"
+
+#include <cstdio>
+
+namespace {
+
+constexpr std::size_t arraySize = 1 << 16;
+std::uint64_t targetArray[arraySize];
+
+// global address of element i of rank's targetArray
+GlobalAddress targetAddress(void* base, std::uint64_t rank, std::size_t i) {
+  const auto addr = reinterpret_cast<std::uintptr_t>(static_cast<std::uint64_t*>(base) + i);
+  return reinterpret_cast<GlobalAddress>(addr | (static_cast<std::uintptr_t>(0xFFFF - rank) << 48));
+}
+
+double seconds(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+double runStores(void* base, std::size_t numOps, std::size_t window) {
+  const auto start = std::chrono::steady_clock::now();
+  for (std::size_t done = 0; done < numOps; done += window) {
+    std::vector<Nodes::Future> futures;
+    futures.reserve(window);
+    for (std::size_t i = done; i < std::min(numOps, done + window); ++i) {
+      const std::uint64_t value = i;
+      const auto& future = futures.emplace_back();
+      if (remoteStore(1, targetAddress(base, 1, i % arraySize), &value, sizeof(value), future) != OK) {
+        std::abort();
+      }
+    }
+    Nodes::waitAll(futures);
+  }
+  return numOps / seconds(std::chrono::steady_clock::now() - start);
+}
+
+double runLoads(void* base, std::size_t numOps, std::size_t window) {
+  std::vector<std::uint64_t> values(window);
+  const auto start = std::chrono::steady_clock::now();
+  for (std::size_t done = 0; done < numOps; done += window) {
+    std::vector<Nodes::Future> futures;
+    futures.reserve(window);
+    for (std::size_t i = done; i < std::min(numOps, done + window); ++i) {
+      const auto& future = futures.emplace_back(&values[i - done]);
+      if (remoteLoad(1, targetAddress(base, 1, i % arraySize), sizeof(std::uint64_t), future) != OK) {
+        std::abort();
+      }
+    }
+    Nodes::waitAll(futures);
+  }
+  return numOps / seconds(std::chrono::steady_clock::now() - start);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const std::size_t numOps = (argc > 1) ? std::strtoull(argv[1], nullptr, 0) : (1 << 20);
+  const std::size_t window = (argc > 2) ? std::strtoull(argv[2], nullptr, 0) : 1024;
+
+  if (initialize(2) != OK || world.size < 2) {
+    std::fprintf(stderr, "aggregation_bench needs 2 ranks\n");
+    return 1;
+  }
+
+  // rank 1 owns the array. its address is broadcast, since it can differ between ranks.
+  void* localBase = targetArray;
+  void* base = nullptr;
+  gex_Event_Wait(gex_Coll_BroadcastNB(world.team, 1, &base, &localBase, sizeof(base), 0));
+
+  if (world.rank == 0) {
+    for (bool aggregate : {false, true}) {
+      if (aggregator.setEnabled(aggregate) != OK) {
+        std::abort();
+      }
+      const auto stores = runStores(base, numOps, window);
+      const auto loads = runLoads(base, numOps, window);
+      std::printf("aggregation %-3s: %12.0f stores/s %12.0f loads/s (%zu ops, window %zu)\n",
+                  aggregate ? "on" : "off", stores, loads, numOps, window);
+    }
+  }
+
+  gex_Event_Wait(gex_Coll_BarrierNB(world.team, 0));
+  return finalize() == OK ? 0 : 1;
+}
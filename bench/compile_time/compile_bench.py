@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Compile-time benchmark of the passes on a generated module.
+
+Writes a module with many functions of loads and stores to globals (by default 10k functions,
+1M loads and stores), runs each pass pipeline over it with `opt` and prints the wall time and peak
+memory of each run as JSON.
+
+usage: ./compile_bench.py [--functions N] [--accesses N] [--globals N] [--opt OPT]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+GLOBALIZE_PLUGIN = os.path.join(ROOT, "build", "LLVMGlobalizePass.so")
+LOAD_STORE_PLUGIN = os.path.join(ROOT, "target", "debug", "libload_store_llvm_pass.dylib")
+
+# name, plugins, pipeline, input (the generated module or the output of another run)
+RUNS = [
+    ("globalize-pass", [GLOBALIZE_PLUGIN], "globalize-pass", "module.ll"),
+    ("provenance-pass", [GLOBALIZE_PLUGIN], "provenance-pass", "globalize-pass.ll"),
+    ("load-store-pass", [GLOBALIZE_PLUGIN, LOAD_STORE_PLUGIN], "load-store-pass", "globalize-pass.ll"),
+    ("load-store-pass<fast-path>", [GLOBALIZE_PLUGIN, LOAD_STORE_PLUGIN], "load-store-pass<fast-path>",
+     "globalize-pass.ll"),
+    ("globalize-cleanup-pass", [GLOBALIZE_PLUGIN], "globalize-cleanup-pass", "load-store-pass.ll"),
+]
+
+# the runtime the passes look up. declarations are enough for them.
+RUNTIME = """
+declare ptr @globalify(ptr)
+declare ptr @deglobalify(ptr)
+declare i32 @check_if_global(ptr)
+declare i64 @__pando__replace_load_int64(ptr)
+declare i32 @__pando__replace_load_int32(ptr)
+declare i8 @__pando__replace_load_int8(ptr)
+declare float @__pando__replace_load_float32(ptr)
+declare ptr @__pando__replace_load_ptr(ptr)
+declare ptr @__pando__replace_load_vector(ptr, i64, i64)
+declare void @__pando__replace_store_int64(i64, ptr)
+declare void @__pando__replace_store_int32(i32, ptr)
+declare void @__pando__replace_store_int8(i8, ptr)
+declare void @__pando__replace_store_float32(float, ptr)
+declare void @__pando__replace_store_ptr(ptr, ptr)
+declare void @__pando__replace_store_vector(ptr, ptr, i64, i64)
+@__pando__local_tag = external global i64
+"""
+
+
+def write_module(path, num_functions, accesses_per_function, num_globals):
+    """Each function reads and writes globals through constant and computed addresses, and a
+    stack slot, and calls the previous function."""
+    with open(path, "w") as out:
+        out.write(RUNTIME)
+        for g in range(num_globals):
+            out.write("@g%d = global [64 x i64] zeroinitializer\n" % g)
+
+        for f in range(num_functions):
+            out.write("\ndefine i64 @f%d(i64 %%i) {\nentry:\n" % f)
+            out.write("  %slot = alloca i64\n")
+            out.write("  store i64 %i, ptr %slot\n")
+            value = "%i"
+            for a in range((accesses_per_function - 2) // 2):
+                g = "@g%d" % ((f * 7 + a) % num_globals)
+                if a % 2 == 0:
+                    out.write("  %%p%d = getelementptr inbounds [64 x i64], ptr %s, i64 0, i64 %%i\n" % (a, g))
+                    address = "%%p%d" % a
+                else:
+                    address = g
+                out.write("  %%v%d = load i64, ptr %s\n" % (a, address))
+                out.write("  %%s%d = add i64 %%v%d, %s\n" % (a, a, value))
+                out.write("  store i64 %%s%d, ptr %s\n" % (a, address))
+                value = "%%s%d" % a
+            if f > 0:
+                out.write("  %%r = call i64 @f%d(i64 %s)\n" % (f - 1, value))
+                value = "%r"
+            out.write("  %%last = load i64, ptr %%slot\n  %%ret = add i64 %%last, %s\n" % value)
+            out.write("  ret i64 %ret\n}\n")
+
+
+def measure(command):
+    """Runs command in a child process and returns (seconds, peak resident bytes) of the run."""
+    # a fresh child per run, so the peak is the run's own (RUSAGE_CHILDREN keeps the maximum)
+    probe = (
+        "import resource, subprocess, sys, time\n"
+        "start = time.monotonic()\n"
+        "code = subprocess.call(sys.argv[1:], stdout=subprocess.DEVNULL)\n"
+        "elapsed = time.monotonic() - start\n"
+        "peak = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss\n"
+        "print(code, elapsed, peak * (1 if sys.platform == 'darwin' else 1024))\n"
+    )
+    output = subprocess.check_output([sys.executable, "-c", probe] + command, text=True)
+    code, elapsed, peak = output.split()
+    if int(code) != 0:
+        raise RuntimeError("%s failed with exit code %s" % (" ".join(command), code))
+    return float(elapsed), int(peak)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--functions", type=int, default=10000)
+    parser.add_argument("--accesses", type=int, default=100, help="loads and stores per function")
+    parser.add_argument("--globals", type=int, default=64)
+    parser.add_argument("--opt", default="opt")
+    args = parser.parse_args()
+
+    start = time.monotonic()
+    write_module("module.ll", args.functions, args.accesses, args.globals)
+    generate_seconds = time.monotonic() - start
+
+    results = []
+    for name, plugins, pipeline, source in RUNS:
+        output = name.replace("<", "_").replace(">", "") + ".ll"
+        if source != "module.ll":
+            source = source.replace("<", "_").replace(">", "")
+        command = [args.opt, "-S"]
+        for plugin in plugins:
+            command.append("--load-pass-plugin=" + plugin)
+        command += ["--passes=" + pipeline, source, "-o", output]
+        seconds, peak = measure(command)
+        results.append({"pass": name, "seconds": round(seconds, 3), "peak_bytes": peak})
+
+    print(json.dumps({
+        "functions": args.functions,
+        "loads_and_stores": args.functions * args.accesses,
+        "generate_seconds": round(generate_seconds, 3),
+        "runs": results,
+    }, indent=2))
+
+
+if __name__ == "__main__":
+    main()
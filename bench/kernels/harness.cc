@@ -0,0 +1,108 @@
+// Times one benchmark kernel and prints its cost as a JSON object. Built natively (never
+// instrumented) and linked with the kernel, which may have gone through the passes.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef KERNEL_NAME
+#define KERNEL_NAME "unknown"
+#endif
+
+extern "C" {
+void kernel_setup();
+uint64_t kernel_accesses();
+uint64_t kernel_run();
+// runtime calls counted by the test runtime built with PANDO_QUIET
+uint64_t __pando__call_count();
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// counts the user-space instructions retired by this thread. returns -1 where perf events are not
+// available (other systems, or perf_event_paranoid too high).
+static int open_instruction_counter() {
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+static void start_counter(int counter) {
+#ifdef __linux__
+  if (counter >= 0) {
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+}
+
+static long long stop_counter(int counter) {
+  long long count = -1;
+#ifdef __linux__
+  if (counter >= 0) {
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &count, sizeof(count)) != sizeof(count)) {
+      count = -1;
+    }
+    close(counter);
+  }
+#endif
+  return count;
+}
+
+// usage: <kernel>.binary [reps]
+int main(int argc, char** argv) {
+  int reps = (argc > 1) ? atoi(argv[1]) : 100;
+
+  kernel_setup();
+  uint64_t checksum = kernel_run();  // warm up
+
+  uint64_t calls_before = __pando__call_count();
+  int counter = open_instruction_counter();
+  start_counter(counter);
+  uint64_t start = now_ns();
+  for (int rep = 0; rep < reps; rep++) {
+    checksum ^= kernel_run() + rep;
+  }
+  uint64_t elapsed = now_ns() - start;
+  long long instructions = stop_counter(counter);
+  uint64_t calls = __pando__call_count() - calls_before;
+
+  uint64_t accesses = kernel_accesses() * reps;
+  // instruction counts are null where perf events are not available
+  char instructions_text[32] = "null";
+  char per_access_text[32] = "null";
+  if (instructions >= 0) {
+    snprintf(instructions_text, sizeof(instructions_text), "%lld", instructions);
+    snprintf(per_access_text, sizeof(per_access_text), "%.3f", (double) instructions / accesses);
+  }
+  printf("{\"kernel\": \"%s\", \"reps\": %d, \"accesses\": %llu, \"ns\": %llu, \"ns_per_access\": %.3f, "
+         "\"instructions\": %s, \"instructions_per_access\": %s, \"runtime_calls\": %llu, "
+         "\"checksum\": %llu}\n",
+         KERNEL_NAME, reps, (unsigned long long) accesses, (unsigned long long) elapsed,
+         (double) elapsed / accesses, instructions_text, per_access_text,
+         (unsigned long long) calls, (unsigned long long) checksum);
+  return 0;
+}
@@ -0,0 +1,41 @@
+// Pointer chasing through global nodes, like test_pointer_layering.cc: the address of every load
+// is the result of the previous one, so nothing can overlap.
+#include <stdint.h>
+
+#define N 4096
+// visits the nodes out of order. coprime to N, so the list is one cycle.
+#define STRIDE 1597
+
+struct Node {
+  Node* next;
+  int64_t value;
+};
+
+Node nodes[N];
+Node* head = &nodes[0];
+
+extern "C" {
+
+void kernel_setup() {
+  for (int i = 0; i < N; i++) {
+    nodes[i].next = &nodes[(i + STRIDE) % N];
+    nodes[i].value = i;
+  }
+}
+
+// two loads per node, plus the head
+uint64_t kernel_accesses() {
+  return 2 * N + 1;
+}
+
+uint64_t kernel_run() {
+  uint64_t sum = 0;
+  Node* node = head;
+  for (int i = 0; i < N; i++) {
+    sum += node->value;
+    node = node->next;
+  }
+  return sum;
+}
+
+} // extern "C"
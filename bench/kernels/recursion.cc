@@ -0,0 +1,38 @@
+// Stack-heavy recursion: every frame fills a small array from its parent's and passes it down, so
+// the frames' allocas escape and are globalized.
+#include <stdint.h>
+
+#define DEPTH 64
+#define REPS 16
+#define WIDTH 4
+
+extern "C" {
+
+__attribute__((noinline)) static int64_t walk(int64_t* parent, int depth) {
+  int64_t frame[WIDTH];
+  for (int i = 0; i < WIDTH; i++) {
+    frame[i] = parent[i] + depth + i;
+  }
+  if (depth == 0) {
+    return frame[0] + frame[WIDTH - 1];
+  }
+  return walk(frame, depth - 1) + frame[1];
+}
+
+void kernel_setup() {}
+
+// per frame, WIDTH loads and stores and one (two at the bottom) load of the result, plus the root
+uint64_t kernel_accesses() {
+  return REPS * ((DEPTH + 1) * (2 * WIDTH + 1) + 1) + WIDTH;
+}
+
+uint64_t kernel_run() {
+  int64_t root[WIDTH] = {1, 2, 3, 4};
+  uint64_t sum = 0;
+  for (int rep = 0; rep < REPS; rep++) {
+    sum += walk(root, DEPTH);
+  }
+  return sum;
+}
+
+} // extern "C"
@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# usage: ./run_kernels.sh [reps]
+#
+# builds every kernel uninstrumented (baseline), with the default passes and with each pass mode,
+# at -O3 and -O0, and prints one JSON array with a result per build. a build whose checksum differs
+# from the baseline's is marked "checksum_ok": false and makes the script fail.
+
+reps="${1:-100}"
+
+# name|globalize pipeline|load-store pipeline
+configs=(
+    "baseline||"
+    "default|globalize-pass|load-store-pass"
+    "fast-path|globalize-pass|load-store-pass<fast-path>"
+    "escape-analysis|globalize-pass|load-store-pass<escape-analysis>"
+    "split-loads|globalize-pass|load-store-pass<split-loads>"
+    "store-buffer|globalize-pass|load-store-pass<store-buffer>"
+    "cleanup|globalize-pass|load-store-pass,globalize-cleanup-pass"
+    "coalesce|globalize-pass,coalesce-pass|load-store-pass"
+    "profile|globalize-pass|load-store-pass<profile>"
+)
+
+kernels=$(ls | grep '\.cc$' | grep -v '^harness\.cc$' | sed 's/\.cc$//')
+failed=0
+separator=""
+
+echo "["
+for opt in O3 O0; do
+    for kernel in $kernels; do
+        baseline_checksum=""
+        for entry in "${configs[@]}"; do
+            IFS='|' read -r config globalize_pipeline load_store_pipeline <<< "$entry"
+
+            if ! make kernel kernel="$kernel" opt="$opt" config="$config" \
+                    GLOBALIZEPIPELINE="$globalize_pipeline" LOADSTOREPIPELINE="$load_store_pipeline" > /dev/null 2>&1; then
+                echo "$kernel $config $opt: build FAILED" >&2
+                failed=1
+                continue
+            fi
+            result=$(./"$kernel.$config.$opt".binary "$reps")
+
+            checksum=$(echo "$result" | grep -o '"checksum": [0-9]*' | grep -o '[0-9]*$')
+            if [[ "$config" == "baseline" ]]; then
+                baseline_checksum="$checksum"
+            fi
+            checksum_ok=true
+            if [[ "$checksum" != "$baseline_checksum" ]]; then
+                echo "$kernel $config $opt: checksum $checksum, expected $baseline_checksum" >&2
+                checksum_ok=false
+                failed=1
+            fi
+
+            printf '%s  {"config": "%s", "opt": "%s", %s, "checksum_ok": %s}' \
+                "$separator" "$config" "$opt" "$(echo "$result" | sed 's/^{//; s/}$//')" "$checksum_ok"
+            separator=$',\n'
+        done
+    done
+done
+printf '\n]\n'
+
+exit $failed
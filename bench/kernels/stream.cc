@@ -0,0 +1,37 @@
+// Streaming sweeps over global arrays: a triad and a reduction. At -O3 the loops are vectorized.
+#include <stdint.h>
+
+#define N 4096
+
+int32_t a[N];
+int32_t b[N];
+int32_t c[N];
+
+extern "C" {
+
+void kernel_setup() {
+  for (int32_t i = 0; i < N; i++) {
+    a[i] = i;
+    b[i] = 2 * i;
+    c[i] = 0;
+  }
+}
+
+// three accesses per element in the triad, one in the reduction
+uint64_t kernel_accesses() {
+  return 4 * N;
+}
+
+uint64_t kernel_run() {
+  for (int i = 0; i < N; i++) {
+    c[i] = a[i] + 3 * b[i];
+  }
+
+  uint64_t sum = 0;
+  for (int i = 0; i < N; i++) {
+    sum += c[i];
+  }
+  return sum;
+}
+
+} // extern "C"
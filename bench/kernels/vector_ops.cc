@@ -0,0 +1,40 @@
+// Vector arithmetic on global arrays of 4 x i32 vectors, like test_vector_types.cc. Every access
+// is a vector load or store, at -O0 too.
+#include <stdint.h>
+
+#define N 1024
+
+typedef int32_t v4i32 __attribute__((vector_size(16)));
+
+v4i32 x[N];
+v4i32 y[N];
+v4i32 z[N];
+
+extern "C" {
+
+void kernel_setup() {
+  for (int32_t i = 0; i < N; i++) {
+    x[i] = (v4i32){i, i + 1, i + 2, i + 3};
+    y[i] = (v4i32){1, 2, 3, 4};
+    z[i] = (v4i32){0, 0, 0, 0};
+  }
+}
+
+// three vector accesses per element in the update, one in the reduction
+uint64_t kernel_accesses() {
+  return 4 * N;
+}
+
+uint64_t kernel_run() {
+  for (int i = 0; i < N; i++) {
+    z[i] = x[i] * y[i] + z[i];
+  }
+
+  v4i32 sum = {0, 0, 0, 0};
+  for (int i = 0; i < N; i++) {
+    sum += z[i];
+  }
+  return (uint64_t) (sum[0] + sum[1] + sum[2] + sum[3]);
+}
+
+} // extern "C"
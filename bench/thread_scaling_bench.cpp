@@ -0,0 +1,146 @@
+// Measures remote stores and loads per second as more threads issue them.
+// Threads of rank 0 issue 8-byte stores and loads to their own slice of an array on rank 1, each
+// keeping a window of them in flight, for 1, 2, 4, ... up to 64 threads. The threads are started
+// once and reused, so with PANDO_THREAD_ENDPOINTS=1 each creates at most one endpoint.
+//
+// usage: thread_scaling_bench [operations per thread] [window] [max threads]
+
+#include "../load_store_library.cpp"
+
+#include <cstdio>
+
+namespace {
+
+constexpr std::size_t arraySize = 1 << 16;
+std::uint64_t targetArray[arraySize];
+
+// global address of element i of rank's targetArray
+GlobalAddress targetAddress(void* base, std::uint64_t rank, std::size_t i) {
+  const auto addr = reinterpret_cast<std::uintptr_t>(static_cast<std::uint64_t*>(base) + i);
+  return reinterpret_cast<GlobalAddress>(addr | (static_cast<std::uintptr_t>(0xFFFF - rank) << 48));
+}
+
+double seconds(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+// What the threads run in a round. A new round starts when generation changes.
+struct {
+  void* base{nullptr};
+  std::size_t numOps{0};
+  std::size_t window{0};
+  std::size_t sliceSize{0};
+  std::size_t numThreads{0};
+  bool loads{false};
+  std::atomic<std::uint64_t> generation{0};
+  std::atomic<std::size_t> finished{0};
+  std::atomic<bool> stop{false};
+} rounds;
+
+void runStores(std::size_t thread) {
+  const auto first = thread * rounds.sliceSize;
+  std::vector<Nodes::Future> futures;
+  futures.reserve(rounds.window);
+  for (std::size_t done = 0; done < rounds.numOps; done += rounds.window) {
+    futures.clear();
+    for (std::size_t i = done; i < std::min(rounds.numOps, done + rounds.window); ++i) {
+      const std::uint64_t value = i;
+      const auto& future = futures.emplace_back();
+      if (remoteStore(1, targetAddress(rounds.base, 1, first + i % rounds.sliceSize), &value, sizeof(value),
+                      future) != OK) {
+        std::abort();
+      }
+    }
+    Nodes::waitAll(futures);
+  }
+}
+
+void runLoads(std::size_t thread) {
+  const auto first = thread * rounds.sliceSize;
+  std::vector<std::uint64_t> values(rounds.window);
+  std::vector<Nodes::Future> futures;
+  futures.reserve(rounds.window);
+  for (std::size_t done = 0; done < rounds.numOps; done += rounds.window) {
+    futures.clear();
+    for (std::size_t i = done; i < std::min(rounds.numOps, done + rounds.window); ++i) {
+      const auto& future = futures.emplace_back(&values[i - done]);
+      if (remoteLoad(1, targetAddress(rounds.base, 1, first + i % rounds.sliceSize), sizeof(std::uint64_t),
+                     future) != OK) {
+        std::abort();
+      }
+    }
+    Nodes::waitAll(futures);
+  }
+}
+
+void worker(std::size_t thread) {
+  std::uint64_t seen = 0;
+  for (;;) {
+    while (rounds.generation.load(std::memory_order_acquire) == seen) {
+      std::this_thread::yield();
+    }
+    seen = rounds.generation.load(std::memory_order_acquire);
+    if (rounds.stop.load(std::memory_order_relaxed)) {
+      return;
+    }
+    if (thread < rounds.numThreads) {
+      rounds.loads ? runLoads(thread) : runStores(thread);
+    }
+    rounds.finished.fetch_add(1, std::memory_order_acq_rel);
+  }
+}
+
+// Runs one round on the first numThreads threads and returns their accesses per second
+double runRound(std::size_t numWorkers, std::size_t numThreads, bool loads) {
+  rounds.numThreads = numThreads;
+  rounds.loads = loads;
+  rounds.finished.store(0, std::memory_order_relaxed);
+  const auto start = std::chrono::steady_clock::now();
+  rounds.generation.fetch_add(1, std::memory_order_acq_rel);
+  while (rounds.finished.load(std::memory_order_acquire) != numWorkers) {
+    std::this_thread::yield();
+  }
+  return numThreads * rounds.numOps / seconds(std::chrono::steady_clock::now() - start);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  rounds.numOps = (argc > 1) ? std::strtoull(argv[1], nullptr, 0) : (1 << 16);
+  rounds.window = (argc > 2) ? std::strtoull(argv[2], nullptr, 0) : 256;
+  const std::size_t maxThreads = std::min<std::size_t>((argc > 3) ? std::strtoull(argv[3], nullptr, 0) : 64, 64);
+
+  if (initialize(2) != OK || world.size < 2) {
+    std::fprintf(stderr, "thread_scaling_bench needs 2 ranks\n");
+    return 1;
+  }
+
+  // rank 1 owns the array. its address is broadcast, since it can differ between ranks.
+  void* localBase = targetArray;
+  gex_Event_Wait(gex_Coll_BroadcastNB(world.team, 1, &rounds.base, &localBase, sizeof(rounds.base), 0));
+
+  if (world.rank == 0) {
+    rounds.sliceSize = arraySize / maxThreads;
+    std::vector<std::thread> workers;
+    for (std::size_t thread = 0; thread < maxThreads; ++thread) {
+      workers.emplace_back(worker, thread);
+    }
+
+    for (std::size_t numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+      const auto stores = runRound(maxThreads, numThreads, false);
+      const auto loads = runRound(maxThreads, numThreads, true);
+      std::printf("%3zu threads: %12.0f stores/s %12.0f loads/s (%zu ops per thread, window %zu, "
+                  "thread endpoints %s)\n",
+                  numThreads, stores, loads, rounds.numOps, rounds.window, threadEndpoints ? "on" : "off");
+    }
+
+    rounds.stop.store(true, std::memory_order_relaxed);
+    rounds.generation.fetch_add(1, std::memory_order_acq_rel);
+    for (auto& thread : workers) {
+      thread.join();
+    }
+  }
+
+  gex_Event_Wait(gex_Coll_BarrierNB(world.team, 0));
+  return finalize() == OK ? 0 : 1;
+}
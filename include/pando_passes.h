@@ -0,0 +1,145 @@
+#ifndef PANDO_PASSES_H
+#define PANDO_PASSES_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/PassManager.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace llvm {
+
+// metadata kind marking a load, store or alloca the load-store pass must leave native
+constexpr const char *LocalMetadata = "pando.local";
+
+// metadata kind marking a load or store whose address is known to carry a tag. The load-store pass
+// calls the runtime's `_nocheck` variant, which skips the tag check.
+constexpr const char *GlobalMetadata = "pando.global";
+
+// metadata kind holding the site id of a load, store or alloca: !{i64 id}. Ids are assigned by
+// `load-store-pass<profile>` (and by SiteProfile::assignSites, which numbers sites the same way).
+constexpr const char *SiteMetadata = "pando.site";
+
+// metadata kind marking a global that every node keeps its own copy of. Nothing writes it, so
+// `globalize-pass` leaves its loads native.
+constexpr const char *ReplicatedMetadata = "pando.replicated";
+
+// section of the globals the GASNet runtime moves to its symmetric heap at initialize(). Their
+// native address is stale afterwards: only the address returned by globalify may be accessed.
+constexpr const char *SymHeapSection = "pando_symheap";
+
+// bits of an address below the tag
+constexpr uint64_t AddressMask = 0x0000FFFFFFFFFFFFull;
+
+// Returns the address ptr with the tag masked off, for a native access
+inline Value *nativePointer(IRBuilder<> &builder, Value *ptr) {
+    return builder.CreateIntrinsic(Intrinsic::ptrmask, {ptr->getType(), builder.getInt64Ty()},
+                                   {ptr, builder.getInt64(AddressMask)}, nullptr, "native_ptr");
+}
+
+// Returns true for the address-tag functions, whose results only depend on their argument.
+inline bool isPandoTagFunction(StringRef name) {
+    return name == "check_if_global" ||
+           name == "deglobalify" ||
+           name == "globalify";
+}
+
+// Returns true for the PANDO runtime functions. Their bodies are never instrumented.
+inline bool isPandoRuntimeFunction(StringRef name) {
+    return name.starts_with("__pando__") || isPandoTagFunction(name);
+}
+
+// Returns true for calls that copy or fill memory: llvm.memcpy, llvm.memmove and llvm.memset, and
+// the libc functions. The load-store pass lowers them to `__pando__memcpy` / `__pando__memset`, so
+// they get tagged addresses.
+inline bool isMemoryTransfer(const CallBase &call) {
+    if (isa<MemIntrinsic>(call)) {
+        return true;
+    }
+    const Function *callee = call.getCalledFunction();
+    if (!callee || !callee->isDeclaration()) {
+        return false;
+    }
+    StringRef name = callee->getName();
+    return name == "memcpy" || name == "memmove" || name == "memset";
+}
+
+// How a site behaved in the training runs of a profile
+enum class SiteClass {
+    Local,  // every access was to this node's memory
+    Remote, // most accesses went to other nodes
+    Mixed,
+};
+
+// Per-site counts of `load-store-pass<profile>` runs, read from the GASNet runtime's
+// pando_profile.<rank>.csv files (several may be concatenated into one file).
+class SiteProfile {
+public:
+    // Reads the profile at path. Reports why and returns false if it cannot be read.
+    bool load(StringRef path, StringRef passName);
+
+    // Numbers the loads, stores and allocas of f in order, as `load-store-pass<profile>` does, and
+    // records the ids as `pando.site` metadata. Sites numbered earlier keep their id.
+    static void assignSites(Function &f);
+
+    // Returns how the site of instr behaved, or nothing if it was never reached in training.
+    std::optional<SiteClass> classify(const Instruction &instr) const;
+
+    // Warns about functions of m that changed since the training runs (sites past the end of the
+    // function, ids of another function, moved lines) and drops their counts. Sites must be
+    // numbered already.
+    void check(Module &m, StringRef passName);
+
+private:
+    struct Counts {
+        std::string function;
+        unsigned line = 0;
+        uint64_t localHits = 0;
+        uint64_t remoteHits = 0;
+    };
+
+    DenseMap<uint64_t, Counts> sites;
+};
+
+// Removes redundant globalify/deglobalify/check_if_global calls left behind by the
+// globalize and load-store passes.
+struct GlobalizeCleanupPass : public PassInfoMixin<GlobalizeCleanupPass> {
+    PreservedAnalyses run(Module &m, ModuleAnalysisManager &mam);
+};
+
+// Coalesces affine loop accesses to a global into one bulk get before the loop and one bulk
+// put after it. Runs between the globalize and load-store passes.
+struct CoalescePass : public PassInfoMixin<CoalescePass> {
+    PreservedAnalyses run(Module &m, ModuleAnalysisManager &mam);
+};
+
+// Gives hot leaf functions whose accesses all go through pointer arguments (or stack slots and
+// globals) an uninstrumented clone, called when every such argument is local. Runs between the
+// globalize and load-store passes.
+struct CloneLocalPass : public PassInfoMixin<CloneLocalPass> {
+    PreservedAnalyses run(Module &m, ModuleAnalysisManager &mam);
+};
+
+// Runs calls to functions annotated pando_ship at the owner of their first pointer argument:
+// each call becomes a `__pando__ship` of a thunk and the packed arguments. Runs between the
+// globalize and load-store passes.
+struct ShipPass : public PassInfoMixin<ShipPass> {
+    PreservedAnalyses run(Module &m, ModuleAnalysisManager &mam);
+};
+
+// Proves where the pointers of the module point, across phis, selects, GEPs, arguments and returns
+// of internal functions: accesses to this node's memory are marked `pando.local` (with the tag
+// masked off) and accesses through tagged addresses `pando.global`. Runs between the globalize and
+// load-store passes.
+struct ProvenancePass : public PassInfoMixin<ProvenancePass> {
+    PreservedAnalyses run(Module &m, ModuleAnalysisManager &mam);
+};
+
+} // namespace llvm
+
+#endif // PANDO_PASSES_H
@@ -1,5 +1,28 @@
-#include <cstdint>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
 #include "gasnet.h"
 #include "gasnet_coll.h"
 
@@ -8,6 +31,12 @@ enum class AMType : std::size_t {
   GenericRequest = 0x0,
   Load,
   Store,
+  Atomic,
+  LoadAck,
+  Ack,
+  ValueAck,
+  Batch,
+  BatchAck,
   Count,
 };
 
@@ -57,12 +86,318 @@ void* unpack(void* buffer, T&... t) noexcept {
   return p;
 }
 
-// Processes a generic request
-void handleRequest(gex_Token_t, void*, size_t);
+// Sends the aggregated requests of every destination. Called before waiting on a handle.
+void flushAggregation();
+
+namespace Nodes {
+
+// Id of a completion slot. A request carries the id of the slot its reply completes, which fits
+// in one AM argument where a pointer to a handle needed two.
+using CompletionId = std::uint32_t;
+
+constexpr CompletionId invalidCompletionId = ~CompletionId{0};
+
+// Completion slot of a remote operation, on its own cache line so that threads waiting on
+// neighbouring slots do not share lines. A reply copies its payload to dst or, if dst is null,
+// keeps up to sizeof(value) bytes in the slot. An RMA operation writes there itself, and the slot
+// holds its event until it completes.
+struct alignas(64) CompletionSlot {
+  enum State : std::uint32_t {
+    Free,
+    Pending,
+    // the reply is being copied out
+    Completing,
+    Ready,
+    // released while pending: the reply frees the slot
+    Abandoned,
+  };
+
+  std::atomic<std::uint32_t> state{Free};
+  void* dst{nullptr};
+  // only touched by the thread holding the slot
+  gex_Event_t event{GEX_EVENT_INVALID};
+  alignas(std::uint64_t) std::byte value[sizeof(std::uint64_t)];
+};
+
+// Preallocated completion slots of all remote operations of this rank. Every thread takes slots
+// from its own partition of the pool with a private cursor, so threads issuing at once neither lock
+// nor share a cache line. A thread whose partition is all held goes on with a shared cursor over the
+// whole pool, advanced with one atomic increment. Slots still held by earlier operations are
+// skipped. Threads beyond numPartitions share partitions, which stays correct, only slower.
+class CompletionPool {
+public:
+  static constexpr std::size_t numSlots = std::size_t{1} << 16;
+  static constexpr std::size_t numPartitions = 64;
+  static constexpr std::size_t partitionSize = numSlots / numPartitions;
+
+  // Takes a free slot for a reply copied to dst, or kept in the slot if dst is null
+  CompletionId acquire(void* dst) noexcept {
+    thread_local Partition partition{
+        (m_nextPartition.fetch_add(1, std::memory_order_relaxed) % numPartitions) * partitionSize};
+    for (std::size_t i = 0; i < partitionSize; ++i) {
+      const auto id = static_cast<CompletionId>(partition.base + (partition.cursor++ & (partitionSize - 1)));
+      if (tryAcquire(id, dst)) {
+        return id;
+      }
+    }
+
+    for (std::size_t attempts = 1;; ++attempts) {
+      const auto id = static_cast<CompletionId>(m_cursor.fetch_add(1, std::memory_order_relaxed) & (numSlots - 1));
+      if (tryAcquire(id, dst)) {
+        return id;
+      }
+      // every slot is held: send the aggregated requests so that their replies free some
+      if (attempts % numSlots == 0) {
+        flushAggregation();
+        gasnet_AMPoll();
+      }
+    }
+  }
+
+  // Completes a slot with the n bytes of a reply
+  void complete(CompletionId id, const void* buffer, std::size_t n) noexcept {
+    auto& slot = m_slots[id];
+    std::uint32_t expected = CompletionSlot::Pending;
+    if (!slot.state.compare_exchange_strong(expected, CompletionSlot::Completing, std::memory_order_acquire)) {
+      // nobody waits for this reply any more
+      assert(expected == CompletionSlot::Abandoned);
+      slot.state.store(CompletionSlot::Free, std::memory_order_release);
+      return;
+    }
+    if (n != 0) {
+      assert(slot.dst != nullptr || n <= sizeof(slot.value));
+      std::memcpy(slot.dst != nullptr ? slot.dst : slot.value, buffer, n);
+    }
+    slot.state.store(CompletionSlot::Ready, std::memory_order_release);
+  }
+
+  // Returns where the payload of a slot goes: dst, or the slot itself
+  void* replyBuffer(CompletionId id) const noexcept {
+    auto& slot = m_slots[id];
+    return (slot.dst != nullptr) ? slot.dst : slot.value;
+  }
+
+  // Completes a pending slot when event completes, for an RMA operation. An invalid event completed
+  // at once.
+  void track(CompletionId id, gex_Event_t event) noexcept {
+    auto& slot = m_slots[id];
+    assert(slot.state.load(std::memory_order_relaxed) == CompletionSlot::Pending);
+    if (event == GEX_EVENT_INVALID) {
+      slot.state.store(CompletionSlot::Ready, std::memory_order_release);
+    } else {
+      slot.event = event;
+    }
+  }
+
+  bool ready(CompletionId id) const noexcept {
+    auto& slot = m_slots[id];
+    if (slot.event != GEX_EVENT_INVALID && gex_Event_Test(slot.event) == GASNET_OK) {
+      slot.event = GEX_EVENT_INVALID;
+      slot.state.store(CompletionSlot::Ready, std::memory_order_release);
+    }
+    return slot.state.load(std::memory_order_acquire) == CompletionSlot::Ready;
+  }
+
+  // Returns the payload kept in a ready slot
+  const std::byte* value(CompletionId id) const noexcept {
+    return m_slots[id].value;
+  }
+
+  // Frees the slot of a request that was never sent, which no reply will free
+  void cancel(CompletionId id) noexcept {
+    assert(m_slots[id].state.load(std::memory_order_relaxed) == CompletionSlot::Pending);
+    m_slots[id].state.store(CompletionSlot::Free, std::memory_order_release);
+  }
+
+  // Gives a slot back. A slot whose reply has not arrived is freed by the reply, and one whose RMA
+  // operation has not completed waits for it, since it still writes to the slot's buffer.
+  void release(CompletionId id) noexcept {
+    auto& slot = m_slots[id];
+    if (slot.event != GEX_EVENT_INVALID) {
+      gex_Event_Wait(slot.event);
+      slot.event = GEX_EVENT_INVALID;
+      slot.state.store(CompletionSlot::Ready, std::memory_order_relaxed);
+    }
+    std::uint32_t expected = CompletionSlot::Ready;
+    while (!slot.state.compare_exchange_weak(expected, CompletionSlot::Free, std::memory_order_release)) {
+      if (expected == CompletionSlot::Pending &&
+          slot.state.compare_exchange_strong(expected, CompletionSlot::Abandoned, std::memory_order_relaxed)) {
+        return;
+      }
+      // wait out a reply being copied
+      expected = CompletionSlot::Ready;
+    }
+  }
+
+private:
+  // slots [base, base + partitionSize) of a thread, searched from base + cursor
+  struct Partition {
+    std::size_t base;
+    std::size_t cursor{0};
+  };
+
+  bool tryAcquire(CompletionId id, void* dst) noexcept {
+    auto& slot = m_slots[id];
+    std::uint32_t expected = CompletionSlot::Free;
+    if (!slot.state.compare_exchange_strong(expected, CompletionSlot::Pending, std::memory_order_acquire)) {
+      return false;
+    }
+    slot.dst = dst;
+    return true;
+  }
+
+  std::unique_ptr<CompletionSlot[]> m_slots{new CompletionSlot[numSlots]};
+  alignas(64) std::atomic<std::size_t> m_cursor{0};
+  alignas(64) std::atomic<std::size_t> m_nextPartition{0};
+};
+
+CompletionPool completions;
+
+// Result of a remote operation, backed by a completion slot. A future for a load copies the
+// reply to its destination buffer; other futures keep the reply (e.g. the old value of an atomic)
+// in the slot. The slot is given back when the future is destroyed.
+class Future {
+  CompletionId m_id;
+
+public:
+  Future() noexcept : m_id(completions.acquire(nullptr)) {}
+
+  explicit Future(void* dst) noexcept : m_id(completions.acquire(dst)) {}
+
+  Future(Future&& other) noexcept : m_id(std::exchange(other.m_id, invalidCompletionId)) {}
+
+  Future& operator=(Future&& other) noexcept {
+    if (this != &other) {
+      reset();
+      m_id = std::exchange(other.m_id, invalidCompletionId);
+    }
+    return *this;
+  }
+
+  Future(const Future&) = delete;
+  Future& operator=(const Future&) = delete;
+
+  ~Future() {
+    reset();
+  }
+
+  // Takes over the slot of a future given up with detach()
+  static Future adopt(CompletionId id) noexcept {
+    return Future{id};
+  }
+
+  // Gives up the slot without releasing it, e.g. to pass it through C code as an integer
+  CompletionId detach() noexcept {
+    return std::exchange(m_id, invalidCompletionId);
+  }
+
+  CompletionId id() const noexcept {
+    return m_id;
+  }
+
+  // Gives the slot back for a request that failed before it was sent
+  void cancel() noexcept {
+    if (m_id != invalidCompletionId) {
+      completions.cancel(m_id);
+      m_id = invalidCompletionId;
+    }
+  }
+
+  // Completes the future locally, for operations that did not need a message
+  void setReady(const void* buffer, std::size_t byteCount) noexcept {
+    completions.complete(m_id, buffer, byteCount);
+  }
+
+  bool ready() const noexcept {
+    return completions.ready(m_id);
+  }
+
+  void wait() const noexcept {
+    if (!ready()) {
+      flushAggregation();
+    }
+    GASNET_BLOCKUNTIL(ready());
+  }
+
+  // Returns the reply kept in the slot of a ready future
+  template <typename T>
+  T value() const noexcept {
+    static_assert(sizeof(T) <= sizeof(CompletionSlot::value));
+    T value;
+    std::memcpy(&value, completions.value(m_id), sizeof(T));
+    return value;
+  }
+
+private:
+  explicit Future(CompletionId id) noexcept : m_id(id) {}
+
+  void reset() noexcept {
+    if (m_id != invalidCompletionId) {
+      completions.release(m_id);
+      m_id = invalidCompletionId;
+    }
+  }
+};
+
+// Waits for every future of a container
+template <typename Futures>
+void waitAll(const Futures& futures) {
+  flushAggregation();
+  for (const auto& future : futures) {
+    GASNET_BLOCKUNTIL(future.ready());
+  }
+}
+
+// Waits for one future of a container and returns its index, or the container's size if it is
+// empty
+template <typename Futures>
+std::size_t waitAny(const Futures& futures) {
+  std::size_t index = 0;
+  for (bool flushed = false; !futures.empty(); flushed = true) {
+    index = 0;
+    for (const auto& future : futures) {
+      if (future.ready()) {
+        return index;
+      }
+      ++index;
+    }
+    if (!flushed) {
+      flushAggregation();
+    }
+    gasnet_AMPoll();
+  }
+  return index;
+}
+
+} // namespace Nodes
+
+extern "C" {
+  int check_if_global(void* ptr);
+  void* deglobalify(void* ptr);
+  void* globalify(void* ptr);
+  void __pando__fence();
+  void* __pando__memcpy(void* dst, const void* src, size_t n);
+  void* __pando__memset(void* dst, int value, size_t n);
+}
+
+// Processes a request to run a shipped function
+void handleRequest(gex_Token_t, void*, size_t, gex_AM_Arg_t completionId);
 // Processes a load request
-void handleLoad(gex_Token_t, void*, size_t, gex_AM_Arg_t handlePtrHi, gex_AM_Arg_t handlePtrLo);
+void handleLoad(gex_Token_t, void*, size_t, gex_AM_Arg_t completionId);
 // Processes a store request
-void handleStore(gex_Token_t, void*, size_t, gex_AM_Arg_t handlePtrHi, gex_AM_Arg_t handlePtrLo);
+void handleStore(gex_Token_t, void*, size_t, gex_AM_Arg_t completionId);
+// Processes an atomic request
+void handleAtomic(gex_Token_t, void*, size_t, gex_AM_Arg_t completionId);
+// Processes an ack for a load
+void handleLoadAck(gex_Token_t, void*, size_t, gex_AM_Arg_t completionId);
+// Processes an ack
+void handleAck(gex_Token_t, gex_AM_Arg_t completionId);
+// Processes an ack with a value
+void handleValueAck(gex_Token_t, void*, size_t, gex_AM_Arg_t completionId);
+// Processes a batch of load and store records
+void handleBatch(gex_Token_t, void*, size_t);
+// Processes the values and acks replied to a batch
+void handleBatchAck(gex_Token_t, void*, size_t);
 
 struct {
   std::string_view clientName = "pando-rt";
@@ -71,84 +406,665 @@ struct {
   gex_Client_t client{GEX_CLIENT_INVALID};
   gex_EP_t endpoint{GEX_EP_INVALID};
   gex_TM_t team{GEX_TM_INVALID};
-  std::atomic<bool> pollingThreadActive{true};
-  std::thread pollingThread;
+  gex_Segment_t segment{GEX_SEGMENT_INVALID};
+  // bound segment of every rank, in the owner's address space. empty if no segment is attached.
+  std::vector<std::pair<std::uintptr_t, std::size_t>> segments;
 
   gex_AM_Entry_t htable[+AMType::Count] = {
-      // generic request
+      // generic request: a call shipped to this rank
       {0, reinterpret_cast<gex_AM_Fn_t>(&handleRequest), (GEX_FLAG_AM_REQUEST | GEX_FLAG_AM_MEDIUM),
-       0, nullptr, nullptr},
+       1, nullptr, nullptr},
 
       // load / store
       {0, reinterpret_cast<gex_AM_Fn_t>(&handleLoad), (GEX_FLAG_AM_REQUEST | GEX_FLAG_AM_MEDIUM),
-       ptrNArgs, nullptr, nullptr},
+       1, nullptr, nullptr},
       {0, reinterpret_cast<gex_AM_Fn_t>(&handleStore), (GEX_FLAG_AM_REQUEST | GEX_FLAG_AM_MEDIUM),
-       ptrNArgs, nullptr, nullptr},
+       1, nullptr, nullptr},
+      {0, reinterpret_cast<gex_AM_Fn_t>(&handleAtomic), (GEX_FLAG_AM_REQUEST | GEX_FLAG_AM_MEDIUM),
+       1, nullptr, nullptr},
 
       // acks
       {0, reinterpret_cast<gex_AM_Fn_t>(&handleLoadAck), (GEX_FLAG_AM_REQREP | GEX_FLAG_AM_MEDIUM),
-       ptrNArgs, nullptr, nullptr},
+       1, nullptr, nullptr},
       {0, reinterpret_cast<gex_AM_Fn_t>(&handleAck), (GEX_FLAG_AM_REQREP | GEX_FLAG_AM_SHORT),
-       ptrNArgs, nullptr, nullptr},
+       1, nullptr, nullptr},
       {0, reinterpret_cast<gex_AM_Fn_t>(&handleValueAck), (GEX_FLAG_AM_REQREP | GEX_FLAG_AM_MEDIUM),
-       ptrNArgs, nullptr, nullptr},
+       1, nullptr, nullptr},
+
+      // aggregated load / store records and their acks
+      {0, reinterpret_cast<gex_AM_Fn_t>(&handleBatch), (GEX_FLAG_AM_REQUEST | GEX_FLAG_AM_MEDIUM),
+       0, nullptr, nullptr},
+      {0, reinterpret_cast<gex_AM_Fn_t>(&handleBatchAck), (GEX_FLAG_AM_REQREP | GEX_FLAG_AM_MEDIUM),
+       0, nullptr, nullptr},
   };
 } world;
 
 enum Status : size_t {
   OK = 0x0,
   GASNET_INIT_ERROR = 0x1,
-  PANDO_OUT_OF_BOUNDS = 0x2;
-  PANDO_BAD_ALLOC = 0x3;
+  PANDO_OUT_OF_BOUNDS = 0x2,
+  PANDO_BAD_ALLOC = 0x3,
+  PANDO_INVALID_CONFIG = 0x4,
 };
 
 using GlobalAddress = void*;
 
-Status remoteLoad8(uint64_t nodeIdx, GlobalAddress srcAddr LoadHandle& handle) {
+extern "C" {
+  // address tag of this node's global addresses, read inline by the load-store pass's fast path
+  uint64_t __pando__local_tag = 0;
+}
+
+// Returns the rank owning a global address. Untagged addresses are local.
+std::uint64_t ownerOf(GlobalAddress addr) noexcept {
+  const auto tag = reinterpret_cast<std::uintptr_t>(addr) >> 48;
+  return (tag == 0) ? world.rank : (0xFFFF - tag);
+}
+
+// Returns the address of a global address in its owner's address space
+std::uintptr_t nativeAddress(GlobalAddress addr) noexcept {
+  return reinterpret_cast<std::uintptr_t>(addr) & ((std::uintptr_t{1} << 48) - 1);
+}
+
+// Returns true if n bytes at addr lie in the bound segment of nodeIdx, so RMA can access them
+bool inSegment(std::uint64_t nodeIdx, GlobalAddress addr, std::size_t n) noexcept {
+  if (nodeIdx >= world.segments.size()) {
+    return false;
+  }
+  const auto [base, size] = world.segments[nodeIdx];
+  const auto native = nativeAddress(addr);
+  return native >= base && n <= size && native - base <= size - n;
+}
+
+// Returns a global address offset by n bytes. The tag bits are left untouched.
+GlobalAddress offsetAddress(GlobalAddress addr, std::size_t n) noexcept {
+  return static_cast<std::byte*>(addr) + n;
+}
+
+// Loads and stores of memory in the owner's segment use RMA, without running a handler on the
+// owner. Set at initialize(): on unless PANDO_RMA=0.
+bool rmaAccesses{false};
+
+// bounds of the pando_symheap section, defined by the linker if the program has one
+extern "C" {
+  extern char __start_pando_symheap[] __attribute__((weak));
+  extern char __stop_pando_symheap[] __attribute__((weak));
+}
+
+// Symmetric heap in this rank's segment. Every rank lays out the same objects at the same offsets
+// of its segment: the globals of the pando_symheap section first, then the blocks of pando_malloc,
+// which ranks call collectively (in the same order, with the same sizes). The copy of an object
+// on another rank is at the same offset of that rank's segment.
+class SymmetricHeap {
+public:
+  static constexpr std::size_t alignment = 64;
+
+  // Sets up the heap in [base, base + size) and copies the pando_symheap section to its start.
+  // Returns false if the section does not fit.
+  bool init(std::byte* base, std::size_t size, const std::byte* section, std::size_t sectionSize) {
+    if (sectionSize > size) {
+      return false;
+    }
+    if (sectionSize != 0) {
+      std::memcpy(base, section, sectionSize);
+    }
+    m_base = base;
+    m_section = section;
+    m_sectionSize = sectionSize;
+    const auto start = alignUp(sectionSize);
+    if (start < size) {
+      m_free.emplace(start, size - start);
+    }
+    return true;
+  }
+
+  // Returns the address in the heap of a pointer into the pando_symheap section. Other pointers
+  // are returned unchanged.
+  void* relocate(void* ptr) const noexcept {
+    const auto offset = reinterpret_cast<std::uintptr_t>(ptr) - reinterpret_cast<std::uintptr_t>(m_section);
+    return (offset < m_sectionSize) ? m_base + offset : ptr;
+  }
+
+  // Allocates n bytes, first fit. Returns null if no free block is large enough.
+  void* allocate(std::size_t n) {
+    n = alignUp(std::max<std::size_t>(n, 1));
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto block = m_free.begin(); block != m_free.end(); ++block) {
+      if (block->second < n) {
+        continue;
+      }
+      const auto [offset, size] = *block;
+      m_free.erase(block);
+      if (size > n) {
+        m_free.emplace(offset + n, size - n);
+      }
+      m_used.emplace(offset, n);
+      return m_base + offset;
+    }
+    return nullptr;
+  }
+
+  // Frees a block returned by allocate, merging it with its free neighbours. Returns false if ptr
+  // is not an allocated block.
+  bool free(void* ptr) {
+    const auto offset = static_cast<std::size_t>(static_cast<std::byte*>(ptr) - m_base);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto used = m_used.find(offset);
+    if (m_base == nullptr || used == m_used.end()) {
+      return false;
+    }
+    auto size = used->second;
+    m_used.erase(used);
+
+    auto next = m_free.lower_bound(offset);
+    if (next != m_free.end() && offset + size == next->first) {
+      size += next->second;
+      next = m_free.erase(next);
+    }
+    if (next != m_free.begin()) {
+      auto prev = std::prev(next);
+      if (prev->first + prev->second == offset) {
+        prev->second += size;
+        return true;
+      }
+    }
+    m_free.emplace(offset, size);
+    return true;
+  }
+
+private:
+  static std::size_t alignUp(std::size_t n) noexcept {
+    return (n + alignment - 1) & ~(alignment - 1);
+  }
+
+  std::byte* m_base{nullptr};
+  const std::byte* m_section{nullptr};
+  std::size_t m_sectionSize{0};
+  std::mutex m_mutex;
+  // offset -> size of the free and the allocated blocks
+  std::map<std::size_t, std::size_t> m_free;
+  std::map<std::size_t, std::size_t> m_used;
+};
+
+SymmetricHeap symmetricHeap;
+
+// Endpoints of the threads that issue requests. Set at initialize(): off unless
+// PANDO_THREAD_ENDPOINTS=1.
+bool threadEndpoints{false};
+
+// Returns the team the calling thread sends its requests through. With thread endpoints, a thread
+// creates its own endpoint on first use and sends through a pair team from it to the primordial
+// endpoint of every rank, so that threads do not share one endpoint's injection resources and get
+// their replies on their own endpoint. Otherwise, or once the conduit has no endpoint left, it is
+// the primordial team. RMA always uses the primordial team, the segment is bound to its endpoint.
+gex_TM_t injectionTeam() noexcept {
+  thread_local const gex_TM_t team = []() noexcept {
+    if (!threadEndpoints) {
+      return world.team;
+    }
+    gex_EP_t endpoint = GEX_EP_INVALID;
+    const gex_Flags_t flags = 0;
+    if (gex_EP_Create(&endpoint, world.client, GEX_EP_CAPABILITY_AM, flags) != GASNET_OK) {
+      return world.team;
+    }
+    // the handlers keep the indices the primordial endpoint assigned, which requests carry
+    gex_AM_Entry_t htable[+AMType::Count];
+    std::copy(std::begin(world.htable), std::end(world.htable), std::begin(htable));
+    if (gex_EP_RegisterHandlers(endpoint, htable, +AMType::Count) != GASNET_OK) {
+      return world.team;
+    }
+    const gex_EP_Index_t primordialIndex = 0;
+    return gex_TM_Pair(endpoint, primordialIndex);
+  }();
+  return team;
+}
+
+// Where a request handler sends its reply. A handler running in the AM handler context replies
+// on its token. A handler deferred to a worker thread no longer has a token, so its reply goes out
+// as a request to the rank that sent the message; the ack handlers accept both.
+class Reply {
+public:
+  explicit Reply(gex_Token_t token) noexcept : m_token(token) {}
+  explicit Reply(gex_Rank_t srcRank) noexcept : m_srcRank(srcRank), m_deferred(true) {}
+
+  int shortMessage(AMType type, gex_AM_Arg_t arg) {
+    const auto flags = 0;
+    const auto index = world.htable[+type].gex_index;
+    if (m_deferred) {
+      return gex_AM_RequestShort(injectionTeam(), m_srcRank, index, flags, arg);
+    }
+    return gex_AM_ReplyShort(m_token, index, flags, arg);
+  }
+
+  int medium(AMType type, const void* buffer, std::size_t n) {
+    const auto flags = 0;
+    const auto index = world.htable[+type].gex_index;
+    if (m_deferred) {
+      return gex_AM_RequestMedium(injectionTeam(), m_srcRank, index, buffer, n, GEX_EVENT_NOW, flags);
+    }
+    return gex_AM_ReplyMedium(m_token, index, buffer, n, GEX_EVENT_NOW, flags);
+  }
+
+  int medium(AMType type, const void* buffer, std::size_t n, gex_AM_Arg_t arg) {
+    const auto flags = 0;
+    const auto index = world.htable[+type].gex_index;
+    if (m_deferred) {
+      return gex_AM_RequestMedium(injectionTeam(), m_srcRank, index, buffer, n, GEX_EVENT_NOW, flags, arg);
+    }
+    return gex_AM_ReplyMedium(m_token, index, buffer, n, GEX_EVENT_NOW, flags, arg);
+  }
+
+private:
+  gex_Token_t m_token{};
+  gex_Rank_t m_srcRank{GEX_RANK_INVALID};
+  bool m_deferred{false};
+};
+
+// Replies to a request with an ack carrying no payload
+void sendAck(Reply& reply, gex_AM_Arg_t completionId) {
+  if (auto status = reply.shortMessage(AMType::Ack, completionId); status != GASNET_OK) {
+    std::abort();
+  }
+}
+
+// Records of an aggregated batch, processed in order by the destination.
+//  load:  Load, src, n, id        replied as  Load, id, n, n bytes of data
+//  store: Store, dst, n, id, data replied as  Store, id
+// where id is the completion slot of the access
+enum class RecordKind : std::uint8_t {
+  Load,
+  Store,
+};
+using RecordSize = std::uint32_t;
+
+// Outgoing load and store records of every thread for every destination rank. Each thread has its
+// own buffers, so threads issuing at once do not contend. The records of a thread to a destination
+// are packed into one medium AM, sent when the buffer is full, when its oldest record is older than
+// the timeout (checked by the polling thread), or before the thread waits on a future. Loads and
+// stores share a buffer, so the destination applies a thread's accesses in the order it issued them.
+class Aggregator {
+public:
+  // Sets up the buffers of one rank. Aggregation stays off if enabled is false.
+  void init(std::uint64_t numRanks, bool enabled, std::chrono::microseconds timeout) {
+    m_enabled.store(enabled, std::memory_order_relaxed);
+    m_timeout = timeout;
+    m_numRanks = numRanks;
+    m_requestCapacity = gex_AM_LUBRequestMedium();
+    m_replyCapacity = gex_AM_LUBReplyMedium();
+  }
+
+  bool enabled() const noexcept {
+    return m_enabled.load(std::memory_order_relaxed);
+  }
+
+  // Returns true if an access of n bytes is aggregated. Larger payloads gain little from sharing a
+  // message and are sent on their own.
+  bool aggregates(std::size_t n) const noexcept {
+    return enabled() && n <= maxRecordPayload;
+  }
+
+  // Turns aggregation on or off. The records buffered by every thread are sent first.
+  Status setEnabled(bool enabled) {
+    auto status = flushAll();
+    m_enabled.store(enabled, std::memory_order_relaxed);
+    return status;
+  }
+
+  std::chrono::microseconds timeout() const noexcept {
+    return m_timeout;
+  }
+
+  // Adds a load of n bytes at srcAddr on nodeIdx
+  Status load(std::uint64_t nodeIdx, GlobalAddress srcAddr, std::size_t n, const Nodes::Future& future) {
+    const auto kind = RecordKind::Load;
+    const auto id = future.id();
+    const auto requestSize = packedSize(kind, srcAddr, RecordSize{}, id);
+    const auto replySize = packedSize(kind, id, RecordSize{}) + n;
+    return add(nodeIdx, requestSize, replySize, [&](std::byte* record) {
+      pack(record, kind, srcAddr, static_cast<RecordSize>(n), id);
+    });
+  }
+
+  // Adds a store of n bytes from srcPtr to dstAddr on nodeIdx
+  Status store(std::uint64_t nodeIdx, GlobalAddress dstAddr, const void* srcPtr, std::size_t n,
+               const Nodes::Future& future) {
+    const auto kind = RecordKind::Store;
+    const auto id = future.id();
+    const auto requestSize = packedSize(kind, dstAddr, RecordSize{}, id) + n;
+    const auto replySize = packedSize(kind, id);
+    return add(nodeIdx, requestSize, replySize, [&](std::byte* record) {
+      auto data = pack(record, kind, dstAddr, static_cast<RecordSize>(n), id);
+      std::memcpy(data, srcPtr, n);
+    });
+  }
+
+  // A lane of a gather or scatter: the address it accesses, its completion, and for a store the
+  // bytes to write
+  struct Lane {
+    GlobalAddress addr;
+    const Nodes::Future* future;
+    const void* data;
+  };
+
+  // Sends loads (or stores) of n bytes for lanes to nodeIdx, packed into as few batches as fit,
+  // whether aggregation is on or not. The records already buffered for nodeIdx are sent first.
+  Status batch(std::uint64_t nodeIdx, RecordKind kind, const std::vector<Lane>& lanes, std::size_t n) {
+    if (nodeIdx >= m_numRanks) {
+      return PANDO_OUT_OF_BOUNDS;
+    }
+    if (auto status = flush(nodeIdx); status != OK) {
+      return status;
+    }
+
+    Buffer buffer;
+    for (const auto& lane : lanes) {
+      const auto id = lane.future->id();
+      const auto requestSize = packedSize(kind, lane.addr, RecordSize{}, id) + (kind == RecordKind::Store ? n : 0);
+      const auto replySize = (kind == RecordKind::Load) ? packedSize(kind, id, RecordSize{}) + n : packedSize(kind, id);
+      if (requestSize > m_requestCapacity || replySize > m_replyCapacity) {
+        return PANDO_BAD_ALLOC;
+      }
+      if (buffer.records.size() + requestSize > m_requestCapacity ||
+          buffer.replySize + replySize > m_replyCapacity) {
+        if (auto status = send(nodeIdx, buffer); status != OK) {
+          return status;
+        }
+        buffer = Buffer{};
+      }
+      const auto offset = buffer.records.size();
+      buffer.records.resize(offset + requestSize);
+      auto data = pack(buffer.records.data() + offset, kind, lane.addr, static_cast<RecordSize>(n), id);
+      if (kind == RecordKind::Store) {
+        std::memcpy(data, lane.data, n);
+      }
+      buffer.replySize += replySize;
+    }
+    return send(nodeIdx, buffer);
+  }
+
+  // Sends the records this thread buffered for every destination
+  Status flush() {
+    if (!enabled()) {
+      return OK;
+    }
+    auto& buffers = threadBuffers();
+    Status status = OK;
+    for (std::uint64_t nodeIdx = 0; nodeIdx < buffers.numRanks; ++nodeIdx) {
+      if (auto destStatus = flushDestination(buffers, nodeIdx, std::chrono::steady_clock::time_point::max());
+          destStatus != OK) {
+        status = destStatus;
+      }
+    }
+    return status;
+  }
+
+  // Sends the records this thread buffered for nodeIdx
+  Status flush(std::uint64_t nodeIdx) {
+    if (!enabled()) {
+      return OK;
+    }
+    auto& buffers = threadBuffers();
+    if (nodeIdx >= buffers.numRanks) {
+      return OK;
+    }
+    return flushDestination(buffers, nodeIdx, std::chrono::steady_clock::time_point::max());
+  }
+
+  // Sends the records every thread buffered
+  Status flushAll() {
+    return flushOlderThan(std::chrono::steady_clock::time_point::max());
+  }
+
+  // Sends the buffers, of every thread, whose oldest record has waited longer than the timeout
+  Status flushStale() {
+    return flushOlderThan(std::chrono::steady_clock::now() - m_timeout);
+  }
+
+private:
+  static constexpr std::size_t maxRecordPayload = 256;
+
+  struct Buffer {
+    std::vector<std::byte> records;
+    std::size_t replySize{0};
+    std::chrono::steady_clock::time_point oldest;
+  };
+
+  struct Destination {
+    std::mutex mutex;
+    Buffer buffer;
+  };
+
+  // Buffers of one thread, one per rank, registered while the thread runs. Only the thread adds
+  // records, so the lock of a buffer is contended only when the polling thread sends it for being
+  // stale. The records left when the thread exits are sent then.
+  struct ThreadBuffers {
+    explicit ThreadBuffers(Aggregator& aggregator)
+        : aggregator(aggregator),
+          numRanks(aggregator.m_numRanks),
+          destinations(std::make_unique<Destination[]>(numRanks)) {
+      std::lock_guard<std::mutex> lock(aggregator.m_threadsMutex);
+      aggregator.m_threads.push_back(this);
+    }
+
+    ~ThreadBuffers() {
+      {
+        std::lock_guard<std::mutex> lock(aggregator.m_threadsMutex);
+        auto& threads = aggregator.m_threads;
+        threads.erase(std::find(threads.begin(), threads.end(), this));
+      }
+      for (std::uint64_t nodeIdx = 0; nodeIdx < numRanks; ++nodeIdx) {
+        aggregator.flushDestination(*this, nodeIdx, std::chrono::steady_clock::time_point::max());
+      }
+    }
+
+    ThreadBuffers(const ThreadBuffers&) = delete;
+    ThreadBuffers& operator=(const ThreadBuffers&) = delete;
+
+    Aggregator& aggregator;
+    const std::uint64_t numRanks;
+    std::unique_ptr<Destination[]> destinations;
+  };
+
+  // Returns the calling thread's buffers, registering them on first use
+  ThreadBuffers& threadBuffers() {
+    thread_local ThreadBuffers buffers{*this};
+    return buffers;
+  }
+
+  template <typename PackRecord>
+  Status add(std::uint64_t nodeIdx, std::size_t requestSize, std::size_t replySize,
+             PackRecord packRecord) {
+    auto& buffers = threadBuffers();
+    if (nodeIdx >= buffers.numRanks) {
+      return PANDO_OUT_OF_BOUNDS;
+    }
+    if (requestSize > m_requestCapacity || replySize > m_replyCapacity) {
+      return PANDO_BAD_ALLOC;
+    }
+
+    auto& dest = buffers.destinations[nodeIdx];
+    {
+      Buffer full;
+      {
+        std::lock_guard<std::mutex> lock(dest.mutex);
+        if (dest.buffer.records.size() + requestSize > m_requestCapacity ||
+            dest.buffer.replySize + replySize > m_replyCapacity) {
+          std::swap(full, dest.buffer);
+        }
+      }
+      // a full buffer is sent before the record is added, so a failed add never sends the record
+      if (auto status = send(nodeIdx, full); status != OK) {
+        return status;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(dest.mutex);
+    auto& buffer = dest.buffer;
+    if (buffer.records.empty()) {
+      buffer.oldest = std::chrono::steady_clock::now();
+    }
+    const auto offset = buffer.records.size();
+    buffer.records.resize(offset + requestSize);
+    packRecord(buffer.records.data() + offset);
+    buffer.replySize += replySize;
+    return OK;
+  }
+
+  // Sends the buffers of every thread whose oldest record is older than deadline. Buffers filled
+  // while aggregation was on are sent even if it is off now.
+  Status flushOlderThan(std::chrono::steady_clock::time_point deadline) {
+    Status status = OK;
+    std::lock_guard<std::mutex> lock(m_threadsMutex);
+    for (auto* buffers : m_threads) {
+      for (std::uint64_t nodeIdx = 0; nodeIdx < buffers->numRanks; ++nodeIdx) {
+        if (auto destStatus = flushDestination(*buffers, nodeIdx, deadline); destStatus != OK) {
+          status = destStatus;
+        }
+      }
+    }
+    return status;
+  }
+
+  Status flushDestination(ThreadBuffers& buffers, std::uint64_t nodeIdx,
+                          std::chrono::steady_clock::time_point deadline) {
+    Buffer buffer;
+    {
+      auto& dest = buffers.destinations[nodeIdx];
+      std::lock_guard<std::mutex> lock(dest.mutex);
+      if (!dest.buffer.records.empty() && dest.buffer.oldest <= deadline) {
+        std::swap(buffer, dest.buffer);
+      }
+    }
+    return send(nodeIdx, buffer);
+  }
+
+  Status send(std::uint64_t nodeIdx, const Buffer& buffer) {
+    if (buffer.records.empty()) {
+      return OK;
+    }
+    const gex_Flags_t flags = 0;
+    if (gex_AM_RequestMedium(injectionTeam(), nodeIdx, world.htable[+AMType::Batch].gex_index,
+                             buffer.records.data(), buffer.records.size(), GEX_EVENT_NOW,
+                             flags) != GASNET_OK) {
+      return PANDO_BAD_ALLOC;
+    }
+    return OK;
+  }
+
+  std::atomic<bool> m_enabled{false};
+  std::chrono::microseconds m_timeout{0};
+  std::uint64_t m_numRanks{0};
+  // buffers of the running threads. taken when a thread starts or exits, and to flush all threads.
+  std::mutex m_threadsMutex;
+  std::vector<ThreadBuffers*> m_threads;
+  std::size_t m_requestCapacity{0};
+  std::size_t m_replyCapacity{0};
+};
+
+Aggregator aggregator;
+
+void flushAggregation() {
+  if (aggregator.enabled() && aggregator.flush() != OK) {
+    std::abort();
+  }
+}
+
+// Sends this thread's buffered stores to n bytes at addr. Defined with the store buffer.
+Status flushBufferedStores(GlobalAddress addr, std::size_t n);
+
+// Loads n bytes from a remote node. n must fit in a medium reply.
+Status remoteLoad(uint64_t nodeIdx, GlobalAddress srcAddr, std::size_t n, const Nodes::Future& future) {
   if(nodeIdx >= world.size) {
     return PANDO_OUT_OF_BOUNDS;
   }
+  if(n > gex_AM_LUBReplyMedium()) {
+    return PANDO_BAD_ALLOC;
+  }
+  if (rmaAccesses && inSegment(nodeIdx, srcAddr, n)) {
+    // keep the order of the accesses still buffered for this node, as the AM path does
+    if (auto status = aggregator.flush(nodeIdx); status != OK) {
+      return status;
+    }
+    if (auto status = flushBufferedStores(srcAddr, n); status != OK) {
+      return status;
+    }
+    // the get writes straight to the future's buffer, which is ready when it completes
+    const gex_Flags_t flags = 0;
+    Nodes::completions.track(future.id(),
+                             gex_RMA_GetNB(world.team, Nodes::completions.replyBuffer(future.id()), nodeIdx,
+                                           reinterpret_cast<void*>(nativeAddress(srcAddr)), n, flags));
+    return OK;
+  }
+  if (aggregator.aggregates(n)) {
+    return aggregator.load(nodeIdx, srcAddr, n, future);
+  }
+  // keep the order of the accesses still buffered for this node
+  if (auto status = aggregator.flush(nodeIdx); status != OK) {
+    return status;
+  }
   const auto requestSize = packedSize(srcAddr, n);
   const gex_Flags_t flags = 0;
-  const unsigned int numArgs = 2;
+  const unsigned int numArgs = 1;
 
-  gex_AM_SrcDesc_t sd = gex_AM_PrepareRequestMedium(world.team, nodeIdx, nullptr,
-      requestSize, GEX_EVENT_NOW, flags, numArgs);
-  auto buffer = gex_AM_SrcDescAddr(sd);
-  if(!buffer) {
+  gex_AM_SrcDesc_t sd = gex_AM_PrepareRequestMedium(injectionTeam(), nodeIdx, nullptr,
+      requestSize, requestSize, GEX_EVENT_NOW, flags, numArgs);
+  // a prepared request holds GASNet resources until it is committed, so nothing may fail between
+  // the two. without GEX_FLAG_IMMEDIATE, the prepare itself does not fail either.
+  if (sd == GEX_AM_SRCDESC_NO_OP) {
     return PANDO_BAD_ALLOC;
   }
+  auto buffer = gex_AM_SrcDescAddr(sd);
   pack(buffer, srcAddr, n);
-  auto packedHandlePtr = packPtr(&handle);
-  gex_AM_CommitRequestMedium2(sd, world.htable[+AMType::Load].gex_index, requestSize,
-                              std::get<0>(packedHandlePtr), std::get<1>(packedHandlePtr));
+  gex_AM_CommitRequestMedium1(sd, world.htable[+AMType::Load].gex_index, requestSize, future.id());
   return OK;
 }
 
-void handleLoad(gex_Token_t token, void* buffer, size_t /*byteCount*/, gex_AM_Arg_t handlePtrHi,
-                gex_AM_Arg_t handlePtrLo) {
+Status remoteLoad8(uint64_t nodeIdx, GlobalAddress srcAddr, const Nodes::Future& future) {
+  return remoteLoad(nodeIdx, srcAddr, 8, future);
+}
+
+// Processes a load request
+void processLoad(Reply& reply, void* buffer, size_t /*byteCount*/, gex_AM_Arg_t completionId) {
   // unpack
   GlobalAddress srcAddr;
   std::size_t n;
-  assert(n == 8);
   unpack(buffer, srcAddr, n);
+  assert(n <= gex_AM_LUBReplyMedium());
 
   // send reply message with data
   void* srcDataPtr = deglobalify(srcAddr);
-  const auto flags = 0;
-  if (auto status = gex_AM_ReplyMedium(token, world.htable[+AMType::LoadAck].gex_index, srcDataPtr,
-                                       n, GEX_EVENT_NOW, flags, handlePtrHi, handlePtrLo);
+  if (auto status = reply.medium(AMType::LoadAck, srcDataPtr, n, completionId);
       status != GASNET_OK) {
 
     std::abort();
   }
 }
 
-Status remoteStore8(NodeIndex nodeIdx, GlobalAddress dstAddr, const void* srcPtr,
-                    AckHandle& handle) {
-  constexpr std::uint64_t n = 8;
+// Stores n bytes to a remote node. n must fit in a medium request along with the address.
+Status remoteStore(uint64_t nodeIdx, GlobalAddress dstAddr, const void* srcPtr, std::size_t n,
+                   const Nodes::Future& future) {
   if (nodeIdx >= world.size) {
-    return OutOfBounds;
+    return PANDO_OUT_OF_BOUNDS;
+  }
+  if (rmaAccesses && inSegment(nodeIdx, dstAddr, n)) {
+    // keep the order of the accesses still buffered for this node. the store buffer sends its
+    // lines through here, so it is flushed by the callers.
+    if (auto status = aggregator.flush(nodeIdx); status != OK) {
+      return status;
+    }
+    // srcPtr may be reused on return (GEX_EVENT_NOW). the future is ready once the store is
+    // applied, like the ack of the AM path.
+    const gex_Flags_t flags = 0;
+    Nodes::completions.track(future.id(),
+                             gex_RMA_PutNB(world.team, nodeIdx, reinterpret_cast<void*>(nativeAddress(dstAddr)),
+                                           const_cast<void*>(srcPtr), n, GEX_EVENT_NOW, flags));
+    return OK;
+  }
+  if (aggregator.aggregates(n)) {
+    return aggregator.store(nodeIdx, dstAddr, srcPtr, n, future);
+  }
+  // keep the order of the accesses still buffered for this node
+  if (auto status = aggregator.flush(nodeIdx); status != OK) {
+    return status;
   }
 
   // size payload: number of bytes to write is inferred from byteCount
@@ -156,139 +1072,2013 @@ Status remoteStore8(NodeIndex nodeIdx, GlobalAddress dstAddr, const void* srcPtr
 
   // get managed buffer to write the request in
   const gex_Flags_t flags = 0;
-  const unsigned int numArgs = 2;
+  const unsigned int numArgs = 1;
   const auto maxMediumRequest =
-      gex_AM_MaxRequestMedium(world.team, nodeIdx.id, nullptr, flags, numArgs);
+      gex_AM_MaxRequestMedium(injectionTeam(), nodeIdx, nullptr, flags, numArgs);
   if (requestSize > maxMediumRequest) {
     return PANDO_BAD_ALLOC;
   }
-  gex_AM_SrcDesc_t sd = gex_AM_PrepareRequestMedium(world.team, nodeIdx.id, nullptr, requestSize,
+  gex_AM_SrcDesc_t sd = gex_AM_PrepareRequestMedium(injectionTeam(), nodeIdx, nullptr, requestSize,
                                                     requestSize, GEX_EVENT_NOW, flags, numArgs);
-  auto buffer = gex_AM_SrcDescAddr(sd);
-  if (buffer == nullptr) {
+  if (sd == GEX_AM_SRCDESC_NO_OP) {
     return PANDO_BAD_ALLOC;
   }
+  auto buffer = gex_AM_SrcDescAddr(sd);
 
   // pack payload: number of bytes to write is inferred from total byte count
   auto packedDataEnd = pack(buffer, dstAddr);
   std::memcpy(packedDataEnd, srcPtr, n);
-  // pack pointer for reply
-  auto packedHandlePtr = packPtr(&handle);
-  // mark buffer ready for send
-  gex_AM_CommitRequestMedium2(sd, world.htable[+AMType::Store].gex_index, requestSize,
-                              std::get<0>(packedHandlePtr), std::get<1>(packedHandlePtr));
+  // mark buffer ready for send, with the completion slot of the ack
+  gex_AM_CommitRequestMedium1(sd, world.htable[+AMType::Store].gex_index, requestSize, future.id());
 
   return OK;
 }
 
-void handleStore(gex_Token_t token, void* buffer, size_t byteCount, gex_AM_Arg_t handlePtrHi,
-                gex_AM_Arg_t handlePtrLo) {
+Status remoteStore8(uint64_t nodeIdx, GlobalAddress dstAddr, const void* srcPtr,
+                    const Nodes::Future& future) {
+  return remoteStore(nodeIdx, dstAddr, srcPtr, 8, future);
+}
+
+// Processes a store request
+void processStore(Reply& reply, void* buffer, size_t byteCount, gex_AM_Arg_t completionId) {
   // unpack: payload number of bytes inferred from total byte count
   void* dstAddr;
-  const uint64_t* srcDataPtr = unpack(buffer, dstAddr);
+  const void* srcDataPtr = unpack(buffer, dstAddr);
   const auto n = byteCount - packedSize(dstAddr);
-  assert(n == 8);
 
   // write data payload to global address
-  uint64_t* nativeDstPtr = deglobalify(dstAddr);
-  *nativeDstPtr = *srcDataPtr;
+  std::memcpy(deglobalify(dstAddr), srcDataPtr, n);
   std::atomic_thread_fence(std::memory_order_release);
 
-  sendAck(token, handlePtrHi, handlePtrLo);
+  sendAck(reply, completionId);
 }
 
-// Processes an ack for a load
-void handleLoadAck(gex_Token_t token, void* buffer, size_t byteCount, gex_AM_Arg_t handlePtrHi,
-                   gex_AM_Arg_t handlePtrLo) {
-  auto handlePtr = reinterpret_cast<Nodes::LoadHandle*>(unpackPtr(handlePtrHi, handlePtrLo));
-  handlePtr->setReady(buffer, byteCount);
+// A split-phase load in flight is passed from __pando__load_issue to __pando__load_wait_* as the
+// id of the completion slot that receives its value
 
-  static_cast<void>(token);
+void* loadHandle(Nodes::Future future) noexcept {
+  return reinterpret_cast<void*>(static_cast<std::uintptr_t>(future.detach()));
 }
 
-// Processes an ack. This is just a signal with no payload.
-void handleAck(gex_Token_t token, gex_AM_Arg_t handlePtrHi, gex_AM_Arg_t handlePtrLo) {
-  auto handlePtr = reinterpret_cast<Nodes::AckHandle*>(unpackPtr(handlePtrHi, handlePtrLo));
-  handlePtr->setReady();
-
-  static_cast<void>(token);
+// Waits for a split-phase load and returns its value. The slot is released.
+template <typename T>
+T waitLoad(void* handle) {
+  const auto future = Nodes::Future::adopt(static_cast<Nodes::CompletionId>(reinterpret_cast<std::uintptr_t>(handle)));
+  future.wait();
+  return future.value<T>();
 }
 
-// Processes an ack with a value
-void handleValueAck(gex_Token_t token, void* buffer, size_t /*byteCount*/, gex_AM_Arg_t handlePtrHi,
-                    gex_AM_Arg_t handlePtrLo) {
-  auto handlePtr = reinterpret_cast<Nodes::ValueHandleBase*>(unpackPtr(handlePtrHi, handlePtrLo));
-  handlePtr->setReady(buffer);
+// Chunks of a large remote get or put in flight at once. Bounds the completion slots one transfer
+// holds.
+constexpr std::size_t maxChunksInFlight = 256;
 
-  static_cast<void>(token);
-}
+// Loads n bytes of any size from a remote node into dst. Payloads larger than a medium AM are read
+// with one RMA get if they lie in the owner's segment and RMA is on, and otherwise split into the
+// largest medium AMs, up to maxChunksInFlight in flight at once.
+Status remoteGet(uint64_t nodeIdx, void* dst, GlobalAddress srcAddr, std::size_t n) {
+  const std::size_t chunkSize = gex_AM_LUBReplyMedium();
+  if (n > chunkSize && rmaAccesses && inSegment(nodeIdx, srcAddr, n)) {
+    if (auto status = aggregator.flush(nodeIdx); status != OK) {
+      return status;
+    }
+    const gex_Flags_t flags = 0;
+    gex_Event_Wait(gex_RMA_GetNB(world.team, dst, nodeIdx, reinterpret_cast<void*>(nativeAddress(srcAddr)),
+                                 n, flags));
+    return OK;
+  }
 
-void processMessages(std::atomic<bool>& pollingActive) {
-  // block the thread until stopped, while polling GASNet
-  while (pollingActive.load(std::memory_order_relaxed) == true) {
-    GASNET_BLOCKUNTIL(pollingActive.load(std::memory_order_relaxed) == false);
+  std::deque<Nodes::Future> futures;
+  Status status = OK;
+  for (std::size_t offset = 0; offset < n && status == OK; offset += chunkSize) {
+    if (futures.size() == maxChunksInFlight) {
+      futures.front().wait();
+      futures.pop_front();
+    }
+    const auto& future = futures.emplace_back(static_cast<std::byte*>(dst) + offset);
+    status = remoteLoad(nodeIdx, offsetAddress(srcAddr, offset), std::min(chunkSize, n - offset), future);
   }
+  if (status != OK) {
+    futures.back().cancel();
+    futures.pop_back();
+  }
+  Nodes::waitAll(futures);
+  return status;
 }
 
-Status initialize(std::uint64_t num_hosts) {
-  auto status = gex_Client_Init(&world.client, &world.endpoint, &world.team,
-                                      world.clientName.data(), nullptr, nullptr, 0);
-  if(status != GASNET_OK) {
-    return GASNET_INIT_ERROR;
+// Stores n bytes of any size from src to a remote node. Payloads larger than a medium AM are
+// written with one RMA put if they lie in the owner's segment and RMA is on, and otherwise split into
+// the largest medium AMs, up to maxChunksInFlight in flight at once.
+Status remotePut(uint64_t nodeIdx, GlobalAddress dstAddr, const void* src, std::size_t n) {
+  const std::size_t chunkSize = gex_AM_LUBRequestMedium() - packedSize(dstAddr);
+  if (n > chunkSize && rmaAccesses && inSegment(nodeIdx, dstAddr, n)) {
+    if (auto status = aggregator.flush(nodeIdx); status != OK) {
+      return status;
+    }
+    // waits for remote completion, like the acks of the medium AM path
+    const gex_Flags_t flags = 0;
+    gex_Event_Wait(gex_RMA_PutNB(world.team, nodeIdx, reinterpret_cast<void*>(nativeAddress(dstAddr)),
+                                 const_cast<void*>(src), n, GEX_EVENT_DEFER, flags));
+    return OK;
   }
-  world.rank = gex_TM_QueryRank(world.team);
-  world.size = gex_TM_QuerySize(world.team);
 
-  status = gex_EP_RegisterHandlers(world.endpoint, world.htable, sizeof(world.htable)/ sizeof(gex_AM_Entry_t));
-  if(status != GASNET_OK) { return GASNET_INIT_ERROR; }
-  world.pollingThread = std::thread(processMessages, std::ref(world.pollingThreadActive));
-  auto barrierEvent = gex_Coll_BarrerNB(world.team, 0);
-  gex_Event_Wait(barrierEvent);
-  return OK;
+  std::deque<Nodes::Future> futures;
+  Status status = OK;
+  for (std::size_t offset = 0; offset < n && status == OK; offset += chunkSize) {
+    if (futures.size() == maxChunksInFlight) {
+      futures.front().wait();
+      futures.pop_front();
+    }
+    const auto& future = futures.emplace_back();
+    status = remoteStore(nodeIdx, offsetAddress(dstAddr, offset), static_cast<const std::byte*>(src) + offset,
+                         std::min(chunkSize, n - offset), future);
+  }
+  if (status != OK) {
+    futures.back().cancel();
+    futures.pop_back();
+  }
+  Nodes::waitAll(futures);
+  return status;
 }
 
-Status finalize() {
-  world.pollingThreadActive.store(false, std::memory_order_relaxed);
-  world.pollingThread.join();
-  gasnet_barrier_notify(0, GASNET_BARRIERFLAG_ANONYMOUS);
-  gasnet_barrier_wait(0, GASNET_BARRIERFLAG_ANONYMOUS);
-  return OK;
-}
+// Write-combining buffer of a thread's remote stores. Stores to the same node and cache line are
+// merged, and the dirty bytes of each line are sent when the buffer is flushed: at release points
+// (__pando__fence), when the buffer is full, or before the thread reads a buffered line.
+class StoreBuffer {
+public:
+  static constexpr std::size_t lineSize = 64;
+  static constexpr std::size_t maxLines = 256;
 
-extern "C" {
-  int check_if_global(void* ptr) {
-    uintptr_t p = (uintptr_t) ptr;
-    return (p >> 48) != 0x0;
-  }
+  // Buffers n bytes from src for the global address dst on a remote node
+  Status store(std::uint64_t nodeIdx, GlobalAddress dst, const void* src, std::size_t n) {
+    auto addr = reinterpret_cast<std::uintptr_t>(dst);
+    auto bytes = static_cast<const std::byte*>(src);
+    while (n > 0) {
+      const auto lineAddr = addr & ~(lineSize - 1);
+      const auto offset = addr - lineAddr;
+      const auto count = std::min(n, lineSize - offset);
 
-  void* deglobalify(void* ptr) {
-    uintptr_t p = (uintptr_t) ptr;
-    uintptr_t mask = ((uintptr_t)0xFFFF - (world.rank & 0xFFFF)) << 48;
-    return (void *) (p & ~mask);
-  }
+      auto it = m_lines.find(lineAddr);
+      if (it == m_lines.end()) {
+        if (m_lines.size() == maxLines) {
+          if (auto status = flush(); status != OK) {
+            return status;
+          }
+        }
+        it = m_lines.emplace(lineAddr, Line{nodeIdx}).first;
+      }
+      std::memcpy(it->second.data + offset, bytes, count);
+      it->second.dirty |= mask(offset, count);
 
-  void* globalify(void* ptr) {
-    uintptr_t p = (uintptr_t) ptr;
-    uintptr_t mask = ((uintptr_t)0xFFFF - (world.rank & 0xFFFF)) << 48;
-    return (void *) (p | mask);
+      addr += count;
+      bytes += count;
+      n -= count;
+    }
+    return OK;
   }
 
-  void __pando__replace_store64(uint64_t val, uint64_t* dst) {
-    assert(check_if_global(dst));
-    *(uint64_t*) deglobalify(dst) = val;
-  }
+  // Sends the buffered lines overlapping n bytes at addr and waits for their acks
+  Status flush(GlobalAddress addr, std::size_t n) {
+    if (m_lines.empty() || n == 0) {
+      return OK;
+    }
+    const auto first = reinterpret_cast<std::uintptr_t>(addr) & ~(lineSize - 1);
+    const auto last = (reinterpret_cast<std::uintptr_t>(addr) + n - 1) & ~(lineSize - 1);
 
-  void __pando__replace_storeptr(void* val, void** dst) {
-    assert(check_if_global(dst));
-    *(void**) deglobalify(dst) = val;
+    std::vector<Nodes::Future> futures;
+    Status status = OK;
+    for (auto lineAddr = first; lineAddr <= last && status == OK; lineAddr += lineSize) {
+      if (auto it = m_lines.find(lineAddr); it != m_lines.end()) {
+        status = send(it->first, it->second, futures);
+        m_lines.erase(it);
+      }
+    }
+    Nodes::waitAll(futures);
+    return status;
   }
 
-  uint64_t __pando__replace_load64(uint64_t* src) {
-    return *(uint64_t*) deglobalify(src);
+  // Sends every buffered line and waits for their acks
+  Status flush() {
+    std::vector<Nodes::Future> futures;
+    futures.reserve(m_lines.size());
+    Status status = OK;
+    for (const auto& [lineAddr, line] : m_lines) {
+      if (status = send(lineAddr, line, futures); status != OK) {
+        break;
+      }
+    }
+    m_lines.clear();
+    Nodes::waitAll(futures);
+    return status;
   }
 
-  void* __pando__replace_loadptr(void** src) {
-    return *(uint64_t**) deglobalify(src);
+private:
+  struct Line {
+    std::uint64_t nodeIdx;
+    std::uint64_t dirty{0};
+    std::byte data[lineSize];
+  };
+  static_assert(lineSize <= 64, "dirty bytes are tracked in a 64-bit mask");
+
+  static std::uint64_t mask(std::size_t offset, std::size_t count) noexcept {
+    const auto bits = (count == 64) ? ~std::uint64_t{0} : ((std::uint64_t{1} << count) - 1);
+    return bits << offset;
+  }
+
+  // Sends each contiguous run of dirty bytes of a line as one store
+  static Status send(std::uintptr_t lineAddr, const Line& line, std::vector<Nodes::Future>& futures) {
+    std::size_t offset = 0;
+    while (offset < lineSize) {
+      if (!(line.dirty & (std::uint64_t{1} << offset))) {
+        ++offset;
+        continue;
+      }
+      auto end = offset;
+      while (end < lineSize && (line.dirty & (std::uint64_t{1} << end))) {
+        ++end;
+      }
+
+      const auto& future = futures.emplace_back();
+      if (auto status = remoteStore(line.nodeIdx, reinterpret_cast<GlobalAddress>(lineAddr + offset),
+                                    line.data + offset, end - offset, future);
+          status != OK) {
+        futures.back().cancel();
+        futures.pop_back();
+        return status;
+      }
+      offset = end;
+    }
+    return OK;
+  }
+
+  std::unordered_map<std::uintptr_t, Line> m_lines;
+};
+
+thread_local StoreBuffer storeBuffer;
+
+Status flushBufferedStores(GlobalAddress addr, std::size_t n) {
+  return storeBuffer.flush(addr, n);
+}
+
+// Read cache settings, from PANDO_CACHE_SIZE (bytes, 0 disables the cache), PANDO_CACHE_LINE
+// (bytes) and PANDO_CACHE_WAYS (1 is direct-mapped)
+struct CacheConfig {
+  std::size_t size{0};
+  std::size_t lineSize{64};
+  std::size_t ways{1};
+} cacheConfig;
+
+// Read cache counters of all threads
+struct {
+  std::atomic<std::uint64_t> hits{0};
+  std::atomic<std::uint64_t> misses{0};
+  std::atomic<std::uint64_t> evictions{0};
+} cacheCounters;
+
+// Reads the cache settings from the environment
+Status readCacheConfig(CacheConfig& config) {
+  auto readSize = [](const char* name, std::size_t& value) {
+    if (const char* str = std::getenv(name)) {
+      value = std::strtoull(str, nullptr, 0);
+    }
+  };
+  readSize("PANDO_CACHE_SIZE", config.size);
+  readSize("PANDO_CACHE_LINE", config.lineSize);
+  readSize("PANDO_CACHE_WAYS", config.ways);
+
+  if (config.size == 0) {
+    return OK;
+  }
+  // lines must not cross a page, so a fill never reads unmapped memory on the owner
+  const bool lineSizeValid = config.lineSize >= sizeof(std::uint64_t) && config.lineSize <= 4096 &&
+                             (config.lineSize & (config.lineSize - 1)) == 0;
+  if (!lineSizeValid || config.ways == 0 || config.size < config.lineSize * config.ways) {
+    std::fprintf(stderr, "pando-rt: invalid cache configuration (size %zu, line %zu, ways %zu)\n",
+                 config.size, config.lineSize, config.ways);
+    return PANDO_INVALID_CONFIG;
+  }
+  return OK;
+}
+
+// Set-associative cache of a thread's remote reads, keyed by global address. Lines are filled
+// with one bulk remote get and replaced in LRU order. The cache is invalidated at the points where
+// the store buffer is flushed, and lines written by the thread are dropped.
+class ReadCache {
+public:
+  explicit ReadCache(const CacheConfig& config)
+      : m_lineSize(config.lineSize), m_ways(config.ways),
+        m_numSets(config.size == 0 ? 0 : config.size / (config.lineSize * config.ways)),
+        m_tags(m_numSets * m_ways, invalidTag), m_lastUse(m_numSets * m_ways, 0),
+        m_data(m_numSets * m_ways * m_lineSize) {}
+
+  bool enabled() const noexcept {
+    return m_numSets != 0;
+  }
+
+  // Reads n bytes at the global address src, owned by a remote node, into dst
+  Status read(std::uint64_t nodeIdx, GlobalAddress src, void* dst, std::size_t n) {
+    auto addr = reinterpret_cast<std::uintptr_t>(src);
+    auto bytes = static_cast<std::byte*>(dst);
+    while (n > 0) {
+      const auto lineAddr = addr & ~(m_lineSize - 1);
+      const auto offset = addr - lineAddr;
+      const auto count = std::min(n, m_lineSize - offset);
+
+      auto slot = find(lineAddr);
+      if (slot == notFound) {
+        cacheCounters.misses.fetch_add(1, std::memory_order_relaxed);
+        slot = victim(lineAddr);
+        if (m_tags[slot] != invalidTag) {
+          cacheCounters.evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_tags[slot] = invalidTag;
+        // the fill covers the whole line, which may hold this thread's buffered stores beyond the
+        // bytes read (store buffer lines are 64 bytes, cache lines up to 4096)
+        const auto remoteLine = reinterpret_cast<GlobalAddress>(lineAddr);
+        if (auto status = storeBuffer.flush(remoteLine, m_lineSize); status != OK) {
+          return status;
+        }
+        if (auto status = remoteGet(nodeIdx, line(slot), remoteLine, m_lineSize); status != OK) {
+          return status;
+        }
+        m_tags[slot] = lineAddr;
+      } else {
+        cacheCounters.hits.fetch_add(1, std::memory_order_relaxed);
+      }
+      m_lastUse[slot] = ++m_clock;
+      std::memcpy(bytes, line(slot) + offset, count);
+
+      addr += count;
+      bytes += count;
+      n -= count;
+    }
+    return OK;
+  }
+
+  // Drops the lines overlapping n bytes at addr
+  void invalidate(GlobalAddress addr, std::size_t n) noexcept {
+    if (!enabled() || n == 0) {
+      return;
+    }
+    const auto first = reinterpret_cast<std::uintptr_t>(addr) & ~(m_lineSize - 1);
+    const auto last = (reinterpret_cast<std::uintptr_t>(addr) + n - 1) & ~(m_lineSize - 1);
+    for (auto lineAddr = first; lineAddr <= last; lineAddr += m_lineSize) {
+      if (auto slot = find(lineAddr); slot != notFound) {
+        m_tags[slot] = invalidTag;
+      }
+    }
+  }
+
+  // Drops every line
+  void invalidate() noexcept {
+    std::fill(m_tags.begin(), m_tags.end(), invalidTag);
+  }
+
+private:
+  // line addresses are aligned, so an all-ones tag never matches
+  static constexpr std::uintptr_t invalidTag = ~std::uintptr_t{0};
+  static constexpr std::size_t notFound = ~std::size_t{0};
+
+  std::size_t firstSlot(std::uintptr_t lineAddr) const noexcept {
+    return ((lineAddr / m_lineSize) % m_numSets) * m_ways;
+  }
+
+  std::size_t find(std::uintptr_t lineAddr) const noexcept {
+    const auto first = firstSlot(lineAddr);
+    for (auto slot = first; slot < first + m_ways; ++slot) {
+      if (m_tags[slot] == lineAddr) {
+        return slot;
+      }
+    }
+    return notFound;
+  }
+
+  // an invalid way of the line's set, else the least recently used one
+  std::size_t victim(std::uintptr_t lineAddr) const noexcept {
+    const auto first = firstSlot(lineAddr);
+    auto lru = first;
+    for (auto slot = first; slot < first + m_ways; ++slot) {
+      if (m_tags[slot] == invalidTag) {
+        return slot;
+      }
+      if (m_lastUse[slot] < m_lastUse[lru]) {
+        lru = slot;
+      }
+    }
+    return lru;
+  }
+
+  std::byte* line(std::size_t slot) noexcept {
+    return m_data.data() + slot * m_lineSize;
+  }
+
+  std::size_t m_lineSize;
+  std::size_t m_ways;
+  std::size_t m_numSets;
+  std::vector<std::uintptr_t> m_tags;
+  std::vector<std::uint64_t> m_lastUse;
+  std::vector<std::byte> m_data;
+  std::uint64_t m_clock{0};
+};
+
+thread_local ReadCache readCache{cacheConfig};
+
+// Reads n bytes at a remote global address into dst. Buffered stores of this thread to it are
+// sent first.
+Status readRemote(std::uint64_t nodeIdx, GlobalAddress src, void* dst, std::size_t n) {
+  if (auto status = storeBuffer.flush(src, n); status != OK) {
+    return status;
+  }
+  if (readCache.enabled()) {
+    return readCache.read(nodeIdx, src, dst, n);
+  }
+
+  Nodes::Future future(dst);
+  if (auto status = remoteLoad(nodeIdx, src, n, future); status != OK) {
+    future.cancel();
+    return status;
+  }
+  future.wait();
+  return OK;
+}
+
+// Loads a value from a global address
+template <typename T>
+T loadValue(GlobalAddress src) {
+  const auto nodeIdx = ownerOf(src);
+  if (nodeIdx == world.rank) {
+    return *static_cast<T*>(deglobalify(src));
+  }
+
+  T value;
+  if (readRemote(nodeIdx, src, &value, sizeof(T)) != OK) {
+    std::abort();
+  }
+  return value;
+}
+
+// Stores a value to a global address. Remote stores are buffered until the next flush.
+template <typename T>
+void storeValue(T value, GlobalAddress dst) {
+  const auto nodeIdx = ownerOf(dst);
+  if (nodeIdx == world.rank) {
+    *static_cast<T*>(deglobalify(dst)) = value;
+    return;
+  }
+
+  readCache.invalidate(dst, sizeof(T));
+  if (storeBuffer.store(nodeIdx, dst, &value, sizeof(T)) != OK) {
+    std::abort();
+  }
+}
+
+// Loads a vector from a global address, which may be less aligned than the vector type
+template <typename V>
+V loadVector(GlobalAddress src) {
+  V value;
+  const auto nodeIdx = ownerOf(src);
+  if (nodeIdx == world.rank) {
+    std::memcpy(&value, deglobalify(src), sizeof(V));
+  } else if (readRemote(nodeIdx, src, &value, sizeof(V)) != OK) {
+    std::abort();
+  }
+  return value;
+}
+
+// Stores a vector to a global address, like storeValue
+template <typename V>
+void storeVector(V value, GlobalAddress dst) {
+  const auto nodeIdx = ownerOf(dst);
+  if (nodeIdx == world.rank) {
+    std::memcpy(deglobalify(dst), &value, sizeof(V));
+    return;
+  }
+
+  readCache.invalidate(dst, sizeof(V));
+  if (storeBuffer.store(nodeIdx, dst, &value, sizeof(V)) != OK) {
+    std::abort();
+  }
+}
+
+// Vectors of the by-value entry points, passed in SIMD registers
+using v16i8 = std::int8_t __attribute__((vector_size(16)));
+using v8i16 = std::int16_t __attribute__((vector_size(16)));
+using v4i32 = std::int32_t __attribute__((vector_size(16)));
+using v2i64 = std::int64_t __attribute__((vector_size(16)));
+using v4f32 = float __attribute__((vector_size(16)));
+using v2f64 = double __attribute__((vector_size(16)));
+
+// Copies one lane of a gather or scatter. The usual lane sizes become single native moves.
+void copyLane(void* dst, const void* src, std::size_t n) noexcept {
+  switch (n) {
+  case 1:
+    std::memcpy(dst, src, 1);
+    break;
+  case 2:
+    std::memcpy(dst, src, 2);
+    break;
+  case 4:
+    std::memcpy(dst, src, 4);
+    break;
+  case 8:
+    std::memcpy(dst, src, 8);
+    break;
+  default:
+    std::memcpy(dst, src, n);
+  }
+}
+
+// Loads (or stores) the remote lanes of a gather (or scatter) and waits for them. Lane i is n bytes
+// at ptrs[i] and at data + i * n, and remote holds the (owner, i) of each remote lane. The lanes of
+// an owner go in one batch, in lane order, so overlapping scatter lanes keep the last one.
+Status remoteLanes(RecordKind kind, std::byte* data, void* const* ptrs,
+                   std::vector<std::pair<std::uint64_t, std::size_t>>& remote, std::size_t n) {
+  std::stable_sort(remote.begin(), remote.end(),
+                   [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  std::deque<Nodes::Future> futures;
+  std::vector<Aggregator::Lane> lanes;
+  for (auto group = remote.begin(); group != remote.end();) {
+    const auto nodeIdx = group->first;
+    lanes.clear();
+    for (; group != remote.end() && group->first == nodeIdx; ++group) {
+      const auto addr = ptrs[group->second];
+      const auto lane = data + group->second * n;
+      if (kind == RecordKind::Store) {
+        readCache.invalidate(addr, n);
+      }
+      if (auto status = storeBuffer.flush(addr, n); status != OK) {
+        return status;
+      }
+      const auto& future = (kind == RecordKind::Load) ? futures.emplace_back(lane) : futures.emplace_back();
+      lanes.push_back({addr, &future, lane});
+    }
+    if (auto status = aggregator.batch(nodeIdx, kind, lanes, n); status != OK) {
+      return status;
+    }
+  }
+  Nodes::waitAll(futures);
+  return OK;
+}
+
+// Atomic operations. All but CmpXchg match the `op` argument of __pando__atomic_rmw_*.
+enum class AtomicOp : std::uint32_t {
+  Xchg,
+  Add,
+  Sub,
+  And,
+  Nand,
+  Or,
+  Xor,
+  Max,
+  Min,
+  UMax,
+  UMin,
+  CmpXchg,
+  FAdd,
+  FSub,
+  FMax,
+  FMin,
+  UIncWrap,
+  UDecWrap,
+};
+
+// Applies a floating-point op to the bits of a float (T of 4 bytes) or a double (8 bytes)
+template <typename T>
+T applyFloatOp(AtomicOp op, T oldBits, T operandBits) noexcept {
+  if constexpr (sizeof(T) != sizeof(float) && sizeof(T) != sizeof(double)) {
+    std::abort();
+  } else {
+    using F = std::conditional_t<sizeof(T) == sizeof(double), double, float>;
+    F old;
+    F operand;
+    std::memcpy(&old, &oldBits, sizeof(F));
+    std::memcpy(&operand, &operandBits, sizeof(F));
+    F next;
+    switch (op) {
+      case AtomicOp::FAdd: next = old + operand; break;
+      case AtomicOp::FSub: next = old - operand; break;
+      case AtomicOp::FMax: next = std::fmax(old, operand); break;
+      case AtomicOp::FMin: next = std::fmin(old, operand); break;
+      default: std::abort();
+    }
+    T nextBits;
+    std::memcpy(&nextBits, &next, sizeof(F));
+    return nextBits;
+  }
+}
+
+// Applies op to *ptr atomically and returns the old value. S is the signed counterpart of T.
+template <typename T, typename S = std::make_signed_t<T>>
+T applyAtomic(T* ptr, AtomicOp op, T operand, T expected) noexcept {
+  switch (op) {
+    case AtomicOp::Xchg: return __atomic_exchange_n(ptr, operand, __ATOMIC_SEQ_CST);
+    case AtomicOp::Add: return __atomic_fetch_add(ptr, operand, __ATOMIC_SEQ_CST);
+    case AtomicOp::Sub: return __atomic_fetch_sub(ptr, operand, __ATOMIC_SEQ_CST);
+    case AtomicOp::And: return __atomic_fetch_and(ptr, operand, __ATOMIC_SEQ_CST);
+    case AtomicOp::Nand: return __atomic_fetch_nand(ptr, operand, __ATOMIC_SEQ_CST);
+    case AtomicOp::Or: return __atomic_fetch_or(ptr, operand, __ATOMIC_SEQ_CST);
+    case AtomicOp::Xor: return __atomic_fetch_xor(ptr, operand, __ATOMIC_SEQ_CST);
+    case AtomicOp::CmpXchg:
+      __atomic_compare_exchange_n(ptr, &expected, operand, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      return expected;
+    default:
+      break;
+  }
+
+  T old = __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+  T next;
+  do {
+    switch (op) {
+      case AtomicOp::Max: next = (static_cast<S>(old) > static_cast<S>(operand)) ? old : operand; break;
+      case AtomicOp::Min: next = (static_cast<S>(old) < static_cast<S>(operand)) ? old : operand; break;
+      case AtomicOp::UMax: next = std::max(old, operand); break;
+      case AtomicOp::UMin: next = std::min(old, operand); break;
+      case AtomicOp::UIncWrap: next = (old >= operand) ? T{0} : static_cast<T>(old + 1); break;
+      case AtomicOp::UDecWrap: next = (old == 0 || old > operand) ? operand : static_cast<T>(old - 1); break;
+      default: next = applyFloatOp(op, old, operand); break;
+    }
+  } while (!__atomic_compare_exchange_n(ptr, &old, next, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+  return old;
+}
+
+// Applies op to n bytes (1, 2, 4 or 8) at ptr and returns the old value, zero-extended
+std::uint64_t applyAtomic(void* ptr, AtomicOp op, std::size_t n, std::uint64_t operand,
+                          std::uint64_t expected) noexcept {
+  switch (n) {
+    case 1:
+      return applyAtomic(static_cast<std::uint8_t*>(ptr), op, static_cast<std::uint8_t>(operand),
+                         static_cast<std::uint8_t>(expected));
+    case 2:
+      return applyAtomic(static_cast<std::uint16_t*>(ptr), op, static_cast<std::uint16_t>(operand),
+                         static_cast<std::uint16_t>(expected));
+    case 4:
+      return applyAtomic(static_cast<std::uint32_t*>(ptr), op, static_cast<std::uint32_t>(operand),
+                         static_cast<std::uint32_t>(expected));
+    case 8:
+      return applyAtomic(static_cast<std::uint64_t*>(ptr), op, operand, expected);
+    default:
+      std::abort();
+  }
+}
+
+// Runs an atomic on n bytes at a remote node. The future receives the old value.
+Status remoteAtomic(uint64_t nodeIdx, GlobalAddress addr, AtomicOp op, std::size_t n,
+                    std::uint64_t operand, std::uint64_t expected, const Nodes::Future& future) {
+  if (nodeIdx >= world.size) {
+    return PANDO_OUT_OF_BOUNDS;
+  }
+  // keep the order of the accesses still buffered for this node
+  if (auto status = aggregator.flush(nodeIdx); status != OK) {
+    return status;
+  }
+
+  const auto requestSize = packedSize(addr, op, n, operand, expected);
+  const gex_Flags_t flags = 0;
+  const unsigned int numArgs = 1;
+  gex_AM_SrcDesc_t sd = gex_AM_PrepareRequestMedium(injectionTeam(), nodeIdx, nullptr, requestSize,
+                                                    requestSize, GEX_EVENT_NOW, flags, numArgs);
+  if (sd == GEX_AM_SRCDESC_NO_OP) {
+    return PANDO_BAD_ALLOC;
+  }
+  auto buffer = gex_AM_SrcDescAddr(sd);
+  pack(buffer, addr, op, n, operand, expected);
+  gex_AM_CommitRequestMedium1(sd, world.htable[+AMType::Atomic].gex_index, requestSize, future.id());
+  return OK;
+}
+
+// Processes an atomic request
+void processAtomic(Reply& reply, void* buffer, size_t /*byteCount*/, gex_AM_Arg_t completionId) {
+  GlobalAddress addr;
+  AtomicOp op;
+  std::size_t n;
+  std::uint64_t operand;
+  std::uint64_t expected;
+  unpack(buffer, addr, op, n, operand, expected);
+
+  // reply with the old value
+  const std::uint64_t old = applyAtomic(deglobalify(addr), op, n, operand, expected);
+  if (auto status = reply.medium(AMType::ValueAck, &old, sizeof(old), completionId);
+      status != GASNET_OK) {
+    std::abort();
+  }
+}
+
+// Runs an atomic on a global address at its owner and returns the old value. Buffered stores and
+// cached reads of this thread to it are sent and dropped first.
+template <typename T>
+T atomicValue(GlobalAddress addr, AtomicOp op, T operand, T expected) {
+  const auto nodeIdx = ownerOf(addr);
+  if (nodeIdx == world.rank) {
+    return applyAtomic(static_cast<T*>(deglobalify(addr)), op, operand, expected);
+  }
+
+  readCache.invalidate(addr, sizeof(T));
+  Nodes::Future future;
+  if (storeBuffer.flush(addr, sizeof(T)) != OK ||
+      remoteAtomic(nodeIdx, addr, op, sizeof(T), operand, expected, future) != OK) {
+    std::abort();
+  }
+  future.wait();
+  return static_cast<T>(future.value<std::uint64_t>());
+}
+
+// Thunk of a function shipped by `ship-pass`: calls it with the arguments packed at args and
+// stores its result at result
+using ShipThunk = void (*)(void* args, void* result);
+
+// 64-bit FNV-1a hash, which ship-pass uses for the ids of the thunks
+constexpr std::uint64_t fnv1a64(std::string_view bytes) {
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char byte : bytes) {
+    hash ^= byte;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Arguments of the runtime's own thunks, which run memory copies and fills at the owner
+struct CopyArgs {
+  GlobalAddress dst;
+  GlobalAddress src;
+  std::uint64_t n;
+};
+
+struct FillArgs {
+  GlobalAddress dst;
+  std::uint64_t value;
+  std::uint64_t n;
+};
+
+// Thunk ids of the copies and fills, hashed like the names of shipped functions (which are never
+// runtime functions)
+constexpr std::uint64_t copyThunkId = fnv1a64("__pando__memcpy");
+constexpr std::uint64_t fillThunkId = fnv1a64("__pando__memset");
+
+// Copies at the owner of the source, which puts the bytes to the owner of the destination
+void copyThunk(void* args, void*) {
+  CopyArgs copy;
+  std::memcpy(&copy, args, sizeof(copy));
+  __pando__memcpy(copy.dst, copy.src, copy.n);
+}
+
+// Fills at the owner of the destination
+void fillThunk(void* args, void*) {
+  FillArgs fill;
+  std::memcpy(&fill, args, sizeof(fill));
+  __pando__memset(fill.dst, static_cast<int>(fill.value), fill.n);
+}
+
+// Thunks by id (a hash of the function name, the same on every rank). Filled by the constructors
+// of instrumented modules before main and only read afterwards.
+std::unordered_map<std::uint64_t, ShipThunk>& shipThunks() {
+  static std::unordered_map<std::uint64_t, ShipThunk> thunks{
+      {copyThunkId, copyThunk},
+      {fillThunkId, fillThunk},
+  };
+  return thunks;
+}
+
+// Runs the thunk with the given id at a remote node. The future receives resultSize bytes of
+// result.
+Status remoteShip(uint64_t nodeIdx, std::uint64_t id, const void* args, std::size_t argsSize,
+                  std::size_t resultSize, const Nodes::Future& future) {
+  if (nodeIdx >= world.size) {
+    return PANDO_OUT_OF_BOUNDS;
+  }
+  if (resultSize > gex_AM_LUBReplyMedium()) {
+    return PANDO_BAD_ALLOC;
+  }
+  // the shipped function sees the accesses still buffered for this node
+  if (auto status = aggregator.flush(nodeIdx); status != OK) {
+    return status;
+  }
+
+  const auto requestSize = packedSize(id, resultSize) + argsSize;
+  const gex_Flags_t flags = 0;
+  const unsigned int numArgs = 1;
+  const auto maxMediumRequest =
+      gex_AM_MaxRequestMedium(injectionTeam(), nodeIdx, nullptr, flags, numArgs);
+  if (requestSize > maxMediumRequest) {
+    return PANDO_BAD_ALLOC;
+  }
+  gex_AM_SrcDesc_t sd = gex_AM_PrepareRequestMedium(injectionTeam(), nodeIdx, nullptr, requestSize,
+                                                    requestSize, GEX_EVENT_NOW, flags, numArgs);
+  if (sd == GEX_AM_SRCDESC_NO_OP) {
+    return PANDO_BAD_ALLOC;
+  }
+  auto buffer = gex_AM_SrcDescAddr(sd);
+  auto packedArgs = pack(buffer, id, resultSize);
+  if (argsSize != 0) {
+    std::memcpy(packedArgs, args, argsSize);
+  }
+  gex_AM_CommitRequestMedium1(sd, world.htable[+AMType::GenericRequest].gex_index, requestSize,
+                              future.id());
+  return OK;
+}
+
+// Runs the handler of a request of the given type
+void processMessage(Reply& reply, AMType type, void* buffer, size_t byteCount, gex_AM_Arg_t arg);
+
+struct ProgressConfig {
+  std::size_t threads{1};
+  // core of each progress thread, assigned round-robin. empty leaves the threads unpinned.
+  std::vector<int> cores;
+  // empty polls before a progress thread starts to back off
+  std::uint64_t spin{1000};
+  std::chrono::microseconds maxBackoff{100};
+  // threads that run request handlers. 0 runs them in the AM handler context. shipped calls always
+  // run in a pool of their own, since they may wait on remote accesses.
+  std::size_t handlerWorkers{0};
+  bool stats{false};
+} progressConfig;
+
+// Reads the progress engine settings from the environment
+Status readProgressConfig(ProgressConfig& config) {
+  auto readSize = [](const char* name, auto& value) {
+    if (const char* str = std::getenv(name)) {
+      value = std::strtoull(str, nullptr, 0);
+    }
+  };
+  readSize("PANDO_PROGRESS_THREADS", config.threads);
+  readSize("PANDO_PROGRESS_SPIN", config.spin);
+  readSize("PANDO_HANDLER_WORKERS", config.handlerWorkers);
+  std::uint64_t maxBackoff = config.maxBackoff.count();
+  readSize("PANDO_PROGRESS_MAX_BACKOFF_US", maxBackoff);
+  config.maxBackoff = std::chrono::microseconds(std::max<std::uint64_t>(maxBackoff, 1));
+  std::uint64_t stats = 0;
+  readSize("PANDO_PROGRESS_STATS", stats);
+  config.stats = stats != 0;
+
+  // comma-separated core ids, e.g. PANDO_PROGRESS_CORES=2,3
+  if (const char* str = std::getenv("PANDO_PROGRESS_CORES")) {
+    while (*str != '\0') {
+      char* end;
+      const long core = std::strtol(str, &end, 10);
+      if (end == str || core < 0 || core >= CPU_SETSIZE || (*end != ',' && *end != '\0')) {
+        std::fprintf(stderr, "pando-rt: invalid PANDO_PROGRESS_CORES\n");
+        return PANDO_INVALID_CONFIG;
+      }
+      config.cores.push_back(static_cast<int>(core));
+      str = (*end == ',') ? end + 1 : end;
+    }
+  }
+
+  // without a progress thread, requests from other ranks are only served while this rank waits
+  if (config.threads == 0) {
+    std::fprintf(stderr, "pando-rt: PANDO_PROGRESS_THREADS must be at least 1\n");
+    return PANDO_INVALID_CONFIG;
+  }
+  return OK;
+}
+
+// Message counters of a thread that handles AMs, on its own cache line
+struct alignas(64) ProgressCounters {
+  std::atomic<std::uint64_t> messages{0};
+  std::atomic<std::uint64_t> polls{0};
+  std::atomic<std::uint64_t> emptyPolls{0};
+  std::atomic<std::uint64_t> idleNanoseconds{0};
+};
+
+// counters of the calling progress thread, null on application threads
+thread_local ProgressCounters* progressCounters = nullptr;
+
+// Threads that poll GASNet so requests are served while the application computes. A progress
+// thread spins while polls find messages and for a number of empty polls after the last one, then
+// sleeps between polls with exponentially growing sleeps up to a maximum. Request handlers run in
+// the AM handler context, or, with handler workers, are queued with a copy of their payload and
+// run by a worker pool that replies with a new request to the source rank. Each worker has its own
+// queue and the requests of a source rank always go to the same one, so they run in the order they
+// arrived: batches of one sender are applied in order, as with handlers in the AM context. Shipped
+// calls run in a separate pool that starts a thread whenever none is idle: a shipped call may ship
+// again and wait for the result, which may need this rank's pool. A worker hands a shipped call to
+// the pool when it reaches it, so the call still starts after its sender's earlier requests.
+class ProgressEngine {
+public:
+  Status start(const ProgressConfig& config) {
+    m_config = config;
+    m_counters.reset(new ProgressCounters[m_config.threads]);
+    m_active.store(true, std::memory_order_relaxed);
+    m_ships.start();
+    m_numWorkers = m_config.handlerWorkers;
+    m_queues.reset(new WorkerQueue[m_numWorkers]);
+    for (std::size_t i = 0; i < m_numWorkers; ++i) {
+      m_queues[i].active = true;
+      m_workers.emplace_back(&ProgressEngine::work, this, i);
+    }
+    for (std::size_t i = 0; i < m_config.threads; ++i) {
+      m_threads.emplace_back(&ProgressEngine::poll, this, i);
+    }
+    return OK;
+  }
+
+  // Stops the handler workers once the queued requests are processed, then the shipped calls and
+  // the progress threads. Requests arriving afterwards are handled in the AM handler context.
+  void stop() {
+    for (std::size_t i = 0; i < m_numWorkers; ++i) {
+      {
+        std::lock_guard<std::mutex> lock(m_queues[i].mutex);
+        m_queues[i].active = false;
+      }
+      m_queues[i].ready.notify_all();
+    }
+    for (auto& worker : m_workers) {
+      worker.join();
+    }
+    m_workers.clear();
+    m_ships.stop();
+
+    m_active.store(false, std::memory_order_relaxed);
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+    m_threads.clear();
+  }
+
+  // Counts a message handled by the calling thread
+  void countMessage() noexcept {
+    auto& counters = progressCounters ? *progressCounters : m_applicationCounters;
+    counters.messages.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Handles a request in the AM handler context or queues it for a handler worker
+  void dispatch(gex_Token_t token, AMType type, void* buffer, size_t byteCount, gex_AM_Arg_t arg = 0) {
+    countMessage();
+    if (m_numWorkers != 0 || type == AMType::GenericRequest) {
+      gex_Token_Info_t info;
+      gex_Token_Info(token, &info, GEX_TI_SRCRANK);
+      auto bytes = static_cast<std::byte*>(buffer);
+      Task task{type, info.gex_srcrank, std::vector<std::byte>(bytes, bytes + byteCount), arg};
+      if (m_numWorkers != 0) {
+        auto& queue = m_queues[info.gex_srcrank % m_numWorkers];
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        if (queue.active) {
+          queue.tasks.push_back(std::move(task));
+          lock.unlock();
+          queue.ready.notify_one();
+          return;
+        }
+      } else if (m_ships.push(std::move(task))) {
+        return;
+      }
+    }
+
+    Reply reply(token);
+    processMessage(reply, type, buffer, byteCount, arg);
+  }
+
+  void printStats() const {
+    auto print = [](const char* name, const ProgressCounters& counters) {
+      std::printf("pando-rt: rank %lu %s: %lu messages, %lu polls (%lu empty), %.3f ms idle\n",
+                  static_cast<unsigned long>(world.rank), name,
+                  static_cast<unsigned long>(counters.messages.load()),
+                  static_cast<unsigned long>(counters.polls.load()),
+                  static_cast<unsigned long>(counters.emptyPolls.load()),
+                  counters.idleNanoseconds.load() / 1e6);
+    };
+    for (std::size_t i = 0; i < m_config.threads; ++i) {
+      char name[32];
+      std::snprintf(name, sizeof(name), "progress thread %zu", i);
+      print(name, m_counters[i]);
+    }
+    print("application threads", m_applicationCounters);
+  }
+
+private:
+  // A request deferred to a handler worker
+  struct Task {
+    AMType type;
+    gex_Rank_t srcRank;
+    std::vector<std::byte> payload;
+    gex_AM_Arg_t arg;
+  };
+
+  // Requests waiting for one handler worker, in arrival order
+  struct alignas(64) WorkerQueue {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Task> tasks;
+    bool active{false};
+  };
+
+  // Threads that run shipped calls. A call never waits for a free thread: one is started whenever
+  // more calls are queued than threads are idle. Threads are kept for later calls until stopped.
+  class ShipPool {
+  public:
+    void start() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_active = true;
+    }
+
+    // Queues a shipped call. Returns false once stopped.
+    bool push(Task&& task) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (!m_active) {
+        return false;
+      }
+      m_tasks.push_back(std::move(task));
+      if (m_tasks.size() > m_idle) {
+        m_threads.emplace_back(&ShipPool::work, this);
+        return true;
+      }
+      lock.unlock();
+      m_ready.notify_one();
+      return true;
+    }
+
+    // Stops the threads once the queued calls are run
+    void stop() {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active = false;
+      }
+      m_ready.notify_all();
+      for (auto& thread : m_threads) {
+        thread.join();
+      }
+      m_threads.clear();
+    }
+
+  private:
+    void work() {
+      while (true) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_idle;
+        m_ready.wait(lock, [this] { return !m_tasks.empty() || !m_active; });
+        --m_idle;
+        if (m_tasks.empty()) {
+          return;
+        }
+        Task task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        lock.unlock();
+
+        Reply reply(task.srcRank);
+        processMessage(reply, task.type, task.payload.data(), task.payload.size(), task.arg);
+      }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<Task> m_tasks;
+    // threads waiting for a call
+    std::size_t m_idle{0};
+    bool m_active{false};
+    std::vector<std::thread> m_threads;
+  };
+
+  void pin(std::size_t id) {
+    if (m_config.cores.empty()) {
+      return;
+    }
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(m_config.cores[id % m_config.cores.size()], &cores);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) != 0) {
+      std::fprintf(stderr, "pando-rt: could not pin progress thread %zu\n", id);
+    }
+  }
+
+  // Polls GASNet until stopped. The first thread also sends aggregated requests that waited past
+  // the timeout.
+  void poll(std::size_t id) {
+    pin(id);
+    auto& counters = m_counters[id];
+    progressCounters = &counters;
+
+    std::uint64_t emptyPolls = 0;
+    auto backoff = std::chrono::microseconds(1);
+    auto nextFlush = std::chrono::steady_clock::now() + aggregator.timeout();
+    while (m_active.load(std::memory_order_relaxed) == true) {
+      const auto messages = counters.messages.load(std::memory_order_relaxed);
+      gasnet_AMPoll();
+      counters.polls.fetch_add(1, std::memory_order_relaxed);
+
+      if (id == 0 && aggregator.enabled()) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= nextFlush) {
+          if (aggregator.flushStale() != OK) {
+            std::abort();
+          }
+          nextFlush = now + aggregator.timeout();
+        }
+      }
+
+      if (counters.messages.load(std::memory_order_relaxed) != messages) {
+        emptyPolls = 0;
+        backoff = std::chrono::microseconds(1);
+        continue;
+      }
+      counters.emptyPolls.fetch_add(1, std::memory_order_relaxed);
+      if (++emptyPolls < m_config.spin) {
+        continue;
+      }
+
+      const auto idleStart = std::chrono::steady_clock::now();
+      std::this_thread::sleep_for(backoff);
+      const auto idle = std::chrono::steady_clock::now() - idleStart;
+      counters.idleNanoseconds.fetch_add(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(idle).count(), std::memory_order_relaxed);
+      backoff = std::min(backoff * 2, m_config.maxBackoff);
+    }
+  }
+
+  // Runs the requests of queue id until stopped and the queue is empty
+  void work(std::size_t id) {
+    auto& queue = m_queues[id];
+    while (true) {
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      queue.ready.wait(lock, [&queue] { return !queue.tasks.empty() || !queue.active; });
+      if (queue.tasks.empty()) {
+        return;
+      }
+      Task task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      lock.unlock();
+
+      // the workers are stopped before the pool, so a shipped call always finds it running
+      if (task.type == AMType::GenericRequest && m_ships.push(std::move(task))) {
+        continue;
+      }
+      Reply reply(task.srcRank);
+      processMessage(reply, task.type, task.payload.data(), task.payload.size(), task.arg);
+    }
+  }
+
+  ProgressConfig m_config;
+  std::atomic<bool> m_active{false};
+  std::vector<std::thread> m_threads;
+  std::unique_ptr<ProgressCounters[]> m_counters;
+  // messages handled by application threads while they wait on a handle
+  ProgressCounters m_applicationCounters;
+
+  // queue of each handler worker. a source rank's requests go to queue srcRank % m_numWorkers.
+  std::size_t m_numWorkers{0};
+  std::unique_ptr<WorkerQueue[]> m_queues;
+  std::vector<std::thread> m_workers;
+  ShipPool m_ships;
+};
+
+ProgressEngine progress;
+
+// Processes an ack for a load
+void handleLoadAck(gex_Token_t token, void* buffer, size_t byteCount, gex_AM_Arg_t completionId) {
+  Nodes::completions.complete(completionId, buffer, byteCount);
+  progress.countMessage();
+
+  static_cast<void>(token);
+}
+
+// Processes an ack. This is just a signal with no payload.
+void handleAck(gex_Token_t token, gex_AM_Arg_t completionId) {
+  Nodes::completions.complete(completionId, nullptr, 0);
+  progress.countMessage();
+
+  static_cast<void>(token);
+}
+
+// Processes an ack with a value
+void handleValueAck(gex_Token_t token, void* buffer, size_t byteCount, gex_AM_Arg_t completionId) {
+  Nodes::completions.complete(completionId, buffer, byteCount);
+  progress.countMessage();
+
+  static_cast<void>(token);
+}
+
+// Processes a batch of load and store records in order and replies with all values and acks in
+// one message
+void processBatch(Reply& reply, void* buffer, size_t byteCount) {
+  std::vector<std::byte> replyRecords;
+  auto record = static_cast<std::byte*>(buffer);
+  const auto end = record + byteCount;
+  while (record < end) {
+    RecordKind kind;
+    GlobalAddress addr;
+    RecordSize n;
+    Nodes::CompletionId id;
+    auto data = static_cast<std::byte*>(unpack(record, kind, addr, n, id));
+
+    const auto offset = replyRecords.size();
+    if (kind == RecordKind::Load) {
+      replyRecords.resize(offset + packedSize(kind, id, n) + n);
+      auto replyData = pack(replyRecords.data() + offset, kind, id, n);
+      std::memcpy(replyData, deglobalify(addr), n);
+      record = data;
+    } else {
+      std::memcpy(deglobalify(addr), data, n);
+      replyRecords.resize(offset + packedSize(kind, id));
+      pack(replyRecords.data() + offset, kind, id);
+      record = data + n;
+    }
+  }
+  assert(replyRecords.size() <= gex_AM_LUBReplyMedium());
+  std::atomic_thread_fence(std::memory_order_release);
+
+  if (auto status = reply.medium(AMType::BatchAck, replyRecords.data(), replyRecords.size());
+      status != GASNET_OK) {
+    std::abort();
+  }
+}
+
+// Processes the values and acks replied to a batch
+void handleBatchAck(gex_Token_t token, void* buffer, size_t byteCount) {
+  auto record = static_cast<std::byte*>(buffer);
+  const auto end = record + byteCount;
+  while (record < end) {
+    RecordKind kind;
+    Nodes::CompletionId id;
+    record = static_cast<std::byte*>(unpack(record, kind, id));
+    if (kind == RecordKind::Load) {
+      RecordSize n;
+      record = static_cast<std::byte*>(unpack(record, n));
+      Nodes::completions.complete(id, record, n);
+      record += n;
+    } else {
+      Nodes::completions.complete(id, nullptr, 0);
+    }
+  }
+  progress.countMessage();
+
+  static_cast<void>(token);
+}
+
+// Processes a shipped call: runs the thunk on the packed arguments and replies with its result
+void processGenericRequest(Reply& reply, void* buffer, size_t byteCount, gex_AM_Arg_t completionId) {
+  std::uint64_t id;
+  std::size_t resultSize;
+  auto args = static_cast<std::byte*>(unpack(buffer, id, resultSize));
+  assert(args <= static_cast<std::byte*>(buffer) + byteCount);
+  static_cast<void>(byteCount);
+
+  const auto thunk = shipThunks().find(id);
+  if (thunk == shipThunks().end()) {
+    std::fprintf(stderr, "pando-rt: rank %lu has no shipped function %016lx\n",
+                 static_cast<unsigned long>(world.rank), static_cast<unsigned long>(id));
+    std::abort();
+  }
+  std::vector<std::byte> result(resultSize);
+  thunk->second(args, result.data());
+
+  // the caller reads what the function wrote once it has the result
+  __pando__fence();
+  if (resultSize == 0) {
+    sendAck(reply, completionId);
+  } else if (auto status = reply.medium(AMType::ValueAck, result.data(), resultSize, completionId);
+             status != GASNET_OK) {
+    std::abort();
+  }
+}
+
+void processMessage(Reply& reply, AMType type, void* buffer, size_t byteCount, gex_AM_Arg_t arg) {
+  switch (type) {
+  case AMType::GenericRequest:
+    processGenericRequest(reply, buffer, byteCount, arg);
+    break;
+  case AMType::Load:
+    processLoad(reply, buffer, byteCount, arg);
+    break;
+  case AMType::Store:
+    processStore(reply, buffer, byteCount, arg);
+    break;
+  case AMType::Atomic:
+    processAtomic(reply, buffer, byteCount, arg);
+    break;
+  case AMType::Batch:
+    processBatch(reply, buffer, byteCount);
+    break;
+  default:
+    std::abort();
+  }
+}
+
+// The request handlers registered with GASNet hand their message to the progress engine
+
+void handleRequest(gex_Token_t token, void* buffer, size_t byteCount, gex_AM_Arg_t completionId) {
+  progress.dispatch(token, AMType::GenericRequest, buffer, byteCount, completionId);
+}
+
+void handleLoad(gex_Token_t token, void* buffer, size_t byteCount, gex_AM_Arg_t completionId) {
+  progress.dispatch(token, AMType::Load, buffer, byteCount, completionId);
+}
+
+void handleStore(gex_Token_t token, void* buffer, size_t byteCount, gex_AM_Arg_t completionId) {
+  progress.dispatch(token, AMType::Store, buffer, byteCount, completionId);
+}
+
+void handleAtomic(gex_Token_t token, void* buffer, size_t byteCount, gex_AM_Arg_t completionId) {
+  progress.dispatch(token, AMType::Atomic, buffer, byteCount, completionId);
+}
+
+void handleBatch(gex_Token_t token, void* buffer, size_t byteCount) {
+  progress.dispatch(token, AMType::Batch, buffer, byteCount);
+}
+
+// Access counters of the sites instrumented by `load-store-pass<profile>`, one table per thread.
+// Only the owning thread writes its table, so a record costs a few relaxed loads and stores and no
+// locks. The tables of all threads are merged and written to a file at exit.
+class SiteProfile {
+public:
+  static constexpr std::size_t capacity = 4096;
+
+  // Records an access of n bytes by a site, taking latency nanoseconds
+  void record(std::uint64_t site, const char* location, bool local, std::uint64_t n,
+              std::uint64_t latency) noexcept {
+    Entry* entry = find(site, location);
+    if (entry == nullptr) {
+      add(m_dropped, 1);
+      return;
+    }
+    add(local ? entry->localHits : entry->remoteHits, 1);
+    add(entry->bytes, n);
+    add(entry->latencyNanoseconds, latency);
+  }
+
+  // Totals of a site, summed over threads
+  struct Totals {
+    const char* location{nullptr};
+    std::uint64_t localHits{0};
+    std::uint64_t remoteHits{0};
+    std::uint64_t bytes{0};
+    std::uint64_t latencyNanoseconds{0};
+  };
+
+  // Adds this table's counters to totals and returns the number of records dropped because the
+  // table was full
+  std::uint64_t addTo(std::unordered_map<std::uint64_t, Totals>& totals) const {
+    for (std::size_t i = 0; i < capacity; ++i) {
+      const auto& entry = m_entries[i];
+      const auto site = entry.site.load(std::memory_order_acquire);
+      if (site == emptySite) {
+        continue;
+      }
+      auto& total = totals[site];
+      total.location = entry.location;
+      total.localHits += entry.localHits.load(std::memory_order_relaxed);
+      total.remoteHits += entry.remoteHits.load(std::memory_order_relaxed);
+      total.bytes += entry.bytes.load(std::memory_order_relaxed);
+      total.latencyNanoseconds += entry.latencyNanoseconds.load(std::memory_order_relaxed);
+    }
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr std::uint64_t emptySite = ~std::uint64_t{0};
+
+  struct Entry {
+    std::atomic<std::uint64_t> site{emptySite};
+    // "function,file,line" of the site, a constant emitted by the pass
+    const char* location{nullptr};
+    std::atomic<std::uint64_t> localHits{0};
+    std::atomic<std::uint64_t> remoteHits{0};
+    std::atomic<std::uint64_t> bytes{0};
+    std::atomic<std::uint64_t> latencyNanoseconds{0};
+  };
+
+  // the table is read at exit while other threads may still record, so counters are atomics
+  // updated by their only writer
+  static void add(std::atomic<std::uint64_t>& counter, std::uint64_t n) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  // Returns the entry of a site, inserting it on first use. Returns null if the table is full.
+  Entry* find(std::uint64_t site, const char* location) noexcept {
+    // site ids are a function hash above an ordinal, mix both into the slot
+    const auto hash = ((site ^ (site >> 32)) * 0x9E3779B97F4A7C15ull) >> 32;
+    for (std::size_t probe = 0; probe < capacity; ++probe) {
+      auto& entry = m_entries[(hash + probe) & (capacity - 1)];
+      const auto entrySite = entry.site.load(std::memory_order_relaxed);
+      if (entrySite == site) {
+        return &entry;
+      }
+      if (entrySite == emptySite) {
+        entry.location = location;
+        entry.site.store(site, std::memory_order_release);
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  std::unique_ptr<Entry[]> m_entries{new Entry[capacity]};
+  std::atomic<std::uint64_t> m_dropped{0};
+};
+
+// Site profiles of all threads. Tables outlive their threads so they can be written at exit.
+struct {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<SiteProfile>> tables;
+} siteProfiles;
+
+// Writes the merged site profile to PANDO_PROFILE (default pando_profile).<rank>.csv, one line per
+// site, sites with the most remote accesses first
+void writeSiteProfile() {
+  std::unordered_map<std::uint64_t, SiteProfile::Totals> totals;
+  std::uint64_t dropped = 0;
+  {
+    std::lock_guard<std::mutex> lock(siteProfiles.mutex);
+    for (const auto& table : siteProfiles.tables) {
+      dropped += table->addTo(totals);
+    }
+  }
+  std::vector<std::pair<std::uint64_t, SiteProfile::Totals>> sites(totals.begin(), totals.end());
+  std::sort(sites.begin(), sites.end(), [](const auto& a, const auto& b) {
+    return a.second.remoteHits != b.second.remoteHits ? a.second.remoteHits > b.second.remoteHits
+                                                      : a.first < b.first;
+  });
+
+  const char* prefix = std::getenv("PANDO_PROFILE");
+  const auto rank = (world.rank == GEX_RANK_INVALID) ? 0 : world.rank;
+  const std::string path = std::string(prefix ? prefix : "pando_profile") + "." + std::to_string(rank) + ".csv";
+  std::FILE* file = std::fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    std::fprintf(stderr, "pando-rt: could not write the site profile to %s\n", path.c_str());
+    return;
+  }
+  std::fprintf(file, "site,function,file,line,local_hits,remote_hits,bytes,latency_ns\n");
+  for (const auto& [site, total] : sites) {
+    std::fprintf(file, "0x%016llx,%s,%llu,%llu,%llu,%llu\n", static_cast<unsigned long long>(site),
+                 total.location ? total.location : ",,0",
+                 static_cast<unsigned long long>(total.localHits),
+                 static_cast<unsigned long long>(total.remoteHits),
+                 static_cast<unsigned long long>(total.bytes),
+                 static_cast<unsigned long long>(total.latencyNanoseconds));
+  }
+  std::fclose(file);
+  if (dropped != 0) {
+    std::fprintf(stderr, "pando-rt: %llu profile records dropped, more than %zu sites in a thread\n",
+                 static_cast<unsigned long long>(dropped), SiteProfile::capacity);
+  }
+}
+
+// Returns the calling thread's site profile, registering it on first use
+SiteProfile& threadSiteProfile() {
+  thread_local SiteProfile* profile = [] {
+    auto table = std::make_unique<SiteProfile>();
+    auto tablePtr = table.get();
+    std::lock_guard<std::mutex> lock(siteProfiles.mutex);
+    if (siteProfiles.tables.empty()) {
+      std::atexit(writeSiteProfile);
+    }
+    siteProfiles.tables.push_back(std::move(table));
+    return tablePtr;
+  }();
+  return *profile;
+}
+
+Status initialize(std::uint64_t num_hosts) {
+  auto status = gex_Client_Init(&world.client, &world.endpoint, &world.team,
+                                      world.clientName.data(), nullptr, nullptr, 0);
+  if(status != GASNET_OK) {
+    return GASNET_INIT_ERROR;
+  }
+  world.rank = gex_TM_QueryRank(world.team);
+  world.size = gex_TM_QuerySize(world.team);
+  __pando__local_tag = (0xFFFF - (world.rank & 0xFFFF));
+  if (auto configStatus = readCacheConfig(cacheConfig); configStatus != OK) {
+    return configStatus;
+  }
+  if (auto configStatus = readProgressConfig(progressConfig); configStatus != OK) {
+    return configStatus;
+  }
+
+  // aggregation is on unless PANDO_AGGREGATION=0. PANDO_AGGREGATION_TIMEOUT_US bounds how long a
+  // record waits in its buffer.
+  const char* aggregation = std::getenv("PANDO_AGGREGATION");
+  const char* aggregationTimeout = std::getenv("PANDO_AGGREGATION_TIMEOUT_US");
+  aggregator.init(world.size, !aggregation || std::strtoull(aggregation, nullptr, 0) != 0,
+                  std::chrono::microseconds(aggregationTimeout ? std::strtoull(aggregationTimeout, nullptr, 0) : 100));
+
+  status = gex_EP_RegisterHandlers(world.endpoint, world.htable, sizeof(world.htable)/ sizeof(gex_AM_Entry_t));
+  if(status != GASNET_OK) { return GASNET_INIT_ERROR; }
+  const char* endpoints = std::getenv("PANDO_THREAD_ENDPOINTS");
+  threadEndpoints = endpoints && std::strtoull(endpoints, nullptr, 0) != 0;
+
+  // transfers to memory in a rank's segment use RMA. PANDO_SEGMENT_SIZE (bytes) sets the size of
+  // the segment this rank attaches, 0 (the default) attaches none. The segment holds the symmetric
+  // heap, so every rank must attach the same size.
+  const char* segmentSize = std::getenv("PANDO_SEGMENT_SIZE");
+  if (segmentSize && std::strtoull(segmentSize, nullptr, 0) != 0) {
+    if (gex_Segment_Attach(&world.segment, world.team, std::strtoull(segmentSize, nullptr, 0)) != GASNET_OK) {
+      return GASNET_INIT_ERROR;
+    }
+    // the queries complete asynchronously, into ownerAddrs and sizes. a rank whose segment stays
+    // unknown (size 0) is reached through AMs only.
+    std::vector<void*> ownerAddrs(world.size, nullptr);
+    std::vector<std::uintptr_t> sizes(world.size, 0);
+    std::vector<gex_Event_t> queries;
+    for (std::uint64_t rank = 0; rank < world.size; ++rank) {
+      queries.push_back(gex_EP_QueryBoundSegmentNB(world.team, rank, &ownerAddrs[rank], nullptr, &sizes[rank], 0));
+    }
+    gex_Event_WaitAll(queries.data(), queries.size(), 0);
+    world.segments.resize(world.size);
+    for (std::uint64_t rank = 0; rank < world.size; ++rank) {
+      world.segments[rank] = {reinterpret_cast<std::uintptr_t>(ownerAddrs[rank]), sizes[rank]};
+    }
+
+    const auto section = reinterpret_cast<const std::byte*>(__start_pando_symheap);
+    const std::size_t sectionSize = (section != nullptr) ? __stop_pando_symheap - __start_pando_symheap : 0;
+    if (!symmetricHeap.init(static_cast<std::byte*>(gex_Segment_QueryAddr(world.segment)),
+                            gex_Segment_QuerySize(world.segment), section, sectionSize)) {
+      std::fprintf(stderr, "pando-rt: the pando_symheap section (%zu bytes) does not fit in PANDO_SEGMENT_SIZE\n",
+                   sectionSize);
+      return PANDO_INVALID_CONFIG;
+    }
+    const char* rma = std::getenv("PANDO_RMA");
+    rmaAccesses = !rma || std::strtoull(rma, nullptr, 0) != 0;
+  }
+  if (auto progressStatus = progress.start(progressConfig); progressStatus != OK) {
+    return progressStatus;
+  }
+  auto barrierEvent = gex_Coll_BarrierNB(world.team, 0);
+  gex_Event_Wait(barrierEvent);
+  return OK;
+}
+
+Status finalize() {
+  if (aggregator.flushAll() != OK) {
+    std::abort();
+  }
+  if (cacheConfig.size != 0) {
+    std::printf("pando-rt: rank %lu read cache: %lu hits, %lu misses, %lu evictions\n",
+                static_cast<unsigned long>(world.rank),
+                static_cast<unsigned long>(cacheCounters.hits.load()),
+                static_cast<unsigned long>(cacheCounters.misses.load()),
+                static_cast<unsigned long>(cacheCounters.evictions.load()));
+  }
+  progress.stop();
+  if (progressConfig.stats) {
+    progress.printStats();
+  }
+  gasnet_barrier_notify(0, GASNET_BARRIERFLAG_ANONYMOUS);
+  gasnet_barrier_wait(0, GASNET_BARRIERFLAG_ANONYMOUS);
+  return OK;
+}
+
+extern "C" {
+  int check_if_global(void* ptr) {
+    uintptr_t p = (uintptr_t) ptr;
+    return (p >> 48) != 0x0;
+  }
+
+  void* deglobalify(void* ptr) {
+    uintptr_t p = (uintptr_t) ptr;
+    uintptr_t mask = ((uintptr_t)0xFFFF - (world.rank & 0xFFFF)) << 48;
+    return (void *) (p & ~mask);
+  }
+
+  // globals of the pando_symheap section live in the symmetric heap once it is set up. an address
+  // that already carries a tag (e.g. a remote pointer read back from memory) is left unchanged.
+  void* globalify(void* ptr) {
+    if (((uintptr_t) ptr >> 48) != 0x0) {
+      return ptr;
+    }
+    uintptr_t p = (uintptr_t) symmetricHeap.relocate(ptr);
+    uintptr_t mask = ((uintptr_t)0xFFFF - (world.rank & 0xFFFF)) << 48;
+    return (void *) (p | mask);
+  }
+
+  // allocates n bytes of the symmetric heap. ranks call it collectively, in the same order and
+  // with the same sizes, and each gets the block at the same offset of its segment. returns this
+  // rank's block, or null if no segment is attached or the heap is full.
+  void* pando_malloc(size_t n) {
+    void* ptr = symmetricHeap.allocate(n);
+    return (ptr != nullptr) ? globalify(ptr) : nullptr;
+  }
+
+  // frees a block of pando_malloc, collectively like the allocation
+  void pando_free(void* ptr) {
+    if (ptr == nullptr) {
+      return;
+    }
+    assert(ownerOf(ptr) == world.rank);
+    if (!symmetricHeap.free(deglobalify(ptr))) {
+      std::fprintf(stderr, "pando-rt: pando_free of %p, which pando_malloc did not return\n", ptr);
+      std::abort();
+    }
+  }
+
+  // returns the global address of the copy on rank of the symmetric heap object at ptr (a
+  // pando_malloc block or a pando_symheap global, possibly of another rank)
+  void* pando_symmetric_address(void* ptr, uint64_t rank) {
+    const auto owner = ownerOf(ptr);
+    assert(inSegment(owner, ptr, 1) && rank < world.segments.size());
+    const auto offset = nativeAddress(ptr) - world.segments[owner].first;
+    const uintptr_t tag = ((uintptr_t)0xFFFF - (rank & 0xFFFF)) << 48;
+    return (void*) ((world.segments[rank].first + offset) | tag);
+  }
+
+  void __pando__replace_store_int64(uint64_t val, uint64_t* dst) {
+    assert(check_if_global(dst));
+    storeValue(val, dst);
+  }
+
+  void __pando__replace_store_ptr(void* val, void** dst) {
+    assert(check_if_global(dst));
+    storeValue(val, dst);
+  }
+
+  uint64_t __pando__replace_load_int64(uint64_t* src) {
+    return loadValue<uint64_t>(src);
+  }
+
+  void* __pando__replace_load_ptr(void** src) {
+    return loadValue<void*>(src);
+  }
+
+  // the earlier names of the entry points above, kept for runtimes and code built against them
+  void __pando__replace_store64(uint64_t val, uint64_t* dst) {
+    __pando__replace_store_int64(val, dst);
+  }
+
+  void __pando__replace_storeptr(void* val, void** dst) {
+    __pando__replace_store_ptr(val, dst);
+  }
+
+  uint64_t __pando__replace_load64(uint64_t* src) {
+    return __pando__replace_load_int64(src);
+  }
+
+  void* __pando__replace_loadptr(void** src) {
+    return __pando__replace_load_ptr(src);
+  }
+
+  // accesses through addresses the provenance pass proved tagged, which skip the tag assertion
+  void __pando__replace_store_int64_nocheck(uint64_t val, uint64_t* dst) {
+    storeValue(val, dst);
+  }
+
+  void __pando__replace_store_ptr_nocheck(void* val, void** dst) {
+    storeValue(val, dst);
+  }
+
+  uint64_t __pando__replace_load_int64_nocheck(uint64_t* src) {
+    return loadValue<uint64_t>(src);
+  }
+
+  void* __pando__replace_load_ptr_nocheck(void** src) {
+    return loadValue<void*>(src);
+  }
+
+  // loads a vector into a per-thread scratch buffer, valid until the thread's next vector load.
+  // the load-store pass loads the vector value from it right away.
+  void* __pando__replace_load_vector(void* src, size_t element_size, size_t num_elements) {
+    assert(check_if_global(src));
+    const auto n = element_size * num_elements;
+    const auto nodeIdx = ownerOf(src);
+    if (nodeIdx == world.rank) {
+      return deglobalify(src);
+    }
+
+    // the pass loads the vector with its natural alignment
+    struct alignas(64) ScratchLine {
+      std::byte bytes[64];
+    };
+    thread_local std::vector<ScratchLine> scratchLines;
+    scratchLines.resize((n + sizeof(ScratchLine) - 1) / sizeof(ScratchLine));
+    auto scratch = reinterpret_cast<std::byte*>(scratchLines.data());
+    if (storeBuffer.flush(src, n) != OK || remoteGet(nodeIdx, scratch, src, n) != OK) {
+      std::abort();
+    }
+    return scratch;
+  }
+
+  void __pando__replace_store_vector(void* val, void* dst, size_t element_size, size_t num_elements) {
+    assert(check_if_global(dst));
+    const auto n = element_size * num_elements;
+    const auto nodeIdx = ownerOf(dst);
+    if (nodeIdx == world.rank) {
+      std::memcpy(deglobalify(dst), val, n);
+      return;
+    }
+
+    readCache.invalidate(dst, n);
+    if (storeBuffer.flush(dst, n) != OK || remotePut(nodeIdx, dst, val, n) != OK) {
+      std::abort();
+    }
+  }
+
+  // vector loads and stores by value, for the widths that fit a SIMD register
+  v16i8 __pando__replace_load_v16i8(v16i8* src) {
+    return loadVector<v16i8>(src);
+  }
+
+  void __pando__replace_store_v16i8(v16i8 val, v16i8* dst) {
+    assert(check_if_global(dst));
+    storeVector(val, dst);
+  }
+
+  v8i16 __pando__replace_load_v8i16(v8i16* src) {
+    return loadVector<v8i16>(src);
+  }
+
+  void __pando__replace_store_v8i16(v8i16 val, v8i16* dst) {
+    assert(check_if_global(dst));
+    storeVector(val, dst);
+  }
+
+  v4i32 __pando__replace_load_v4i32(v4i32* src) {
+    return loadVector<v4i32>(src);
+  }
+
+  void __pando__replace_store_v4i32(v4i32 val, v4i32* dst) {
+    assert(check_if_global(dst));
+    storeVector(val, dst);
+  }
+
+  v2i64 __pando__replace_load_v2i64(v2i64* src) {
+    return loadVector<v2i64>(src);
+  }
+
+  void __pando__replace_store_v2i64(v2i64 val, v2i64* dst) {
+    assert(check_if_global(dst));
+    storeVector(val, dst);
+  }
+
+  v4f32 __pando__replace_load_v4f32(v4f32* src) {
+    return loadVector<v4f32>(src);
+  }
+
+  void __pando__replace_store_v4f32(v4f32 val, v4f32* dst) {
+    assert(check_if_global(dst));
+    storeVector(val, dst);
   }
 
+  v2f64 __pando__replace_load_v2f64(v2f64* src) {
+    return loadVector<v2f64>(src);
+  }
+
+  void __pando__replace_store_v2f64(v2f64 val, v2f64* dst) {
+    assert(check_if_global(dst));
+    storeVector(val, dst);
+  }
+
+  uint64_t __pando__atomic_rmw_int64(uint64_t* ptr, uint64_t val, uint32_t op) {
+    assert(check_if_global(ptr));
+    return atomicValue<uint64_t>(ptr, static_cast<AtomicOp>(op), val, 0);
+  }
+
+  uint32_t __pando__atomic_rmw_int32(uint32_t* ptr, uint32_t val, uint32_t op) {
+    assert(check_if_global(ptr));
+    return atomicValue<uint32_t>(ptr, static_cast<AtomicOp>(op), val, 0);
+  }
+
+  uint16_t __pando__atomic_rmw_int16(uint16_t* ptr, uint16_t val, uint32_t op) {
+    assert(check_if_global(ptr));
+    return atomicValue<uint16_t>(ptr, static_cast<AtomicOp>(op), val, 0);
+  }
+
+  uint8_t __pando__atomic_rmw_int8(uint8_t* ptr, uint8_t val, uint32_t op) {
+    assert(check_if_global(ptr));
+    return atomicValue<uint8_t>(ptr, static_cast<AtomicOp>(op), val, 0);
+  }
+
+  // compare-exchange, returns the old value. the load-store pass compares it to expected.
+  uint64_t __pando__atomic_cmpxchg_int64(uint64_t* ptr, uint64_t expected, uint64_t desired) {
+    assert(check_if_global(ptr));
+    return atomicValue<uint64_t>(ptr, AtomicOp::CmpXchg, desired, expected);
+  }
+
+  uint32_t __pando__atomic_cmpxchg_int32(uint32_t* ptr, uint32_t expected, uint32_t desired) {
+    assert(check_if_global(ptr));
+    return atomicValue<uint32_t>(ptr, AtomicOp::CmpXchg, desired, expected);
+  }
+
+  uint16_t __pando__atomic_cmpxchg_int16(uint16_t* ptr, uint16_t expected, uint16_t desired) {
+    assert(check_if_global(ptr));
+    return atomicValue<uint16_t>(ptr, AtomicOp::CmpXchg, desired, expected);
+  }
+
+  uint8_t __pando__atomic_cmpxchg_int8(uint8_t* ptr, uint8_t expected, uint8_t desired) {
+    assert(check_if_global(ptr));
+    return atomicValue<uint8_t>(ptr, AtomicOp::CmpXchg, desired, expected);
+  }
+
+  // release point: sends this thread's buffered remote stores and waits until they are applied,
+  // and drops its cached remote reads. the load-store pass inserts it before atomics, fences,
+  // calls into unknown code and returns.
+  void __pando__fence() {
+    if (storeBuffer.flush() != OK) {
+      std::abort();
+    }
+    readCache.invalidate();
+  }
+
+  // copies n bytes from src to dst, which may overlap (like memmove). the load-store pass lowers
+  // llvm.memcpy, llvm.memmove and their libc forms to it. copies between this node and another are
+  // one bulk get or put. copies between two other nodes run at the owner of src, which puts the
+  // bytes to the owner of dst without going through this node.
+  void* __pando__memcpy(void* dst, const void* src, size_t n) {
+    if (n == 0) {
+      return dst;
+    }
+    const auto source = const_cast<void*>(src);
+    const auto dstNode = ownerOf(dst);
+    const auto srcNode = ownerOf(source);
+    if (srcNode == world.rank && dstNode == world.rank) {
+      std::memmove(deglobalify(dst), deglobalify(source), n);
+    } else if (srcNode == world.rank) {
+      readCache.invalidate(dst, n);
+      if (storeBuffer.flush(dst, n) != OK || remotePut(dstNode, dst, deglobalify(source), n) != OK) {
+        std::abort();
+      }
+    } else if (dstNode == world.rank) {
+      if (storeBuffer.flush(source, n) != OK || remoteGet(srcNode, deglobalify(dst), source, n) != OK) {
+        std::abort();
+      }
+    } else {
+      // the owner of src sees this thread's stores, and this thread's cached copy of dst is stale
+      __pando__fence();
+      const CopyArgs args{dst, source, n};
+      Nodes::Future future;
+      if (remoteShip(srcNode, copyThunkId, &args, sizeof(args), 0, future) != OK) {
+        std::abort();
+      }
+      future.wait();
+    }
+    return dst;
+  }
+
+  // sets n bytes at dst to value, like memset. the load-store pass lowers llvm.memset and memset to
+  // it. remote fills run at the owner of dst, in one message.
+  void* __pando__memset(void* dst, int value, size_t n) {
+    if (n == 0) {
+      return dst;
+    }
+    const auto dstNode = ownerOf(dst);
+    if (dstNode == world.rank) {
+      std::memset(deglobalify(dst), value, n);
+      return dst;
+    }
+
+    __pando__fence();
+    const FillArgs args{dst, static_cast<std::uint64_t>(value), n};
+    Nodes::Future future;
+    if (remoteShip(dstNode, fillThunkId, &args, sizeof(args), 0, future) != OK) {
+      std::abort();
+    }
+    future.wait();
+    return dst;
+  }
+
+  // gathers num_elements lanes of element_size bytes into dst: lane i is read from ptrs[i] if
+  // mask[i] is set and left as it is otherwise. the load-store pass lowers llvm.masked.gather to it.
+  // local lanes are read natively, remote ones in one batch per owner.
+  void __pando__gather(void* dst, void* const* ptrs, const uint8_t* mask, size_t element_size,
+                       size_t num_elements) {
+    const auto lanes = static_cast<std::byte*>(dst);
+    std::vector<std::pair<std::uint64_t, std::size_t>> remote;
+    for (std::size_t i = 0; i < num_elements; ++i) {
+      if (!mask[i]) {
+        continue;
+      }
+      assert(check_if_global(ptrs[i]));
+      const auto nodeIdx = ownerOf(ptrs[i]);
+      if (nodeIdx == world.rank) {
+        copyLane(lanes + i * element_size, deglobalify(ptrs[i]), element_size);
+      } else {
+        remote.emplace_back(nodeIdx, i);
+      }
+    }
+    if (!remote.empty() && remoteLanes(RecordKind::Load, lanes, ptrs, remote, element_size) != OK) {
+      std::abort();
+    }
+  }
+
+  // scatters num_elements lanes of element_size bytes from src: lane i is written to ptrs[i] if
+  // mask[i] is set, in lane order. the load-store pass lowers llvm.masked.scatter to it. local lanes
+  // are written natively, remote ones in one batch per owner, which are applied before it returns.
+  void __pando__scatter(void* src, void* const* ptrs, const uint8_t* mask, size_t element_size,
+                        size_t num_elements) {
+    const auto lanes = static_cast<std::byte*>(src);
+    std::vector<std::pair<std::uint64_t, std::size_t>> remote;
+    for (std::size_t i = 0; i < num_elements; ++i) {
+      if (!mask[i]) {
+        continue;
+      }
+      assert(check_if_global(ptrs[i]));
+      const auto nodeIdx = ownerOf(ptrs[i]);
+      if (nodeIdx == world.rank) {
+        copyLane(deglobalify(ptrs[i]), lanes + i * element_size, element_size);
+      } else {
+        remote.emplace_back(nodeIdx, i);
+      }
+    }
+    if (!remote.empty() && remoteLanes(RecordKind::Store, lanes, ptrs, remote, element_size) != OK) {
+      std::abort();
+    }
+  }
+
+  // starts loading n bytes (at most 8) of global memory at src. returns a handle for the
+  // matching __pando__load_wait_* call, which the load-store pass places where the value is used.
+  void* __pando__load_issue(void* src, size_t n) {
+    assert(check_if_global(src));
+    assert(n <= sizeof(Nodes::CompletionSlot::value));
+    Nodes::Future future;
+    const auto nodeIdx = ownerOf(src);
+    if (nodeIdx == world.rank) {
+      future.setReady(deglobalify(src), n);
+    } else if (readCache.enabled()) {
+      // a cached read completes right away
+      std::byte value[sizeof(Nodes::CompletionSlot::value)];
+      if (readRemote(nodeIdx, src, value, n) != OK) {
+        std::abort();
+      }
+      future.setReady(value, n);
+    } else if (storeBuffer.flush(src, n) != OK || remoteLoad(nodeIdx, src, n, future) != OK) {
+      std::abort();
+    }
+    return loadHandle(std::move(future));
+  }
+
+  uint64_t __pando__load_wait_int64(void* handle) {
+    return waitLoad<uint64_t>(handle);
+  }
+
+  uint32_t __pando__load_wait_int32(void* handle) {
+    return waitLoad<uint32_t>(handle);
+  }
+
+  uint8_t __pando__load_wait_int8(void* handle) {
+    return waitLoad<uint8_t>(handle);
+  }
+
+  float __pando__load_wait_float32(void* handle) {
+    return waitLoad<float>(handle);
+  }
+
+  void* __pando__load_wait_ptr(void* handle) {
+    return waitLoad<void*>(handle);
+  }
+
+  // copies n bytes of global memory at src into the local buffer dst
+  void __pando__bulk_get(void* dst, void* src, size_t n) {
+    assert(check_if_global(src));
+    const auto nodeIdx = ownerOf(src);
+    if (nodeIdx == world.rank) {
+      std::memcpy(dst, deglobalify(src), n);
+    } else if (storeBuffer.flush(src, n) != OK || remoteGet(nodeIdx, dst, src, n) != OK) {
+      std::abort();
+    }
+  }
+
+  // copies n bytes of the local buffer src to global memory at dst
+  void __pando__bulk_put(void* dst, void* src, size_t n) {
+    assert(check_if_global(dst));
+    const auto nodeIdx = ownerOf(dst);
+    if (nodeIdx == world.rank) {
+      std::memcpy(deglobalify(dst), src, n);
+    } else {
+      readCache.invalidate(dst, n);
+      if (storeBuffer.flush(dst, n) != OK || remotePut(nodeIdx, dst, src, n) != OK) {
+        std::abort();
+      }
+    }
+  }
+
+  // returns the start time of an access profiled by `load-store-pass<profile>`
+  uint64_t __pando__profile_begin() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // counts an access of n bytes at addr by a profiled site. start is 0 for accesses that are not
+  // timed (allocas).
+  void __pando__profile_end(uint64_t site, uint64_t start, void* addr, uint64_t n, const char* location) {
+    const auto latency = (start == 0) ? 0 : __pando__profile_begin() - start;
+    threadSiteProfile().record(site, location, ownerOf(addr) == world.rank, n, latency);
+  }
+
+  // registers the thunk of a function shipped by `ship-pass`. called by module constructors.
+  void __pando__ship_register(uint64_t id, void (*thunk)(void*, void*)) {
+    auto [entry, inserted] = shipThunks().emplace(id, thunk);
+    if (!inserted && entry->second != thunk) {
+      std::fprintf(stderr, "pando-rt: two shipped functions hash to %016lx\n", static_cast<unsigned long>(id));
+      std::abort();
+    }
+  }
+
+  // runs the thunk of a shipped function at the owner of owner with args_size bytes of packed
+  // arguments and copies its result_size bytes of result to result. this thread's buffered stores
+  // are sent first and its cached reads dropped, as for a call into unknown code. arguments or a
+  // result too large for one message run the thunk here instead, with remote accesses.
+  void __pando__ship(uint64_t id, void (*thunk)(void*, void*), void* owner, void* args,
+                     uint64_t args_size, void* result, uint64_t result_size) {
+    const auto nodeIdx = ownerOf(owner);
+    if (nodeIdx == world.rank) {
+      thunk(args, result);
+      return;
+    }
+
+    __pando__fence();
+    Nodes::Future future(result);
+    const auto status = remoteShip(nodeIdx, id, args, args_size, result_size, future);
+    if (status == PANDO_BAD_ALLOC) {
+      future.cancel();
+      thunk(args, result);
+      return;
+    }
+    if (status != OK) {
+      std::abort();
+    }
+    future.wait();
+  }
 }
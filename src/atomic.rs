@@ -0,0 +1,160 @@
+use llvm_plugin::inkwell::builder::Builder;
+use llvm_plugin::inkwell::module::Module;
+use llvm_plugin::inkwell::types::{AnyType, AnyTypeEnum};
+use llvm_plugin::inkwell::values::{AsValueRef, BasicValue, BasicValueEnum, FunctionValue, InstructionValue, IntValue};
+use llvm_plugin::inkwell::IntPredicate;
+use llvm_sys::core::LLVMGetAtomicRMWBinOp;
+use llvm_sys::LLVMAtomicRMWBinOp;
+
+// returns the runtime encoding of an atomicrmw's operation, the `op` argument of
+// __pando__atomic_rmw_*. the runtimes use the same numbering, in which 11 is cmpxchg.
+fn rmw_op(instr: InstructionValue) -> u64 {
+  // SAFETY: instr is an atomicrmw owned by the module
+  match unsafe { LLVMGetAtomicRMWBinOp(instr.as_value_ref()) } {
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpXchg => 0,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpAdd => 1,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpSub => 2,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpAnd => 3,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpNand => 4,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpOr => 5,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpXor => 6,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpMax => 7,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpMin => 8,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpUMax => 9,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpUMin => 10,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpFAdd => 12,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpFSub => 13,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpFMax => 14,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpFMin => 15,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpUIncWrap => 16,
+    LLVMAtomicRMWBinOp::LLVMAtomicRMWBinOpUDecWrap => 17,
+  }
+}
+
+// returns the runtime function `<prefix>int<width>` for an atomic on values of type `value_type`, or
+// None for types the runtimes have no atomics of (e.g. half). pointers are exchanged as 64-bit
+// integers, floats and doubles as the integers of their bits.
+fn runtime_func<'ctx>(module: &Module<'ctx>, prefix: &str, value_type: AnyTypeEnum<'ctx>) -> Option<FunctionValue<'ctx>> {
+  let cx = module.get_context();
+  let width = match value_type {
+    AnyTypeEnum::IntType(int_type) if matches!(int_type.get_bit_width(), 8 | 16 | 32 | 64) => int_type.get_bit_width(),
+    AnyTypeEnum::PointerType(_) => 64,
+    AnyTypeEnum::FloatType(float_type) if float_type == cx.f32_type() => 32,
+    AnyTypeEnum::FloatType(float_type) if float_type == cx.f64_type() => 64,
+    _ => return None,
+  };
+
+  let name = format!("{}int{}", prefix, width);
+  Some(module.get_function(&name).unwrap_or_else(|| {
+    println!("[LOAD-STORE PASS] atomics need the runtime to define {}", name);
+    panic!("missing atomic function")
+  }))
+}
+
+// converts a pointer or floating-point operand to the integer the runtime takes. integers pass through.
+fn to_runtime_value<'ctx>(module: &Module<'ctx>, builder: &Builder<'ctx>, value: BasicValueEnum<'ctx>) -> IntValue<'ctx> {
+  let cx = module.get_context();
+  match value {
+    BasicValueEnum::PointerValue(ptr) => builder.build_ptr_to_int(ptr, cx.i64_type(), "atomic_operand").unwrap(),
+    BasicValueEnum::FloatValue(float) => {
+      // only floats and doubles get here
+      let int_type = if float.get_type() == cx.f32_type() { cx.i32_type() } else { cx.i64_type() };
+      builder.build_bit_cast(float, int_type, "atomic_operand").unwrap().into_int_value()
+    },
+    other => other.into_int_value(),
+  }
+}
+
+// converts the runtime's result back to the atomic's value type
+fn from_runtime_value<'ctx>(
+  builder: &Builder<'ctx>,
+  value: IntValue<'ctx>,
+  value_type: AnyTypeEnum<'ctx>,
+) -> BasicValueEnum<'ctx> {
+  match value_type {
+    AnyTypeEnum::PointerType(ptr_type) => builder.build_int_to_ptr(value, ptr_type, "atomic_old").unwrap().into(),
+    AnyTypeEnum::FloatType(float_type) => builder.build_bit_cast(value, float_type, "atomic_old").unwrap(),
+    _ => value.into(),
+  }
+}
+
+// a native atomic would dereference the tagged address, so an atomic the runtimes cannot run stops
+// the pass
+fn unsupported(instr: InstructionValue) -> ! {
+  println!(
+    "[LOAD-STORE PASS] the runtimes have no atomic for this type: {}",
+    instr.print_to_string().to_string()
+  );
+  panic!("unsupported atomic type")
+}
+
+fn operand<'ctx>(instr: InstructionValue<'ctx>, index: u32) -> BasicValueEnum<'ctx> {
+  instr.get_operand(index).unwrap().left().unwrap()
+}
+
+// Replaces `atomicrmw <op> ptr %p, T %val` with `__pando__atomic_rmw_intN(%p, %val, op)`, which
+// runs the operation at the owner of %p and returns the old value. Atomics on types the runtimes do
+// not support (e.g. half, i128) are an error.
+pub fn lower_rmw<'ctx>(module: &Module<'ctx>, builder: &Builder<'ctx>, instr: InstructionValue<'ctx>) {
+  let value_type = instr.get_type();
+  let Some(func) = runtime_func(module, "__pando__atomic_rmw_", value_type) else {
+    unsupported(instr);
+  };
+  let op = rmw_op(instr);
+  builder.position_before(&instr);
+
+  let ptr = operand(instr, 0);
+  let value = to_runtime_value(module, builder, operand(instr, 1));
+  let op = module.get_context().i32_type().const_int(op, false);
+  let old = builder
+    .build_direct_call(func, &[ptr.into(), value.into(), op.into()], "atomic_rmw")
+    .unwrap()
+    .try_as_basic_value()
+    .left()
+    .unwrap()
+    .into_int_value();
+
+  let old = from_runtime_value(builder, old, value_type);
+  instr.replace_all_uses_with(&old.as_instruction_value().unwrap());
+  instr.erase_from_basic_block();
+}
+
+// Replaces `cmpxchg ptr %p, T %cmp, T %new` with `__pando__atomic_cmpxchg_intN(%p, %cmp, %new)`,
+// which runs the exchange at the owner of %p and returns the old value. The { T, i1 } result is
+// rebuilt from the old value. Unsupported types are an error, like in `lower_rmw`.
+pub fn lower_cmpxchg<'ctx>(module: &Module<'ctx>, builder: &Builder<'ctx>, instr: InstructionValue<'ctx>) {
+  let result_type = match instr.get_type() {
+    AnyTypeEnum::StructType(struct_type) => struct_type,
+    other => panic!("cmpxchg should return a struct, not {:?}", other),
+  };
+  let value_type = result_type.get_field_type_at_index(0).unwrap().as_any_type_enum();
+  let Some(func) = runtime_func(module, "__pando__atomic_cmpxchg_", value_type) else {
+    unsupported(instr);
+  };
+  builder.position_before(&instr);
+
+  let ptr = operand(instr, 0);
+  let expected = to_runtime_value(module, builder, operand(instr, 1));
+  let desired = to_runtime_value(module, builder, operand(instr, 2));
+  let old = builder
+    .build_direct_call(func, &[ptr.into(), expected.into(), desired.into()], "atomic_cmpxchg")
+    .unwrap()
+    .try_as_basic_value()
+    .left()
+    .unwrap()
+    .into_int_value();
+  let success = builder
+    .build_int_compare(IntPredicate::EQ, old, expected, "atomic_success")
+    .unwrap();
+
+  let result = builder
+    .build_insert_value(result_type.get_undef(), from_runtime_value(builder, old, value_type), 0, "")
+    .unwrap();
+  let result = builder
+    .build_insert_value(result, success, 1, "atomic_result")
+    .unwrap()
+    .into_struct_value();
+
+  instr.replace_all_uses_with(&result.as_instruction_value().unwrap());
+  instr.erase_from_basic_block();
+}
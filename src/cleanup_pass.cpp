@@ -0,0 +1,186 @@
+#include "pando_passes.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+#define DEBUG_TYPE "globalize-cleanup"
+
+using namespace llvm;
+
+STATISTIC(NumPairsCancelled, "Number of deglobalify(globalify(x)) pairs cancelled");
+STATISTIC(NumGlobalifyCSE, "Number of redundant globalify calls removed");
+STATISTIC(NumDeglobalifyCSE, "Number of redundant deglobalify calls removed");
+STATISTIC(NumCheckCSE, "Number of redundant check_if_global calls removed");
+STATISTIC(NumDeadRemoved, "Number of unused globalify/deglobalify/check_if_global calls removed");
+
+namespace {
+
+// the address-tag functions only depend on their argument (the printf tracing in the test
+// runtime aside), so calls to them can be treated as pure.
+struct TagFunctions {
+    Function *globalify;
+    Function *deglobalify;
+    Function *checkIfGlobal;
+
+    bool contains(const Function *f) const {
+        return f && (f == globalify || f == deglobalify || f == checkIfGlobal);
+    }
+};
+
+// returns true if ptr points into a global of the symmetric heap section, which the runtime's
+// globalify relocates to its copy in the heap
+bool isSymHeapGlobal(const Value *ptr) {
+    auto *gv = dyn_cast<GlobalVariable>(getUnderlyingObject(ptr));
+    return gv && gv->getSection() == SymHeapSection;
+}
+
+// a call to a tag function, identified by callee and argument
+using CallKey = std::pair<Function *, Value *>;
+
+class FunctionCleanup {
+public:
+    FunctionCleanup(const TagFunctions &tagFuncs) : tagFuncs(tagFuncs) {}
+
+    // walks the dominator tree in preorder, keeping the tag calls of all dominating blocks
+    // available. a call is replaced by an available call with the same callee and argument.
+    bool run(DominatorTree &dt) {
+        struct Frame {
+            DomTreeNode *node;
+            DomTreeNode::iterator nextChild;
+            size_t undoMark;
+        };
+
+        SmallVector<Frame, 16> worklist;
+        auto enter = [&](DomTreeNode *node) {
+            worklist.push_back({node, node->begin(), undoLog.size()});
+            processBlock(*node->getBlock());
+        };
+
+        enter(dt.getRootNode());
+        while (!worklist.empty()) {
+            Frame &top = worklist.back();
+            if (top.nextChild != top.node->end()) {
+                DomTreeNode *child = *top.nextChild++;
+                enter(child);
+                continue;
+            }
+
+            // leaving the subtree: forget the calls that only dominate it
+            while (undoLog.size() > top.undoMark) {
+                available.erase(undoLog.pop_back_val());
+            }
+            worklist.pop_back();
+        }
+
+        // the cancelled pairs and CSE can leave tag calls without uses
+        for (CallInst *call : reverse(tagCalls)) {
+            if (call->use_empty()) {
+                call->eraseFromParent();
+                ++NumDeadRemoved;
+                changed = true;
+            }
+        }
+
+        return changed;
+    }
+
+private:
+    void processBlock(BasicBlock &bb) {
+        for (Instruction &instr : make_early_inc_range(bb)) {
+            auto *call = dyn_cast<CallInst>(&instr);
+            if (!call || call->arg_size() != 1) {
+                continue;
+            }
+
+            Function *callee = call->getCalledFunction();
+            if (!tagFuncs.contains(callee)) {
+                continue;
+            }
+
+            Value *arg = call->getArgOperand(0);
+
+            // deglobalify(globalify(x)) is just x, unless globalify moves x to the symmetric heap
+            if (callee == tagFuncs.deglobalify) {
+                auto *inner = dyn_cast<CallInst>(arg);
+                if (inner && inner->getCalledFunction() == tagFuncs.globalify &&
+                    !isSymHeapGlobal(inner->getArgOperand(0))) {
+                    call->replaceAllUsesWith(inner->getArgOperand(0));
+                    call->eraseFromParent();
+                    ++NumPairsCancelled;
+                    changed = true;
+                    continue;
+                }
+            }
+
+            CallKey key{callee, arg};
+            auto it = available.find(key);
+            if (it != available.end()) {
+                // a dominating call already computed this value
+                call->replaceAllUsesWith(it->second);
+                call->eraseFromParent();
+                if (callee == tagFuncs.globalify) {
+                    ++NumGlobalifyCSE;
+                } else if (callee == tagFuncs.deglobalify) {
+                    ++NumDeglobalifyCSE;
+                } else {
+                    ++NumCheckCSE;
+                }
+                changed = true;
+                continue;
+            }
+
+            undoLog.push_back(key);
+            available[key] = call;
+            tagCalls.push_back(call);
+        }
+    }
+
+    const TagFunctions &tagFuncs;
+    DenseMap<CallKey, CallInst *> available;
+    // keys in the order they became available, popped when leaving their subtree
+    SmallVector<CallKey, 32> undoLog;
+    // every tag call that survived, checked for uses at the end
+    SmallVector<CallInst *, 32> tagCalls;
+    bool changed = false;
+};
+
+} // end anonymous namespace
+
+PreservedAnalyses GlobalizeCleanupPass::run(Module &m, ModuleAnalysisManager &mam) {
+    TagFunctions tagFuncs{
+        m.getFunction("globalify"),
+        m.getFunction("deglobalify"),
+        m.getFunction("check_if_global"),
+    };
+    if (!tagFuncs.globalify && !tagFuncs.deglobalify && !tagFuncs.checkIfGlobal) {
+        errs() << "[GLOBALIZE CLEANUP PASS] -- no globalify/deglobalify/check_if_global functions found. exiting early.\n";
+        return PreservedAnalyses::all();
+    }
+
+    FunctionAnalysisManager &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(m).getManager();
+
+    bool changed = false;
+    for (Function &f : m) {
+        if (f.isDeclaration() || isPandoRuntimeFunction(f.getName())) {
+            continue;
+        }
+
+        FunctionCleanup cleanup(tagFuncs);
+        changed |= cleanup.run(fam.getResult<DominatorTreeAnalysis>(f));
+    }
+
+    if (!changed) {
+        return PreservedAnalyses::all();
+    }
+
+    // only calls were removed, the CFG is untouched
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
+}
@@ -0,0 +1,309 @@
+#include "pando_passes.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <algorithm>
+
+#define DEBUG_TYPE "clone-local"
+
+using namespace llvm;
+
+static cl::opt<double> CloneMinFrequency(
+    "pando-clone-min-frequency", cl::init(1.0),
+    cl::desc("Clone functions called at least this often per invocation of their callers, summed "
+             "over call sites (estimated from block frequencies)"));
+
+static cl::opt<uint64_t> CloneMinEntryCount(
+    "pando-clone-min-entry-count", cl::init(1000),
+    cl::desc("Clone functions entered at least this often in the training run, for modules built "
+             "with profile data (entry counts replace the call frequency estimate)"));
+
+static cl::opt<unsigned> CloneMaxGrowth(
+    "pando-clone-max-growth", cl::init(10),
+    cl::desc("Largest growth of the module's instruction count by local clones, in percent"));
+
+static cl::opt<unsigned> CloneMaxSize(
+    "pando-clone-max-size", cl::init(500),
+    cl::desc("Largest function (in instructions) that is cloned"));
+
+STATISTIC(NumFunctionsCloned, "Number of functions given an uninstrumented local clone");
+STATISTIC(NumAccessesLocal, "Number of loads/stores/atomics left native in local clones");
+
+namespace {
+
+// the address tag is the top 16 bits (see AddressMask)
+constexpr uint64_t TagShift = 48;
+// name of the runtime global holding this node's address tag
+constexpr const char *LocalTagGlobal = "__pando__local_tag";
+
+// a function worth cloning, and how hot it is
+struct Candidate {
+    Function *f;
+    // the pointer arguments its accesses go through, tested at entry
+    SmallVector<Argument *, 4> testedArgs;
+    double hotness;
+    unsigned size;
+};
+
+class LocalCloner {
+public:
+    LocalCloner(Module &m, Function *globalifyFunc, GlobalVariable *localTag)
+        : m(m), globalifyFunc(globalifyFunc), localTag(localTag) {}
+
+    // Returns true if every access of f goes through one of its pointer arguments, a stack slot
+    // or a globalified global, and f calls nothing but intrinsics and tag functions. The
+    // arguments the accesses go through are added to args.
+    bool isLocalCandidate(Function &f, SmallVectorImpl<Argument *> &args) const {
+        SmallPtrSet<Argument *, 4> seen;
+        bool hasAccess = false;
+        for (Instruction &instr : instructions(f)) {
+            if (auto *call = dyn_cast<CallBase>(&instr)) {
+                Function *callee = call->getCalledFunction();
+                if (!isa<IntrinsicInst>(call) && !(callee && isPandoTagFunction(callee->getName()))) {
+                    return false;
+                }
+                continue;
+            }
+
+            Value *ptr = accessPointer(instr);
+            if (!ptr) {
+                continue;
+            }
+            hasAccess = true;
+            if (!collectBases(ptr, seen)) {
+                return false;
+            }
+        }
+
+        for (Argument &arg : f.args()) {
+            if (seen.count(&arg)) {
+                args.push_back(&arg);
+            }
+        }
+        return hasAccess && !args.empty();
+    }
+
+    // Estimates how often f is called: its profile entry count if the module has one, else the
+    // summed block frequencies of its call sites relative to their callers' entries.
+    double hotness(Function &f, FunctionAnalysisManager &fam) const {
+        if (auto count = f.getEntryCount()) {
+            return double(count->getCount());
+        }
+
+        double frequency = 0;
+        for (User *user : f.users()) {
+            auto *call = dyn_cast<CallBase>(user);
+            if (!call || call->getCalledFunction() != &f) {
+                continue;
+            }
+            Function *caller = call->getFunction();
+            auto &bfi = fam.getResult<BlockFrequencyAnalysis>(*caller);
+            double entryFrequency = double(BlockFrequency(bfi.getEntryFreq()).getFrequency());
+            frequency += double(bfi.getBlockFreq(call->getParent()).getFrequency()) / entryFrequency;
+        }
+        return frequency;
+    }
+
+    // Clones f into an uninstrumented `<name>.pando.local` and makes f dispatch to it when all of
+    // args carry this node's tag (or none).
+    void clone(Function &f, ArrayRef<Argument *> args) {
+        ValueToValueMapTy vmap;
+        Function *localFunc = CloneFunction(&f, vmap);
+        localFunc->setName(f.getName() + ".pando.local");
+        localFunc->setLinkage(GlobalValue::InternalLinkage);
+        localFunc->setComdat(nullptr);
+        makeNative(*localFunc);
+
+        LLVMContext &ctx = m.getContext();
+        BasicBlock *oldEntry = &f.getEntryBlock();
+        BasicBlock *dispatch = BasicBlock::Create(ctx, "pando.dispatch", &f, oldEntry);
+        BasicBlock *localPath = BasicBlock::Create(ctx, "pando.local", &f, oldEntry);
+
+        // all arguments local: one inline tag test per argument, no runtime calls
+        IRBuilder<> builder(dispatch);
+        Type *i64Type = builder.getInt64Ty();
+        LoadInst *tag = builder.CreateLoad(i64Type, localTag, "local_tag");
+        tag->setMetadata(LocalMetadata, MDNode::get(ctx, {}));
+        Value *allLocal = builder.getTrue();
+        for (Argument *arg : args) {
+            Value *argTag = builder.CreateLShr(builder.CreatePtrToInt(arg, i64Type), TagShift, "arg_tag");
+            Value *isLocal = builder.CreateOr(builder.CreateICmpEQ(argTag, tag),
+                                              builder.CreateICmpEQ(argTag, builder.getInt64(0)), "is_local");
+            allLocal = builder.CreateAnd(allLocal, isLocal, "all_local");
+        }
+        MDBuilder mdBuilder(ctx);
+        builder.CreateCondBr(allLocal, localPath, oldEntry, mdBuilder.createBranchWeights(2000, 1));
+
+        builder.SetInsertPoint(localPath);
+        SmallVector<Value *, 8> callArgs;
+        for (Argument &arg : f.args()) {
+            callArgs.push_back(&arg);
+        }
+        CallInst *call = builder.CreateCall(localFunc, callArgs);
+        call->setTailCall();
+        if (f.getReturnType()->isVoidTy()) {
+            builder.CreateRetVoid();
+        } else {
+            builder.CreateRet(call);
+        }
+
+        ++NumFunctionsCloned;
+    }
+
+private:
+    // returns the address operand of a load, store or atomic
+    static Value *accessPointer(Instruction &instr) {
+        if (auto *load = dyn_cast<LoadInst>(&instr)) {
+            return load->getPointerOperand();
+        }
+        if (auto *store = dyn_cast<StoreInst>(&instr)) {
+            return store->getPointerOperand();
+        }
+        if (auto *rmw = dyn_cast<AtomicRMWInst>(&instr)) {
+            return rmw->getPointerOperand();
+        }
+        if (auto *cmpxchg = dyn_cast<AtomicCmpXchgInst>(&instr)) {
+            return cmpxchg->getPointerOperand();
+        }
+        return nullptr;
+    }
+
+    static unsigned pointerOperandIndex(Instruction &instr) {
+        if (auto *store = dyn_cast<StoreInst>(&instr)) {
+            return store->getPointerOperandIndex();
+        }
+        if (auto *rmw = dyn_cast<AtomicRMWInst>(&instr)) {
+            return rmw->getPointerOperandIndex();
+        }
+        if (auto *cmpxchg = dyn_cast<AtomicCmpXchgInst>(&instr)) {
+            return cmpxchg->getPointerOperandIndex();
+        }
+        return LoadInst::getPointerOperandIndex();
+    }
+
+    // Walks ptr back through GEPs, casts, phis and selects. Returns false if it may come from
+    // anything but an argument (added to args), a stack slot or a global.
+    bool collectBases(Value *ptr, SmallPtrSetImpl<Argument *> &args) const {
+        SmallPtrSet<Value *, 16> visited;
+        SmallVector<Value *, 16> worklist{ptr};
+        while (!worklist.empty()) {
+            Value *value = worklist.pop_back_val();
+            if (!visited.insert(value).second) {
+                continue;
+            }
+
+            if (auto *arg = dyn_cast<Argument>(value)) {
+                args.insert(arg);
+            } else if (isa<AllocaInst>(value) || isa<GlobalVariable>(value)) {
+                continue;
+            } else if (auto *call = dyn_cast<CallInst>(value)) {
+                // globalify(@g): a global of this node
+                if (call->getCalledFunction() != globalifyFunc || !isa<GlobalVariable>(call->getArgOperand(0))) {
+                    return false;
+                }
+            } else if (auto *gep = dyn_cast<GEPOperator>(value)) {
+                worklist.push_back(gep->getPointerOperand());
+            } else if (auto *cast = dyn_cast<BitCastOperator>(value)) {
+                worklist.push_back(cast->getOperand(0));
+            } else if (auto *cast = dyn_cast<AddrSpaceCastInst>(value)) {
+                worklist.push_back(cast->getOperand(0));
+            } else if (auto *phi = dyn_cast<PHINode>(value)) {
+                append_range(worklist, phi->incoming_values());
+            } else if (auto *select = dyn_cast<SelectInst>(value)) {
+                worklist.push_back(select->getTrueValue());
+                worklist.push_back(select->getFalseValue());
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Marks every access of the clone `pando.local` and strips the tag from its address, so the
+    // load-store pass leaves it native.
+    void makeNative(Function &localFunc) {
+        LLVMContext &ctx = m.getContext();
+        MDNode *localNode = MDNode::get(ctx, {});
+        IRBuilder<> builder(ctx);
+
+        for (Instruction &instr : instructions(localFunc)) {
+            Value *ptr = accessPointer(instr);
+            if (!ptr) {
+                continue;
+            }
+            builder.SetInsertPoint(&instr);
+            instr.setOperand(pointerOperandIndex(instr), nativePointer(builder, ptr));
+            instr.setMetadata(LocalMetadata, localNode);
+            ++NumAccessesLocal;
+        }
+    }
+
+    Module &m;
+    Function *globalifyFunc;
+    GlobalVariable *localTag;
+};
+
+} // end anonymous namespace
+
+PreservedAnalyses CloneLocalPass::run(Module &m, ModuleAnalysisManager &mam) {
+    Function *globalifyFunc = m.getFunction("globalify");
+    GlobalVariable *localTag = m.getGlobalVariable(LocalTagGlobal);
+    if (!globalifyFunc || !localTag) {
+        errs() << "[CLONE LOCAL PASS] -- globalify or " << LocalTagGlobal << " not found. exiting early.\n";
+        return PreservedAnalyses::all();
+    }
+
+    FunctionAnalysisManager &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(m).getManager();
+    LocalCloner cloner(m, globalifyFunc, localTag);
+
+    uint64_t moduleSize = 0;
+    SmallVector<Candidate, 16> candidates;
+    for (Function &f : m) {
+        if (f.isDeclaration()) {
+            continue;
+        }
+        moduleSize += f.getInstructionCount();
+        if (isPandoRuntimeFunction(f.getName()) || f.isVarArg() || f.hasFnAttribute(Attribute::Naked)) {
+            continue;
+        }
+
+        Candidate candidate{&f, {}, 0, f.getInstructionCount()};
+        if (candidate.size > CloneMaxSize || !cloner.isLocalCandidate(f, candidate.testedArgs)) {
+            continue;
+        }
+
+        candidate.hotness = cloner.hotness(f, fam);
+        double threshold = f.getEntryCount() ? double(CloneMinEntryCount) : double(CloneMinFrequency);
+        if (candidate.hotness >= threshold) {
+            candidates.push_back(std::move(candidate));
+        }
+    }
+
+    // hottest first, until the code size budget is spent
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Candidate &a, const Candidate &b) { return a.hotness > b.hotness; });
+    uint64_t budget = moduleSize * CloneMaxGrowth / 100;
+    bool changed = false;
+    for (Candidate &candidate : candidates) {
+        if (candidate.size > budget) {
+            continue;
+        }
+        budget -= candidate.size;
+        cloner.clone(*candidate.f, candidate.testedArgs);
+        changed = true;
+    }
+
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
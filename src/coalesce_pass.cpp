@@ -0,0 +1,343 @@
+#include "pando_passes.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+
+#include <limits>
+
+#define DEBUG_TYPE "coalesce"
+
+using namespace llvm;
+
+static cl::opt<unsigned> CoalesceMaxBytes(
+    "pando-coalesce-max-bytes", cl::init(64 * 1024),
+    cl::desc("Largest range of a global (in bytes) that a loop's accesses are coalesced into"));
+
+STATISTIC(NumLoopsCoalesced, "Number of loops whose global accesses were coalesced");
+STATISTIC(NumAccessesCoalesced, "Number of loads/stores redirected to a coalesced buffer");
+
+namespace {
+
+// alignment of the coalesced buffers
+constexpr uint64_t BufferAlign = 16;
+
+// an affine access {base + offset, +, step} over a loop
+struct AffineAccess {
+    Instruction *instr;
+    int64_t offset;
+    int64_t step;
+    uint64_t size;
+    Align align;
+};
+
+// all affine accesses of one loop to one global, the byte range they cover, their largest
+// alignment and the [begin, end) byte ranges the stores write
+struct CoalescedRange {
+    CallInst *base = nullptr;
+    SmallVector<AffineAccess, 8> accesses;
+    int64_t begin = std::numeric_limits<int64_t>::max();
+    int64_t end = std::numeric_limits<int64_t>::min();
+    Align align;
+    SmallVector<std::pair<int64_t, int64_t>, 4> stored;
+};
+
+class LoopCoalescer {
+public:
+    LoopCoalescer(Function &f, ScalarEvolution &se, DominatorTree &dt, Function *globalifyFunc,
+                  Function *bulkGetFunc, Function *bulkPutFunc)
+        : f(f), se(se), dt(dt), dl(f.getParent()->getDataLayout()), globalifyFunc(globalifyFunc),
+          bulkGetFunc(bulkGetFunc), bulkPutFunc(bulkPutFunc) {}
+
+    bool run(Loop &loop) {
+        BasicBlock *preheader = loop.getLoopPreheader();
+        BasicBlock *exitBlock = loop.getUniqueExitBlock();
+        if (!preheader || !exitBlock || !loop.hasDedicatedExits()) {
+            return false;
+        }
+
+        unsigned tripCount = se.getSmallConstantTripCount(&loop);
+        if (tripCount == 0) {
+            return false;
+        }
+
+        SmallVector<Instruction *, 16> memAccesses;
+        if (!collectAccesses(loop, memAccesses)) {
+            return false;
+        }
+
+        MapVector<GlobalVariable *, CoalescedRange> ranges;
+        SmallVector<Value *, 8> otherObjects;
+        for (Instruction *instr : memAccesses) {
+            if (!addAffineAccess(loop, tripCount, instr, ranges)) {
+                otherObjects.push_back(getUnderlyingObject(getLoadStorePointerOperand(instr)));
+            }
+        }
+        if (ranges.empty()) {
+            return false;
+        }
+
+        // accesses that stay instrumented must not touch the coalesced globals
+        for (Value *object : otherObjects) {
+            GlobalVariable *gv = globalifiedGlobal(object);
+            if (!isa<AllocaInst>(object) && (!gv || ranges.count(gv))) {
+                return false;
+            }
+        }
+
+        bool coalesced = false;
+        for (auto &[gv, range] : ranges) {
+            uint64_t globalSize = dl.getTypeAllocSize(gv->getValueType());
+            if (range.begin < 0) {
+                continue;
+            }
+            // the buffer starts at an offset aligned like the accesses, so they stay aligned in it
+            range.begin = alignDown(range.begin, std::min(range.align.value(), BufferAlign));
+            if (static_cast<uint64_t>(range.end) > globalSize ||
+                static_cast<uint64_t>(range.end - range.begin) > CoalesceMaxBytes) {
+                continue;
+            }
+
+            coalesce(loop, preheader, exitBlock, range);
+            coalesced = true;
+        }
+
+        if (coalesced) {
+            ++NumLoopsCoalesced;
+        }
+        return coalesced;
+    }
+
+private:
+    // returns the global behind a globalify(@g) call
+    GlobalVariable *globalifiedGlobal(Value *value) const {
+        auto *call = dyn_cast<CallInst>(value);
+        if (!call || call->getCalledFunction() != globalifyFunc) {
+            return nullptr;
+        }
+        return dyn_cast<GlobalVariable>(call->getArgOperand(0)->stripPointerCasts());
+    }
+
+    // gathers the loop's loads/stores. fails on anything else that could touch memory, since
+    // the buffered copy of a global would go stale behind its back.
+    bool collectAccesses(Loop &loop, SmallVectorImpl<Instruction *> &memAccesses) const {
+        for (BasicBlock *bb : loop.blocks()) {
+            for (Instruction &instr : *bb) {
+                if (auto *call = dyn_cast<CallInst>(&instr)) {
+                    Function *callee = call->getCalledFunction();
+                    if (callee && isPandoTagFunction(callee->getName())) {
+                        continue;
+                    }
+                    if (auto *intrinsic = dyn_cast<IntrinsicInst>(call)) {
+                        if (intrinsic->isAssumeLikeIntrinsic()) {
+                            continue;
+                        }
+                    }
+                    return false;
+                }
+
+                if (isa<LoadInst>(instr) || isa<StoreInst>(instr)) {
+                    bool isSimple = isa<LoadInst>(instr) ? cast<LoadInst>(instr).isSimple()
+                                                         : cast<StoreInst>(instr).isSimple();
+                    if (!isSimple) {
+                        return false;
+                    }
+                    memAccesses.push_back(&instr);
+                } else if (instr.mayReadOrWriteMemory()) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // returns true if instr runs in every iteration of the loop
+    bool runsEveryIteration(Loop &loop, Instruction *instr) const {
+        SmallVector<BasicBlock *, 4> exitingBlocks;
+        loop.getExitingBlocks(exitingBlocks);
+        return all_of(exitingBlocks,
+                      [&](BasicBlock *exiting) { return dt.dominates(instr->getParent(), exiting); });
+    }
+
+    // records instr if its address is globalify(@g) + {offset, +, step} over the loop. The
+    // globalify call may sit in the loop, since its argument is invariant. A store is only
+    // recorded if it writes every byte from its first address to its last, in every iteration, as
+    // the buffer is written back over those bytes.
+    bool addAffineAccess(Loop &loop, unsigned tripCount, Instruction *instr,
+                         MapVector<GlobalVariable *, CoalescedRange> &ranges) const {
+        const SCEV *ptr = se.getSCEV(getLoadStorePointerOperand(instr));
+        auto *baseUnknown = dyn_cast<SCEVUnknown>(se.getPointerBase(ptr));
+        if (!baseUnknown) {
+            return false;
+        }
+        auto *base = dyn_cast<CallInst>(baseUnknown->getValue());
+        GlobalVariable *gv = base ? globalifiedGlobal(base) : nullptr;
+        if (!gv || !loop.isLoopInvariant(base->getArgOperand(0))) {
+            return false;
+        }
+
+        auto *addRec = dyn_cast<SCEVAddRecExpr>(se.getMinusSCEV(ptr, baseUnknown));
+        if (!addRec || addRec->getLoop() != &loop || !addRec->isAffine()) {
+            return false;
+        }
+        auto *step = dyn_cast<SCEVConstant>(addRec->getStepRecurrence(se));
+        auto *offset = dyn_cast<SCEVConstant>(addRec->getStart());
+        if (!step || !offset || step->getAPInt().isNonPositive()) {
+            return false;
+        }
+
+        Type *accessType = isa<LoadInst>(instr) ? instr->getType()
+                                                : cast<StoreInst>(instr)->getValueOperand()->getType();
+        AffineAccess access{instr, offset->getAPInt().getSExtValue(), step->getAPInt().getSExtValue(),
+                            dl.getTypeStoreSize(accessType).getFixedValue(), getLoadStoreAlignment(instr)};
+
+        int64_t accessEnd = access.offset + access.step * static_cast<int64_t>(tripCount - 1) +
+                            static_cast<int64_t>(access.size);
+        if (isa<StoreInst>(instr) &&
+            (access.step > static_cast<int64_t>(access.size) || !runsEveryIteration(loop, instr))) {
+            return false;
+        }
+
+        CoalescedRange &range = ranges[gv];
+        if (!range.base) {
+            range.base = base;
+        }
+        range.accesses.push_back(access);
+        range.begin = std::min(range.begin, access.offset);
+        range.end = std::max(range.end, accessEnd);
+        range.align = std::max(range.align, access.align);
+        if (isa<StoreInst>(instr)) {
+            range.stored.emplace_back(access.offset, accessEnd);
+        }
+        return true;
+    }
+
+    // fetches the range into a local buffer before the loop, redirects the accesses to the
+    // buffer and writes the stored bytes back after the loop.
+    void coalesce(Loop &loop, BasicBlock *preheader, BasicBlock *exitBlock, CoalescedRange &range) {
+        LLVMContext &ctx = f.getContext();
+        Type *i8Type = Type::getInt8Ty(ctx);
+        Type *i64Type = Type::getInt64Ty(ctx);
+        uint64_t numBytes = range.end - range.begin;
+        MDNode *localNode = MDNode::get(ctx, {});
+        unsigned localKind = ctx.getMDKindID(LocalMetadata);
+
+        IRBuilder<> builder(&*f.getEntryBlock().getFirstInsertionPt());
+        AllocaInst *buffer = builder.CreateAlloca(ArrayType::get(i8Type, numBytes), nullptr, "coalesced_buffer");
+        buffer->setAlignment(Align(BufferAlign));
+        buffer->setMetadata(localKind, localNode);
+
+        // the fetch needs the base before the loop
+        if (loop.contains(range.base)) {
+            range.base->moveBefore(preheader->getTerminator());
+            se.forgetLoop(&loop);
+        }
+
+        builder.SetInsertPoint(preheader->getTerminator());
+        Value *globalBegin = builder.CreateConstInBoundsGEP1_64(i8Type, range.base, range.begin, "coalesced_src");
+        builder.CreateCall(bulkGetFunc, {buffer, globalBegin, builder.getInt64(numBytes)});
+
+        SCEVExpander expander(se, dl, "coalesced");
+        for (AffineAccess &access : range.accesses) {
+            const SCEV *bufferOffset = se.getAddRecExpr(se.getConstant(i64Type, access.offset - range.begin),
+                                                        se.getConstant(i64Type, access.step), &loop,
+                                                        SCEV::FlagAnyWrap);
+            Value *offset = expander.expandCodeFor(bufferOffset, i64Type, access.instr);
+
+            builder.SetInsertPoint(access.instr);
+            Value *bufferPtr = builder.CreateInBoundsGEP(i8Type, buffer, offset, "coalesced_ptr");
+            unsigned ptrIndex = isa<LoadInst>(access.instr) ? LoadInst::getPointerOperandIndex()
+                                                            : StoreInst::getPointerOperandIndex();
+            access.instr->setOperand(ptrIndex, bufferPtr);
+            access.instr->setMetadata(localKind, localNode);
+
+            // keep no more alignment than the buffer offsets of every iteration have
+            Align bufferAlign = commonAlignment(
+                commonAlignment(Align(BufferAlign), access.offset - range.begin), access.step);
+            Align align = std::min(access.align, bufferAlign);
+            if (auto *load = dyn_cast<LoadInst>(access.instr)) {
+                load->setAlignment(align);
+            } else {
+                cast<StoreInst>(access.instr)->setAlignment(align);
+            }
+            ++NumAccessesCoalesced;
+        }
+
+        // one put per run of stored bytes: the bytes that were only read, or lie between the runs,
+        // may have been written by other nodes meanwhile
+        llvm::sort(range.stored);
+        SmallVector<std::pair<int64_t, int64_t>, 4> runs;
+        for (auto [begin, end] : range.stored) {
+            if (!runs.empty() && begin <= runs.back().second) {
+                runs.back().second = std::max(runs.back().second, end);
+            } else {
+                runs.emplace_back(begin, end);
+            }
+        }
+        builder.SetInsertPoint(&*exitBlock->getFirstInsertionPt());
+        for (auto [begin, end] : runs) {
+            Value *globalDst = builder.CreateConstInBoundsGEP1_64(i8Type, range.base, begin, "coalesced_dst");
+            Value *bufferSrc = builder.CreateConstInBoundsGEP1_64(i8Type, buffer, begin - range.begin, "coalesced_src");
+            builder.CreateCall(bulkPutFunc, {globalDst, bufferSrc, builder.getInt64(end - begin)});
+        }
+    }
+
+    Function &f;
+    ScalarEvolution &se;
+    DominatorTree &dt;
+    const DataLayout &dl;
+    Function *globalifyFunc;
+    Function *bulkGetFunc;
+    Function *bulkPutFunc;
+};
+
+} // end anonymous namespace
+
+PreservedAnalyses CoalescePass::run(Module &m, ModuleAnalysisManager &mam) {
+    Function *globalifyFunc = m.getFunction("globalify");
+    Function *bulkGetFunc = m.getFunction("__pando__bulk_get");
+    Function *bulkPutFunc = m.getFunction("__pando__bulk_put");
+    if (!globalifyFunc || !bulkGetFunc || !bulkPutFunc) {
+        errs() << "[COALESCE PASS] -- globalify or bulk get/put functions not found. exiting early.\n";
+        return PreservedAnalyses::all();
+    }
+
+    FunctionAnalysisManager &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(m).getManager();
+
+    bool changed = false;
+    for (Function &f : m) {
+        if (f.isDeclaration() || isPandoRuntimeFunction(f.getName())) {
+            continue;
+        }
+
+        LoopInfo &li = fam.getResult<LoopAnalysis>(f);
+        ScalarEvolution &se = fam.getResult<ScalarEvolutionAnalysis>(f);
+        DominatorTree &dt = fam.getResult<DominatorTreeAnalysis>(f);
+        LoopCoalescer coalescer(f, se, dt, globalifyFunc, bulkGetFunc, bulkPutFunc);
+
+        bool functionChanged = false;
+        for (Loop *loop : li.getLoopsInPreorder()) {
+            if (loop->isInnermost()) {
+                functionChanged |= coalescer.run(*loop);
+            }
+        }
+
+        if (functionChanged) {
+            fam.invalidate(f, PreservedAnalyses::none());
+            changed = true;
+        }
+    }
+
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
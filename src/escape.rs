@@ -0,0 +1,87 @@
+use std::collections::HashSet;
+
+use llvm_plugin::inkwell::context::ContextRef;
+use llvm_plugin::inkwell::values::{FunctionValue, InstructionOpcode, InstructionValue};
+
+use crate::utils::{called_function_name, operand_instruction, user_instruction, LOCAL_METADATA};
+
+// Walks every use of `alloca` and of the pointers derived from it.
+// Returns the loads/stores that access the slot, or None if the address can leave the
+// function: passed to a call, stored to memory, returned, merged with other pointers, or
+// converted to an integer.
+fn private_accesses<'ctx>(alloca: InstructionValue<'ctx>) -> Option<Vec<InstructionValue<'ctx>>> {
+  let mut accesses = Vec::new();
+  let mut visited = HashSet::new();
+  let mut worklist = vec![alloca];
+
+  while let Some(ptr) = worklist.pop() {
+    if !visited.insert(ptr) {
+      continue;
+    }
+
+    let mut next_use = ptr.get_first_use();
+    while let Some(ptr_use) = next_use {
+      next_use = ptr_use.get_next_use();
+
+      let user = user_instruction(ptr_use.get_user())?;
+      match user.get_opcode() {
+        InstructionOpcode::Load => accesses.push(user),
+        InstructionOpcode::Store => {
+          // storing *to* the slot is fine. storing the address itself lets it escape.
+          if operand_instruction(user, 0) == Some(ptr) {
+            return None;
+          }
+          accesses.push(user);
+        },
+        InstructionOpcode::GetElementPtr => {
+          // a derived pointer, unless the slot is only used as an index
+          if operand_instruction(user, 0) != Some(ptr) {
+            return None;
+          }
+          worklist.push(user);
+        },
+        InstructionOpcode::BitCast => worklist.push(user),
+        // comparing addresses does not publish them
+        InstructionOpcode::ICmp => {},
+        InstructionOpcode::Call => {
+          match called_function_name(user) {
+            Some(name) if name.starts_with("llvm.lifetime.") => {},
+            // the slot's address with the tag masked off (see `provenance-pass`)
+            Some(name) if name.starts_with("llvm.ptrmask.") => worklist.push(user),
+            _ => return None,
+          }
+        },
+        _ => return None,
+      }
+    }
+  }
+
+  Some(accesses)
+}
+
+// Marks every alloca of `f` whose address cannot leave the function, and the loads/stores that
+// access it, with `pando.local` metadata. The load-store pass leaves those native.
+// Returns the number of allocas kept private.
+pub fn mark_private_allocas(cx: &ContextRef, f: FunctionValue) -> usize {
+  let local_kind = cx.get_kind_id(LOCAL_METADATA);
+  let local_node = cx.metadata_node(&[]);
+  let mut num_private = 0;
+
+  for b in f.get_basic_block_iter() {
+    for instr in b.get_instructions() {
+      if instr.get_opcode() != InstructionOpcode::Alloca {
+        continue;
+      }
+
+      if let Some(accesses) = private_accesses(instr) {
+        instr.set_metadata(local_node, local_kind).unwrap();
+        for access in accesses {
+          access.set_metadata(local_node, local_kind).unwrap();
+        }
+        num_private += 1;
+      }
+    }
+  }
+
+  num_private
+}
@@ -0,0 +1,53 @@
+use llvm_plugin::inkwell::builder::Builder;
+use llvm_plugin::inkwell::module::Module;
+use llvm_plugin::inkwell::values::{FunctionValue, InstructionOpcode, InstructionValue};
+
+use crate::utils::{called_function_name, is_runtime_function};
+
+// runtime entry point that sends the calling thread's buffered remote stores
+pub const FENCE_FUNC: &str = "__pando__fence";
+
+// returns true if buffered remote stores must be visible before `instr`: it orders memory
+// (fences, atomics), may hand control to code outside the module (calls to declarations or
+// through function pointers), or returns to the caller
+fn is_release_point(module: &Module, instr: InstructionValue) -> bool {
+  match instr.get_opcode() {
+    InstructionOpcode::Fence
+    | InstructionOpcode::AtomicRMW
+    | InstructionOpcode::AtomicCmpXchg
+    | InstructionOpcode::Return => true,
+    InstructionOpcode::Call | InstructionOpcode::Invoke => match called_function_name(instr) {
+      // indirect call
+      None => true,
+      // atomics are lowered to runtime calls before the fences are placed
+      Some(name) if name.starts_with("__pando__atomic_") => true,
+      Some(name) if name.starts_with("llvm.") || is_runtime_function(&name) => false,
+      Some(name) => module
+        .get_function(&name)
+        .map_or(true, |callee| callee.as_global_value().is_declaration()),
+    },
+    _ => false,
+  }
+}
+
+// Inserts a call to `fence_func` before every release point of `f`.
+// Returns the number of fences inserted.
+pub fn insert_release_fences<'ctx>(
+  module: &Module<'ctx>,
+  builder: &Builder<'ctx>,
+  f: FunctionValue<'ctx>,
+  fence_func: FunctionValue<'ctx>,
+) -> usize {
+  let release_points: Vec<InstructionValue> = f
+    .get_basic_block_iter()
+    .flat_map(|b| b.get_instructions())
+    .filter(|instr| is_release_point(module, *instr))
+    .collect();
+
+  for instr in &release_points {
+    builder.position_before(instr);
+    builder.build_direct_call(fence_func, &[], "").unwrap();
+  }
+
+  release_points.len()
+}
@@ -0,0 +1,368 @@
+use llvm_plugin::inkwell::attributes::{Attribute, AttributeLoc};
+use llvm_plugin::inkwell::builder::Builder;
+use llvm_plugin::inkwell::context::ContextRef;
+use llvm_plugin::inkwell::module::{Linkage, Module};
+use llvm_plugin::inkwell::types::{BasicMetadataTypeEnum, BasicTypeEnum, VectorType};
+use llvm_plugin::inkwell::values::{
+  BasicMetadataValueEnum, BasicValue, BasicValueEnum, FunctionValue, InstructionOpcode, InstructionValue, IntValue,
+  PointerValue, VectorValue,
+};
+use llvm_plugin::inkwell::{AddressSpace, IntPredicate};
+
+use crate::utils::{called_function_name, scratch_slot, LOCAL_METADATA};
+use crate::{ADDRESS_MASK, LOCAL_BRANCH_WEIGHT, LOCAL_TAG_GLOBAL, REMOTE_BRANCH_WEIGHT, TAG_SHIFT};
+
+// runtime entry points of masked gathers and scatters:
+//   void __pando__gather(void* dst, void** ptrs, uint8_t* mask, uint64_t element_size, uint64_t num_elements)
+//   void __pando__scatter(void* src, void** ptrs, uint8_t* mask, uint64_t element_size, uint64_t num_elements)
+pub const GATHER_FUNC: &str = "__pando__gather";
+pub const SCATTER_FUNC: &str = "__pando__scatter";
+
+// what a masked vector access does
+#[derive(Clone, Copy, PartialEq)]
+enum Access {
+  Gather,
+  Scatter,
+}
+
+fn access(instr: InstructionValue) -> Option<Access> {
+  if instr.get_opcode() != InstructionOpcode::Call {
+    return None;
+  }
+  let name = called_function_name(instr)?;
+  if name.starts_with("llvm.masked.gather.") {
+    Some(Access::Gather)
+  } else if name.starts_with("llvm.masked.scatter.") {
+    Some(Access::Scatter)
+  } else {
+    None
+  }
+}
+
+// returns true if `instr` is a masked gather or scatter that `lower` replaces
+pub fn is_gather_or_scatter(instr: InstructionValue) -> bool {
+  access(instr).is_some()
+}
+
+fn runtime_func<'ctx>(module: &Module<'ctx>, name: &str) -> FunctionValue<'ctx> {
+  module.get_function(name).unwrap_or_else(|| {
+    println!("[LOAD-STORE PASS] masked gathers and scatters need the runtime to define {}", name);
+    panic!("missing gather/scatter function")
+  })
+}
+
+fn operand<'ctx>(instr: InstructionValue<'ctx>, index: u32) -> BasicValueEnum<'ctx> {
+  instr.get_operand(index).unwrap().left().unwrap()
+}
+
+// stores `value` to the scratch slot `slot`, natively. the slot may be an array of the value's size,
+// whose alignment is only that of its elements.
+fn spill<'ctx>(module: &Module<'ctx>, builder: &Builder<'ctx>, slot: PointerValue<'ctx>, value: BasicValueEnum<'ctx>) {
+  let cx = module.get_context();
+  let store = builder.build_store(slot, value).unwrap();
+  store.set_alignment(1).unwrap();
+  store.set_metadata(cx.metadata_node(&[]), cx.get_kind_id(LOCAL_METADATA)).unwrap();
+}
+
+// entry-block slots of a function that a gather or scatter passes its lanes, their addresses and
+// the mask through. array slots for the addresses and the mask, so they never share a slot with a
+// vector of lanes.
+struct RuntimeSlots<'ctx> {
+  value: PointerValue<'ctx>,
+  ptrs: PointerValue<'ctx>,
+  mask: PointerValue<'ctx>,
+}
+
+fn runtime_slots<'ctx>(
+  cx: &ContextRef<'ctx>,
+  builder: &Builder<'ctx>,
+  f: FunctionValue<'ctx>,
+  slots: &mut Vec<(BasicTypeEnum<'ctx>, PointerValue<'ctx>)>,
+  vec_type: VectorType<'ctx>,
+) -> RuntimeSlots<'ctx> {
+  let num_elements = vec_type.get_size();
+  RuntimeSlots {
+    value: scratch_slot(cx, builder, f, slots, vec_type.into()),
+    ptrs: scratch_slot(cx, builder, f, slots, cx.ptr_type(AddressSpace::default()).array_type(num_elements).into()),
+    mask: scratch_slot(cx, builder, f, slots, cx.i8_type().array_type(num_elements).into()),
+  }
+}
+
+// Calls `__pando__gather` / `__pando__scatter` for the lanes of `mask` at the builder's position and
+// returns the gathered lanes, in which the masked-off lanes are those of `value`
+fn call_runtime<'ctx>(
+  module: &Module<'ctx>,
+  builder: &Builder<'ctx>,
+  slots: &RuntimeSlots<'ctx>,
+  access: Access,
+  value: VectorValue<'ctx>,
+  ptrs: BasicValueEnum<'ctx>,
+  mask: VectorValue<'ctx>,
+) -> Option<VectorValue<'ctx>> {
+  let cx = module.get_context();
+  let vec_type = value.get_type();
+  let num_elements = vec_type.get_size();
+
+  spill(module, builder, slots.value, value.into());
+  spill(module, builder, slots.ptrs, ptrs);
+  let mask_bytes = builder.build_int_z_extend(mask, cx.i8_type().vec_type(num_elements), "lane_mask").unwrap();
+  spill(module, builder, slots.mask, mask_bytes.into());
+
+  let args = [
+    slots.value.into(),
+    slots.ptrs.into(),
+    slots.mask.into(),
+    vec_type.get_element_type().size_of().unwrap().into(),
+    cx.i64_type().const_int(num_elements as u64, false).into(),
+  ];
+
+  match access {
+    Access::Gather => {
+      builder.build_direct_call(runtime_func(module, GATHER_FUNC), &args, "").unwrap();
+      let gathered = builder.build_load(vec_type, slots.value, "gathered").unwrap().into_vector_value();
+      gathered
+        .as_instruction()
+        .unwrap()
+        .set_metadata(cx.metadata_node(&[]), cx.get_kind_id(LOCAL_METADATA))
+        .unwrap();
+      Some(gathered)
+    },
+    Access::Scatter => {
+      builder.build_direct_call(runtime_func(module, SCATTER_FUNC), &args, "").unwrap();
+      None
+    },
+  }
+}
+
+// globalifies the lanes of gathered pointers, like the loads of a single pointer. other lanes are
+// returned as they are.
+fn globalify_lanes<'ctx>(
+  module: &Module<'ctx>,
+  builder: &Builder<'ctx>,
+  globalify_func: FunctionValue<'ctx>,
+  mut gathered: VectorValue<'ctx>,
+) -> VectorValue<'ctx> {
+  let cx = module.get_context();
+  let vec_type = gathered.get_type();
+  if !matches!(vec_type.get_element_type(), BasicTypeEnum::PointerType(_)) {
+    return gathered;
+  }
+  for lane in 0..vec_type.get_size() {
+    let index = cx.i32_type().const_int(lane as u64, false);
+    let lane_ptr = builder.build_extract_element(gathered, index, "gathered_lane").unwrap();
+    let globalized = builder
+      .build_direct_call(globalify_func, &[lane_ptr.into()], "globalized_lane")
+      .unwrap()
+      .try_as_basic_value()
+      .left()
+      .unwrap();
+    gathered = builder.build_insert_element(gathered, globalized, index, "globalized_lanes").unwrap();
+  }
+  gathered
+}
+
+// returns `value` in every lane of a vector of `num_elements` lanes
+fn splat<'ctx>(
+  cx: &ContextRef<'ctx>,
+  builder: &Builder<'ctx>,
+  value: IntValue<'ctx>,
+  num_elements: u32,
+) -> VectorValue<'ctx> {
+  let undef = value.get_type().vec_type(num_elements).get_undef();
+  let first = builder.build_insert_element(undef, value, cx.i32_type().const_zero(), "").unwrap();
+  builder
+    .build_shuffle_vector(first, undef, cx.i32_type().vec_type(num_elements).const_zero(), "splat")
+    .unwrap()
+}
+
+// Returns the always-inline fast-path variant of the masked gather or scatter `intrinsic`, building
+// it on first use. It takes the intrinsic's operands but the alignment: (ptrs, mask, passthru) for a
+// gather, (value, ptrs, mask) for a scatter. The lanes are split by the inline tag test of the
+// scalar fast path: the local lanes are accessed with `intrinsic` itself, over their native
+// addresses, and the runtime is only called for the remote lanes, on a branch weighted as cold.
+fn fast_path_func<'ctx>(
+  module: &Module<'ctx>,
+  access: Access,
+  instr: InstructionValue<'ctx>,
+  globalify_func: FunctionValue<'ctx>,
+) -> FunctionValue<'ctx> {
+  let intrinsic_name = called_function_name(instr).unwrap();
+  let intrinsic = module.get_function(&intrinsic_name).unwrap();
+  let align_index = match access {
+    Access::Gather => 1,
+    Access::Scatter => 2,
+  };
+  let align = operand(instr, align_index).into_int_value();
+  let name = format!(
+    "{}.align{}",
+    intrinsic_name.replacen("llvm.masked.", "__pando__fast_", 1),
+    align.get_zero_extended_constant().unwrap()
+  );
+  if let Some(fast_func) = module.get_function(&name) {
+    return fast_func;
+  }
+
+  let cx = module.get_context();
+  let builder = cx.create_builder();
+  let i64_type = cx.i64_type();
+
+  // the intrinsic's operands without the alignment
+  let params: Vec<BasicValueEnum> =
+    (0..4).filter(|index| *index != align_index).map(|index| operand(instr, index)).collect();
+  let param_types: Vec<BasicMetadataTypeEnum> = params.iter().map(|param| param.get_type().into()).collect();
+  let fn_type = match access {
+    Access::Gather => instr.get_type().into_vector_type().fn_type(&param_types, false),
+    Access::Scatter => cx.void_type().fn_type(&param_types, false),
+  };
+  let fast_func = module.add_function(&name, fn_type, Some(Linkage::Internal));
+  let always_inline = cx.create_enum_attribute(Attribute::get_named_enum_kind_id("alwaysinline"), 0);
+  fast_func.add_attribute(AttributeLoc::Function, always_inline);
+
+  let entry_block = cx.append_basic_block(fast_func, "entry");
+  let remote_block = cx.append_basic_block(fast_func, "remote");
+  let done_block = cx.append_basic_block(fast_func, "done");
+
+  let fast_params = fast_func.get_params();
+  let (value, ptrs, mask) = match access {
+    Access::Gather => (fast_params[2], fast_params[0], fast_params[1]),
+    Access::Scatter => (fast_params[0], fast_params[1], fast_params[2]),
+  };
+  let value = value.into_vector_value();
+  let ptrs = ptrs.into_vector_value();
+  let mask = mask.into_vector_value();
+  let num_elements = value.get_type().get_size();
+
+  let mut slots = Vec::new();
+  let runtime_slots = runtime_slots(&cx, &builder, fast_func, &mut slots, value.get_type());
+
+  // the tag test of every lane. a lane is local when it carries this node's tag or no tag at all.
+  builder.position_at_end(entry_block);
+  let local_tag_global = module.get_global(LOCAL_TAG_GLOBAL).unwrap_or_else(|| {
+    println!("[LOAD-STORE PASS] the fast path needs the runtime to define {}", LOCAL_TAG_GLOBAL);
+    panic!("missing local tag global")
+  });
+  let addr_type = i64_type.vec_type(num_elements);
+  let addrs = builder.build_ptr_to_int(ptrs, addr_type, "addrs").unwrap();
+  let tags = builder
+    .build_right_shift(addrs, splat(&cx, &builder, i64_type.const_int(TAG_SHIFT, false), num_elements), false, "tags")
+    .unwrap();
+  let local_tag = builder
+    .build_load(i64_type, local_tag_global.as_pointer_value(), "local_tag")
+    .unwrap()
+    .into_int_value();
+  let is_local_tag = builder
+    .build_int_compare(IntPredicate::EQ, tags, splat(&cx, &builder, local_tag, num_elements), "is_local_tag")
+    .unwrap();
+  let is_untagged = builder.build_int_compare(IntPredicate::EQ, tags, addr_type.const_zero(), "is_untagged").unwrap();
+  let is_local = builder.build_or(is_local_tag, is_untagged, "is_local").unwrap();
+  let local_mask = builder.build_and(mask, is_local, "local_mask").unwrap();
+  let is_remote = builder.build_not(is_local, "is_remote").unwrap();
+  let remote_mask = builder.build_and(mask, is_remote, "remote_mask").unwrap();
+
+  let native_addrs = builder
+    .build_and(addrs, splat(&cx, &builder, i64_type.const_int(ADDRESS_MASK, false), num_elements), "native_addrs")
+    .unwrap();
+  let native_ptrs = builder.build_int_to_ptr(native_addrs, ptrs.get_type(), "native_ptrs").unwrap();
+
+  // local lanes: the native gather or scatter
+  let local_args: Vec<BasicMetadataValueEnum> = match access {
+    Access::Gather => vec![native_ptrs.into(), align.into(), local_mask.into(), value.into()],
+    Access::Scatter => vec![value.into(), native_ptrs.into(), align.into(), local_mask.into()],
+  };
+  let local_call = builder.build_direct_call(intrinsic, &local_args, "local_lanes").unwrap();
+  local_call
+    .try_as_basic_value()
+    .either(|local| local.as_instruction_value(), Some)
+    .unwrap()
+    .set_metadata(cx.metadata_node(&[]), cx.get_kind_id(LOCAL_METADATA))
+    .unwrap();
+  let local_lanes = local_call.try_as_basic_value().left().map(|local| local.into_vector_value());
+
+  let remote_bits = builder
+    .build_bit_cast(remote_mask, cx.custom_width_int_type(num_elements), "remote_bits")
+    .unwrap()
+    .into_int_value();
+  let any_remote = builder
+    .build_int_compare(IntPredicate::NE, remote_bits, remote_bits.get_type().const_zero(), "any_remote")
+    .unwrap();
+  let branch = builder.build_conditional_branch(any_remote, remote_block, done_block).unwrap();
+  let branch_weights = cx.metadata_node(&[
+    cx.metadata_string("branch_weights").into(),
+    cx.i32_type().const_int(REMOTE_BRANCH_WEIGHT, false).into(),
+    cx.i32_type().const_int(LOCAL_BRANCH_WEIGHT, false).into(),
+  ]);
+  branch.set_metadata(branch_weights, cx.get_kind_id("prof")).unwrap();
+
+  // remote lanes: the runtime, which keeps the local lanes already gathered
+  builder.position_at_end(remote_block);
+  let runtime_value = local_lanes.unwrap_or(value);
+  let remote_lanes = call_runtime(module, &builder, &runtime_slots, access, runtime_value, ptrs.into(), remote_mask);
+  builder.build_unconditional_branch(done_block).unwrap();
+
+  builder.position_at_end(done_block);
+  match (local_lanes, remote_lanes) {
+    (Some(local_lanes), Some(remote_lanes)) => {
+      let gathered = builder.build_phi(local_lanes.get_type(), "gathered").unwrap();
+      gathered.add_incoming(&[(&local_lanes, entry_block), (&remote_lanes, remote_block)]);
+      let gathered = globalify_lanes(module, &builder, globalify_func, gathered.as_basic_value().into_vector_value());
+      builder.build_return(Some(&gathered)).unwrap();
+    },
+    _ => {
+      builder.build_return(None).unwrap();
+    },
+  }
+
+  fast_func
+}
+
+// Replaces `llvm.masked.gather(ptrs, align, mask, passthru)` and `llvm.masked.scatter(value, ptrs,
+// align, mask)` with `__pando__gather` / `__pando__scatter`. The lanes, their addresses and the mask
+// (one byte per lane) are spilled to entry-block slots of `f` and the runtime reads and writes them
+// there: it accesses the local lanes natively and sends the remote ones to their owners, one request
+// per owner. Gathered pointers are globalified lane by lane, like the loads of a single pointer.
+// With `fast_path`, the access calls the variant of `fast_path_func` instead, which keeps the local
+// lanes a native vector access.
+pub fn lower<'ctx>(
+  module: &Module<'ctx>,
+  builder: &Builder<'ctx>,
+  f: FunctionValue<'ctx>,
+  slots: &mut Vec<(BasicTypeEnum<'ctx>, PointerValue<'ctx>)>,
+  globalify_func: FunctionValue<'ctx>,
+  fast_path: bool,
+  instr: InstructionValue<'ctx>,
+) {
+  let cx = module.get_context();
+  let access = access(instr).unwrap();
+
+  if fast_path {
+    let fast_func = fast_path_func(module, access, instr, globalify_func);
+    let align_index = if access == Access::Gather { 1 } else { 2 };
+    let args: Vec<BasicMetadataValueEnum> =
+      (0..4).filter(|index| *index != align_index).map(|index| operand(instr, index).into()).collect();
+    builder.position_before(&instr);
+    let call = builder.build_direct_call(fast_func, &args, "").unwrap();
+    if let Some(gathered) = call.try_as_basic_value().left() {
+      instr.replace_all_uses_with(&gathered.as_instruction_value().unwrap());
+    }
+    instr.erase_from_basic_block();
+    return;
+  }
+
+  let (value_index, ptrs_index, mask_index) = match access {
+    Access::Gather => (3, 0, 2),
+    Access::Scatter => (0, 1, 3),
+  };
+
+  let value = operand(instr, value_index).into_vector_value();
+  let ptrs = operand(instr, ptrs_index);
+  let mask = operand(instr, mask_index).into_vector_value();
+
+  let runtime_slots = runtime_slots(&cx, builder, f, slots, value.get_type());
+  builder.position_before(&instr);
+  // a gather leaves the masked-off lanes as the passthru
+  if let Some(gathered) = call_runtime(module, builder, &runtime_slots, access, value, ptrs, mask) {
+    let gathered = globalify_lanes(module, builder, globalify_func, gathered);
+    instr.replace_all_uses_with(&gathered.as_instruction().unwrap());
+  }
+  instr.erase_from_basic_block();
+}
@@ -1,79 +1,448 @@
-use llvm_plugin::inkwell::module::Module;
-use llvm_plugin::inkwell::types::{AnyTypeEnum, BasicType};
-use llvm_plugin::inkwell::values::{BasicMetadataValueEnum, BasicValueEnum, CallSiteValue, InstructionOpcode, InstructionValue, PointerValue};
-use llvm_plugin::inkwell::AddressSpace;
+use llvm_plugin::inkwell::attributes::{Attribute, AttributeLoc};
+use llvm_plugin::inkwell::builder::Builder;
+use llvm_plugin::inkwell::context::ContextRef;
+use llvm_plugin::inkwell::module::{Linkage, Module};
+use llvm_plugin::inkwell::types::{AnyTypeEnum, BasicType, BasicTypeEnum};
+use llvm_plugin::inkwell::values::{AsValueRef, BasicMetadataValueEnum, BasicValue, BasicValueEnum, CallSiteValue, FunctionValue, InstructionOpcode, InstructionValue, IntValue, PointerValue};
+use llvm_plugin::inkwell::{AddressSpace, IntPredicate};
 use llvm_plugin::{
     LlvmModulePass, ModuleAnalysisManager, PassBuilder, PipelineParsing, PreservedAnalyses
 };
+use llvm_sys::core::{
+  LLVMGetConstOpcode, LLVMGetOperand, LLVMIsAAddrSpaceCastInst, LLVMIsAAllocaInst, LLVMIsABitCastInst,
+  LLVMIsAConstantExpr, LLVMIsAGetElementPtrInst, LLVMIsAGlobalVariable,
+};
+use llvm_sys::LLVMOpcode;
 use either::Either;
 
+mod atomic;
+mod escape;
+mod fence;
+mod gather;
+mod memory;
+mod profile;
+mod runtime;
+mod split;
+mod utils;
+
+use profile::SiteClass;
+use utils::{called_function_name, has_metadata, is_runtime_function, operand_instruction, scratch_slot, GLOBAL_METADATA, LOCAL_METADATA};
+
 #[llvm_plugin::plugin(name = "scea-load-store-pass", version = "0.1")]
 fn plugin_registrar(builder: &mut PassBuilder) {
   builder.add_module_pipeline_parsing_callback(|name, manager| {
-    match name {
-      "load-store-pass" => {
-        manager.add_pass(LoadStorePass);
+    match LoadStoreOptions::parse(name) {
+      Some(options) => {
+        manager.add_pass(LoadStorePass { options });
         PipelineParsing::Parsed
       },
-      _ => PipelineParsing::NotParsed,
+      None => PipelineParsing::NotParsed,
     }
   });
 }
 
-struct LoadStorePass;
+// options accepted as `load-store-pass<option;option;...>`
+#[derive(Clone, Default)]
+struct LoadStoreOptions {
+  // `fast-path`: test the pointer tag inline and only call into the runtime for remote pointers
+  fast_path: bool,
+  // `escape-analysis`: keep allocas whose address never leaves the function as native stack memory
+  escape_analysis: bool,
+  // `split-loads`: issue remote loads early and wait for them where the value is used
+  split_loads: bool,
+  // `store-buffer`: the runtime buffers remote stores, so flush them at release points
+  store_buffer: bool,
+  // `profile`: give every load, store and alloca a site id and count its accesses in the runtime
+  profile: bool,
+  // `profile-use=<path>`: lower each site by how it behaved in the profile at `path`
+  profile_use: Option<String>,
+}
+
+impl LoadStoreOptions {
+  fn parse(name: &str) -> Option<LoadStoreOptions> {
+    let params = match name.strip_prefix("load-store-pass") {
+      Some("") => return Some(LoadStoreOptions::default()),
+      Some(rest) => rest.strip_prefix('<')?.strip_suffix('>')?,
+      None => return None,
+    };
+
+    let mut options = LoadStoreOptions::default();
+    for param in params.split(';').filter(|param| !param.is_empty()) {
+      match param {
+        "fast-path" => options.fast_path = true,
+        "escape-analysis" => options.escape_analysis = true,
+        "split-loads" => options.split_loads = true,
+        "store-buffer" => options.store_buffer = true,
+        "profile" => options.profile = true,
+        _ if param.starts_with("profile-use=") => {
+          options.profile_use = Some(param["profile-use=".len()..].to_string());
+        },
+        _ => {
+          println!("[LOAD-STORE PASS] unknown pass option `{}`", param);
+          return None;
+        },
+      }
+    }
+    Some(options)
+  }
+}
+
+// name of the runtime global holding this node's address tag (the top 16 bits of a local global address)
+const LOCAL_TAG_GLOBAL: &str = "__pando__local_tag";
+// bits below the address tag
+const ADDRESS_MASK: u64 = 0x0000_FFFF_FFFF_FFFF;
+const TAG_SHIFT: u64 = 48;
+// branch weights for the fast path: local accesses are the common case
+const LOCAL_BRANCH_WEIGHT: u64 = 2000;
+const REMOTE_BRANCH_WEIGHT: u64 = 1;
+
+// Emits the native address of `ptr` (its address tag cleared) at the builder's position
+fn build_native_ptr<'ctx>(
+  cx: &ContextRef<'ctx>,
+  builder: &Builder<'ctx>,
+  addr: IntValue<'ctx>,
+) -> PointerValue<'ctx> {
+  let native_addr = builder.build_and(addr, cx.i64_type().const_int(ADDRESS_MASK, false), "native_addr").unwrap();
+  builder
+    .build_int_to_ptr(native_addr, cx.ptr_type(AddressSpace::from(0)), "native_ptr")
+    .unwrap()
+}
+
+// Emits the inline locality test for `ptr` at the builder's position.
+// Returns (is_local, native pointer, local tag). A pointer is local when it carries this node's
+// tag or no tag at all.
+fn build_tag_test<'ctx>(
+  cx: &ContextRef<'ctx>,
+  module: &Module<'ctx>,
+  builder: &Builder<'ctx>,
+  ptr: PointerValue<'ctx>,
+) -> (IntValue<'ctx>, PointerValue<'ctx>, IntValue<'ctx>) {
+  let i64_type = cx.i64_type();
+  let local_tag_global = module.get_global(LOCAL_TAG_GLOBAL).unwrap_or_else(|| {
+    println!("[LOAD-STORE PASS] the fast path needs the runtime to define {}", LOCAL_TAG_GLOBAL);
+    panic!("missing local tag global")
+  });
+
+  let addr = builder.build_ptr_to_int(ptr, i64_type, "addr").unwrap();
+  let tag = builder
+    .build_right_shift(addr, i64_type.const_int(TAG_SHIFT, false), false, "tag")
+    .unwrap();
+  let local_tag = builder
+    .build_load(i64_type, local_tag_global.as_pointer_value(), "local_tag")
+    .unwrap()
+    .into_int_value();
+
+  let is_local_tag = builder.build_int_compare(IntPredicate::EQ, tag, local_tag, "is_local_tag").unwrap();
+  let is_untagged = builder
+    .build_int_compare(IntPredicate::EQ, tag, i64_type.const_zero(), "is_untagged")
+    .unwrap();
+  let is_local = builder.build_or(is_local_tag, is_untagged, "is_local").unwrap();
+
+  let native_ptr = build_native_ptr(cx, builder, addr);
+
+  (is_local, native_ptr, local_tag)
+}
+
+// returns true for the instructions the pass may rewrite
+fn is_instrumented(instr: InstructionValue) -> bool {
+  matches!(
+    instr.get_opcode(),
+    InstructionOpcode::Load
+      | InstructionOpcode::Store
+      | InstructionOpcode::AtomicRMW
+      | InstructionOpcode::AtomicCmpXchg
+      | InstructionOpcode::Alloca
+  )
+}
+
+// returns the address operand of a load or store
+fn access_ptr(instr: InstructionValue) -> BasicValueEnum {
+  let index = if instr.get_opcode() == InstructionOpcode::Store { 1 } else { 0 };
+  instr.get_operand(index).unwrap().left().unwrap()
+}
+
+// Returns true if `ptr`, stripped of GEPs and casts (instructions or constant expressions), is a
+// stack slot or a global variable of this module
+fn is_local_object(ptr: BasicValueEnum) -> bool {
+  // SAFETY: only queries the kind and operands of values owned by the module
+  unsafe {
+    let mut value = ptr.as_value_ref();
+    loop {
+      if !LLVMIsAAllocaInst(value).is_null() || !LLVMIsAGlobalVariable(value).is_null() {
+        return true;
+      }
+      let is_gep_or_cast = !LLVMIsAGetElementPtrInst(value).is_null()
+        || !LLVMIsABitCastInst(value).is_null()
+        || !LLVMIsAAddrSpaceCastInst(value).is_null()
+        || (!LLVMIsAConstantExpr(value).is_null()
+          && matches!(
+            LLVMGetConstOpcode(value),
+            LLVMOpcode::LLVMGetElementPtr | LLVMOpcode::LLVMBitCast | LLVMOpcode::LLVMAddrSpaceCast
+          ));
+      if !is_gep_or_cast {
+        return false;
+      }
+      value = LLVMGetOperand(value, 0);
+    }
+  }
+}
+
+// Returns true if `ptr` is statically a local address: `globalify` of a stack slot or global of this
+// node, possibly offset by GEPs or casts. `globalify` of anything else, e.g. of a loaded pointer, may
+// be another node's address.
+fn is_proven_local(ptr: BasicValueEnum) -> bool {
+  let mut instr = ptr.as_instruction_value();
+  while let Some(current) = instr {
+    match current.get_opcode() {
+      InstructionOpcode::GetElementPtr | InstructionOpcode::BitCast | InstructionOpcode::AddrSpaceCast => {
+        instr = operand_instruction(current, 0);
+      },
+      _ => {
+        return called_function_name(current).as_deref() == Some("globalify")
+          && current.get_operand(0).and_then(|operand| operand.left()).map_or(false, is_local_object);
+      },
+    }
+  }
+  false
+}
+
+// Globalifies the pointer read by the native load `instr`, like __pando__replace_load_ptr does.
+// A pointer stored with its tag (e.g. another node's) comes back unchanged: globalify leaves tagged
+// addresses alone.
+fn globalify_loaded_ptr<'ctx>(builder: &Builder<'ctx>, globalify_func: FunctionValue<'ctx>, instr: InstructionValue<'ctx>) {
+  builder.position_before(&instr.get_next_instruction().unwrap());
+
+  let loaded_ptr = PointerValue::try_from(instr).unwrap();
+  let globalized_instr = builder
+    .build_direct_call(globalify_func, &[loaded_ptr.into()], "globalized_load")
+    .unwrap()
+    .try_as_basic_value()
+    .left()
+    .unwrap()
+    .into_pointer_value()
+    .as_instruction()
+    .unwrap();
+
+  instr.replace_all_uses_with(&globalized_instr);
+  globalized_instr.set_operand(0, loaded_ptr);
+}
+
+// Returns the always-inline fast-path variant of the runtime load/store `runtime_func`, building it
+// on first use. The variant has the same signature as `runtime_func`: it performs a native access
+// when the pointer is local and only calls `runtime_func` on the (cold) remote branch.
+fn fast_path_func<'ctx>(
+  module: &Module<'ctx>,
+  runtime_func: FunctionValue<'ctx>,
+  alignment: u32,
+) -> FunctionValue<'ctx> {
+  let runtime_name = runtime_func.get_name().to_str().unwrap();
+  let is_store = runtime_name.starts_with("__pando__replace_store_");
+  let name = format!(
+    "{}.align{}",
+    runtime_name.replacen("__pando__replace_", "__pando__fast_", 1),
+    alignment
+  );
+  if let Some(fast_func) = module.get_function(&name) {
+    return fast_func;
+  }
+
+  let cx = module.get_context();
+  let builder = cx.create_builder();
+
+  let fast_func = module.add_function(&name, runtime_func.get_type(), Some(Linkage::Internal));
+  let always_inline = cx.create_enum_attribute(Attribute::get_named_enum_kind_id("alwaysinline"), 0);
+  fast_func.add_attribute(AttributeLoc::Function, always_inline);
+
+  let entry_block = cx.append_basic_block(fast_func, "entry");
+  let local_block = cx.append_basic_block(fast_func, "local");
+  let remote_block = cx.append_basic_block(fast_func, "remote");
+
+  // loads take (src), stores take (val, dst)
+  let params = fast_func.get_params();
+  let ptr = params[if is_store { 1 } else { 0 }].into_pointer_value();
+
+  builder.position_at_end(entry_block);
+  let (is_local, native_ptr, local_tag) = build_tag_test(&cx, module, &builder, ptr);
+  let branch = builder.build_conditional_branch(is_local, local_block, remote_block).unwrap();
+  let branch_weights = cx.metadata_node(&[
+    cx.metadata_string("branch_weights").into(),
+    cx.i32_type().const_int(LOCAL_BRANCH_WEIGHT, false).into(),
+    cx.i32_type().const_int(REMOTE_BRANCH_WEIGHT, false).into(),
+  ]);
+  branch.set_metadata(branch_weights, cx.get_kind_id("prof")).unwrap();
+
+  // local: native access
+  builder.position_at_end(local_block);
+  if is_store {
+    let native_store = builder.build_store(native_ptr, params[0]).unwrap();
+    if alignment != 0 {
+      native_store.set_alignment(alignment).unwrap();
+    }
+    builder.build_return(None).unwrap();
+  } else {
+    let value_type = runtime_func.get_type().get_return_type().unwrap();
+    let native_value = builder.build_load(value_type, native_ptr, "native_value").unwrap();
+    if alignment != 0 {
+      native_value.as_instruction_value().unwrap().set_alignment(alignment).unwrap();
+    }
+
+    let value = match native_value {
+      // match __pando__replace_load_ptr, which hands back globalified pointers
+      BasicValueEnum::PointerValue(loaded_ptr) => {
+        let i64_type = cx.i64_type();
+        let loaded_addr = builder.build_ptr_to_int(loaded_ptr, i64_type, "loaded_addr").unwrap();
+        let tag_bits = builder
+          .build_left_shift(local_tag, i64_type.const_int(TAG_SHIFT, false), "tag_bits")
+          .unwrap();
+        let globalized_addr = builder.build_or(loaded_addr, tag_bits, "globalized_addr").unwrap();
+        builder
+          .build_int_to_ptr(globalized_addr, loaded_ptr.get_type(), "globalized")
+          .unwrap()
+          .into()
+      },
+      other => other,
+    };
+    builder.build_return(Some(&value)).unwrap();
+  }
+
+  // remote: fall back to the runtime
+  builder.position_at_end(remote_block);
+  let args: Vec<BasicMetadataValueEnum> = params.iter().map(|param| (*param).into()).collect();
+  let remote_call = builder.build_direct_call(runtime_func, &args, "remote").unwrap();
+  match remote_call.try_as_basic_value() {
+    Either::Left(remote_value) => builder.build_return(Some(&remote_value)).unwrap(),
+    Either::Right(_) => builder.build_return(None).unwrap(),
+  };
+
+  fast_func
+}
+
+struct LoadStorePass {
+  options: LoadStoreOptions,
+}
+
 impl LlvmModulePass for LoadStorePass {
 
 fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> PreservedAnalyses {
   let mut one_load_or_store = false;
 
-  let globalify_func = module.get_function("globalify").unwrap();
-  let loadsi64_func = module.get_function("__pando__replace_load_int64").unwrap();
-  let loadsi32_func = module.get_function("__pando__replace_load_int32").unwrap();
-  let loadsi8_func = module.get_function("__pando__replace_load_int8").unwrap();
-  let loadsfl32_func = module.get_function("__pando__replace_load_float32").unwrap();
-  let loadsptr_func = module.get_function("__pando__replace_load_ptr").unwrap();
-  let loadsvector_func = module.get_function("__pando__replace_load_vector").unwrap();
-  let storei64_func = module.get_function("__pando__replace_store_int64").unwrap();
-  let storei32_func = module.get_function("__pando__replace_store_int32").unwrap();
-  let storei8_func = module.get_function("__pando__replace_store_int8").unwrap();
-  let storefl32_func = module.get_function("__pando__replace_store_float32").unwrap();
-  let storeptr_func = module.get_function("__pando__replace_store_ptr").unwrap();
-  let storevector_func = module.get_function("__pando__replace_store_vector").unwrap();
-  
+  let runtime = runtime::RuntimeFunctions::new(module);
+  let globalify_func = runtime.globalify;
+  // mostly-remote sites of a profile are split too, when the runtime supports it
+  let load_issue_func = match self.options.split_loads {
+    true => Some(module.get_function(split::LOAD_ISSUE_FUNC).unwrap_or_else(|| {
+      println!("[LOAD-STORE PASS] split loads need the runtime to define {}", split::LOAD_ISSUE_FUNC);
+      panic!("missing load issue function")
+    })),
+    false if self.options.profile_use.is_some() => module.get_function(split::LOAD_ISSUE_FUNC),
+    false => None,
+  };
+  let fence_func = self.options.store_buffer.then(|| {
+    module.get_function(fence::FENCE_FUNC).unwrap_or_else(|| {
+      println!("[LOAD-STORE PASS] the store buffer needs the runtime to define {}", fence::FENCE_FUNC);
+      panic!("missing fence function")
+    })
+  });
+  let profiler = self.options.profile.then(|| profile::Profiler::new(module));
 
   let cx = module.get_context();
   let builder = cx.create_builder();
+  let local_kind = cx.get_kind_id(LOCAL_METADATA);
+  let global_kind = cx.get_kind_id(GLOBAL_METADATA);
+
+  // sites are numbered up front, so the profile can be checked against the whole module
+  if self.options.profile || self.options.profile_use.is_some() {
+    for f in module.get_functions().filter(|f| !is_runtime_function(f.get_name().to_str().unwrap())) {
+      profile::assign_sites(&cx, f);
+    }
+  }
+  let site_profile = self.options.profile_use.as_ref().and_then(|path| {
+    match profile::SiteProfile::load(module, path) {
+      Ok(mut site_profile) => {
+        site_profile.check(module);
+        Some(site_profile)
+      },
+      Err(error) => {
+        println!("[LOAD-STORE PASS] profile: {}, instrumenting without it", error);
+        None
+      },
+    }
+  });
+  // sites lowered natively, with an inline tag guard, and as remote because of the profile
+  let mut num_native_sites = 0;
+  let mut num_guarded_sites = 0;
+  let mut num_remote_sites = 0;
+
   let fs = module.get_functions();
 
   for f in fs {
 
-    // skip modifying loads/stores inside our wrapper functions
-    match f.get_name().to_str().unwrap() {
-      "__pando__replace_load_int64" => continue,
-      "__pando__replace_load_int32" => continue,
-      "__pando__replace_load_int8" => continue,
-      "__pando__replace_load_float32" => continue,
-      "__pando__replace_load_ptr" => continue,
-      "__pando__replace_load_vector" => continue,
-      "__pando__replace_store_int64" => continue,
-      "__pando__replace_store_int32" => continue,
-      "__pando__replace_store_int8" => continue,
-      "__pando__replace_store_float32" => continue,
-      "__pando__replace_store_ptr" => continue,
-      "__pando__replace_store_vector" => continue,
-      "check_if_global" => continue,
-      "deglobalify" => continue,
-      "globalify" => continue,
-      _ => (),
+    // skip modifying loads/stores inside our wrapper functions (and the fast-path variants we add)
+    if is_runtime_function(f.get_name().to_str().unwrap()) {
+      continue;
+    }
+
+    let function_name = f.get_name().to_str().unwrap();
+
+    // private stack slots (and their loads/stores) get marked `pando.local` and stay native
+    if self.options.escape_analysis {
+      escape::mark_private_allocas(&cx, f);
     }
 
+    // scalar loads instrumented in this function, and those that could not be split
+    let mut num_loads = 0;
+    let mut num_unsplit = 0;
+    // entry-block slots that values are spilled to for the runtime, one per type
+    let mut scratch_slots = Vec::new();
+
     // iterate over basic blocks in the function
     for b in f.get_basic_block_iter() {
 
+      // the block's loads, stores, atomics, allocas, memory copies and fills and masked gathers and
+      // scatters, collected up front since rewriting them inserts and erases instructions
+      let worklist: Vec<InstructionValue> = b
+        .get_instructions()
+        .filter(|instr| {
+          is_instrumented(*instr) || memory::is_memory_transfer(module, *instr) || gather::is_gather_or_scatter(*instr)
+        })
+        .collect();
+
       // iterate over instructions in the basic block
-      for instr in b.get_instructions() {
+      for instr in worklist {
+
+        let site_class = site_profile.as_ref().and_then(|site_profile| site_profile.class(instr));
 
         match instr.get_opcode() {
+          InstructionOpcode::Load if has_metadata(instr, local_kind) => {
+            // native load. pointers still come back globalified, like from __pando__replace_load_ptr
+            if let AnyTypeEnum::PointerType(_) = instr.get_type() {
+              one_load_or_store = true;
+              globalify_loaded_ptr(&builder, globalify_func, instr);
+            }
+          }, // end: local InstructionOpcode::Load
+
+          // always local in the profile and statically local: a native access, without a tag test
+          InstructionOpcode::Load | InstructionOpcode::Store
+            if site_class == Some(SiteClass::Local)
+              && !has_metadata(instr, local_kind)
+              && is_proven_local(access_ptr(instr)) =>
+          {
+            one_load_or_store = true;
+            num_native_sites += 1;
+            builder.position_before(&instr);
+
+            let ptr_index = if instr.get_opcode() == InstructionOpcode::Load { 0 } else { 1 };
+            let addr = builder
+              .build_ptr_to_int(access_ptr(instr).into_pointer_value(), cx.i64_type(), "addr")
+              .unwrap();
+            instr.set_operand(ptr_index, build_native_ptr(&cx, &builder, addr));
+            instr.set_metadata(cx.metadata_node(&[]), local_kind).unwrap();
+
+            if instr.get_opcode() == InstructionOpcode::Load && instr.get_type().is_pointer_type() {
+              globalify_loaded_ptr(&builder, globalify_func, instr);
+            }
+          }, // end: profiled local InstructionOpcode::Load/Store
+
           InstructionOpcode::Load  => {
             one_load_or_store = true;
             builder.position_at(b, &instr);
@@ -83,29 +452,92 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
             match operand {
               BasicValueEnum::PointerValue(_) => {
                 // figure out which function we should use to load to this operand
+                // (vectors that fit a register come back by value, the others through a buffer)
                 let func = match instr.get_type() {
-                  AnyTypeEnum::PointerType(_) => loadsptr_func,
-                  AnyTypeEnum::IntType(int_type) => match int_type.get_bit_width() {
-                    64 => loadsi64_func,
-                    32 => loadsi32_func,
-                    8 => loadsi8_func,
-                    _ => {
-                      println!(
-                        "[LOAD-STORE PASS] we are attempting to instrument a LOAD 
-                        with a non-supported bit-width of {}. add this!", 
-                        int_type.get_bit_width()
-                      );
-                      panic!("need to add new supported load behavior")
-                    },
+                  AnyTypeEnum::VectorType(vec_type) => runtime
+                    .load_by_value(module, vec_type)
+                    .unwrap_or_else(|| runtime.load(instr.get_type())),
+                  value_type => runtime.load(value_type),
+                };
+                let by_value = matches!(func.get_type().get_return_type(), Some(BasicTypeEnum::VectorType(_)));
+
+                // scalar loads can be split into an early issue and a wait at the original position
+                let issue_point = match instr.get_type() {
+                  AnyTypeEnum::VectorType(_) => None,
+                  _ if site_class == Some(SiteClass::Local) => None,
+                  _ if self.options.split_loads || (site_class == Some(SiteClass::Remote) && load_issue_func.is_some()) => {
+                    num_loads += 1;
+                    let issue_point = split::issue_point(instr);
+                    if issue_point.is_none() {
+                      num_unsplit += 1;
+                    }
+                    issue_point
                   },
-                  AnyTypeEnum::FloatType(_) => loadsfl32_func,
-                  AnyTypeEnum::VectorType(_) => loadsvector_func,
-                  _ => loadsi64_func,
+                  _ => None,
                 };
 
+                // addresses proven tagged skip the runtime's tag check
+                let func = match instr.get_type() {
+                  AnyTypeEnum::VectorType(_) => func,
+                  _ if issue_point.is_none() && has_metadata(instr, global_kind) => runtime.unchecked(module, func),
+                  _ => func,
+                };
+
+                // scalar loads can test the tag inline and stay native when local
+                // (sites the profile found always local get the tag test, mostly-remote ones skip it)
+                let func = match instr.get_type() {
+                  AnyTypeEnum::VectorType(_) => func,
+                  _ if issue_point.is_some() => func,
+                  _ if site_class == Some(SiteClass::Remote) => func,
+                  _ if self.options.fast_path || site_class == Some(SiteClass::Local) => {
+                    fast_path_func(module, func, instr.get_alignment().unwrap_or(0))
+                  },
+                  _ => func,
+                };
+                match site_class {
+                  Some(SiteClass::Local) if func.get_name().to_str().unwrap().starts_with("__pando__fast_") => {
+                    num_guarded_sites += 1
+                  },
+                  Some(SiteClass::Remote) => num_remote_sites += 1,
+                  _ => {},
+                }
+
+                // profiled loads are timed from their issue
+                let profile_start = profiler.as_ref().map(|profiler| {
+                  match issue_point {
+                    Some(issue_point) => builder.position_before(&issue_point),
+                    None => builder.position_at(b, &instr),
+                  }
+                  profiler.begin(&builder)
+                });
+
                 // build a call to the chosen loader function to load this operand 
-                let func_call: CallSiteValue =  match instr.get_type() {
-                  AnyTypeEnum::VectorType(vec_type) => {
+                let func_call: CallSiteValue =  match (instr.get_type(), issue_point) {
+                  (_, Some(issue_point)) => {
+                    let func_name = func.get_name().to_str().unwrap();
+                    let wait_func_name = split::wait_func_name(func_name).unwrap();
+                    let wait_func = module.get_function(&wait_func_name).unwrap_or_else(|| {
+                      println!("[LOAD-STORE PASS] split loads need the runtime to define {}", wait_func_name);
+                      panic!("missing load wait function")
+                    });
+
+                    let value_type = BasicTypeEnum::try_from(instr.get_type()).unwrap();
+                    builder.position_before(&issue_point);
+                    let handle = builder
+                      .build_direct_call(
+                        load_issue_func.unwrap(),
+                        &[operand.into(), value_type.size_of().unwrap().into()],
+                        "load_handle"
+                      )
+                      .unwrap()
+                      .try_as_basic_value()
+                      .left()
+                      .unwrap();
+
+                    builder.position_at(b, &instr);
+                    builder.build_direct_call(wait_func, &[handle.into()], "loads_func")
+                  },
+                  (AnyTypeEnum::VectorType(vec_type), None) if !by_value => {
                     builder.build_direct_call(
                       func,
                       &[
@@ -116,7 +548,7 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
                       "loads_func"
                     )
                   },
-                  _ => {
+                  (_, None) => {
                     builder.build_direct_call(
                       func,
                       &[operand.into()],
@@ -128,7 +560,7 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
                 // extract the result of the function call as an instruction
                 let replace_instr: InstructionValue = match func_call.try_as_basic_value() {
                   Either::Left(basic_value) => match instr.get_type() {
-                    AnyTypeEnum::VectorType(vec_type) => {
+                    AnyTypeEnum::VectorType(vec_type) if !by_value => {
                       builder.build_load(vec_type, 
                                          basic_value.into_pointer_value(),
                                          "loaded_vector")
@@ -144,6 +576,8 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
                         basic_value.into_int_value().as_instruction().unwrap()
                       } else if basic_value.is_float_value() {
                         basic_value.into_float_value().as_instruction().unwrap()
+                      } else if basic_value.is_vector_value() {
+                        basic_value.into_vector_value().as_instruction().unwrap()
                       } else {
                         panic!("This is unreachable for the call type")
                       }
@@ -152,6 +586,20 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
                   Either::Right(instr_value) => {instr_value}
                 };
                   
+                if let Some(profiler) = &profiler {
+                  let value_type = BasicTypeEnum::try_from(instr.get_type()).unwrap();
+                  profiler.end(
+                    module,
+                    &builder,
+                    instr,
+                    function_name,
+                    profile_start,
+                    operand.into_pointer_value(),
+                    value_type.size_of().unwrap(),
+                  );
+                  profiler.tag(instr, replace_instr);
+                }
+
                 // replace the load instruction with our new loader function call.
                 instr.replace_all_uses_with(&replace_instr);
                 instr.erase_from_basic_block();
@@ -169,6 +617,9 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
             }
           }, // end: InstructionOpcode::Load
 
+          // native store to a private stack slot
+          InstructionOpcode::Store if has_metadata(instr, local_kind) => continue,
+
           InstructionOpcode::Store  => {
             one_load_or_store = true;
             builder.position_at(b, &instr);
@@ -177,48 +628,49 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
             let operand1 = instr.get_operand(1).unwrap().left().unwrap();
 
             // figure out which function we should use to store this operand
+            // (vectors that fit a register go by value, addresses proven tagged skip the tag check)
             let func = match operand0 {
-              BasicValueEnum::PointerValue(_) => storeptr_func,
-              BasicValueEnum::IntValue(int_value) => match int_value.get_type().get_bit_width() {
-                64 => storei64_func,
-                32 => storei32_func,
-                8 => storei8_func,
-                _ => {
-                  println!(
-                    "[LOAD-STORE PASS] we are attempting to instrument a STORE 
-                    with a non-supported bit-width of {}. add this!", 
-                    int_value.get_type().get_bit_width()
-                  );
-                  panic!("need to add new supported store behavior")
-                },
-              },
-              BasicValueEnum::FloatValue(_) => storefl32_func,
-              BasicValueEnum::VectorValue(_) => storevector_func,
-              _ => {
-                panic!("Unreachable {:#?}", operand0)
+              BasicValueEnum::VectorValue(vec_val) => runtime
+                .store_by_value(module, vec_val.get_type())
+                .unwrap_or_else(|| runtime.store(operand0)),
+              _ if has_metadata(instr, global_kind) => runtime.unchecked(module, runtime.store(operand0)),
+              _ => runtime.store(operand0),
+            };
+
+            let by_value = matches!(func.get_nth_param(0), Some(BasicValueEnum::VectorValue(_)));
+
+            let profile_start = profiler.as_ref().map(|profiler| profiler.begin(&builder));
+
+            // scalar stores can test the tag inline and stay native when local
+            // (sites the profile found always local get the tag test, mostly-remote ones skip it)
+            let func = match operand0 {
+              BasicValueEnum::VectorValue(_) => func,
+              _ if site_class == Some(SiteClass::Remote) => func,
+              _ if self.options.fast_path || site_class == Some(SiteClass::Local) => {
+                fast_path_func(module, func, instr.get_alignment().unwrap_or(0))
               },
+              _ => func,
             };
+            match site_class {
+              Some(SiteClass::Local) if !operand0.is_vector_value() => num_guarded_sites += 1,
+              Some(SiteClass::Remote) => num_remote_sites += 1,
+              _ => {},
+            }
         
             // build a call to the chosen storing function to store this operand 
             let func_call: CallSiteValue = match operand0 {
-                BasicValueEnum::VectorValue(vec_val) => {
+                BasicValueEnum::VectorValue(vec_val) if !by_value => {
                   let vec_type = vec_val.get_type();
-                  
-                  builder.position_before(&instr);
-
-                  let alloca_buffer = builder.build_alloca(vec_type, "alloca_buffer").unwrap();
-                  builder.build_store(alloca_buffer, vec_val).unwrap();
-
-                  let ptr_type = cx.ptr_type(AddressSpace::from(0));
-                  let casted_alloca_buffer = builder
-                    .build_bit_cast(alloca_buffer, ptr_type, "casted_alloca_buffer").unwrap();
+                  let scratch = scratch_slot(&cx, &builder, f, &mut scratch_slots, vec_type.into());
 
                   builder.position_at(b, &instr);
+                  let spill = builder.build_store(scratch, vec_val).unwrap();
+                  spill.set_metadata(cx.metadata_node(&[]), local_kind).unwrap();
 
                   builder.build_direct_call(
                     func,
                     &[
-                      casted_alloca_buffer.into(),
+                      scratch.into(),
                       operand1.into(),
                       vec_type.get_element_type().size_of().unwrap().into(),
                       cx.i64_type().const_int(vec_type.get_size().into(), false).into()
@@ -254,11 +706,54 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
               Either::Right(instr_value) => instr_value,
             };
                
+            if let Some(profiler) = &profiler {
+              profiler.end(
+                module,
+                &builder,
+                instr,
+                function_name,
+                profile_start,
+                operand1.into_pointer_value(),
+                operand0.get_type().size_of().unwrap(),
+              );
+              profiler.tag(instr, replace_instr);
+            }
+
             // replace the store instruction with the result of our new storing function call.
             instr.replace_all_uses_with(&replace_instr);
             instr.erase_from_basic_block();
           }, // end: InstructionOpcode::Store
 
+          // atomics run at the owner of the address, as a single runtime call
+          InstructionOpcode::AtomicRMW | InstructionOpcode::AtomicCmpXchg if has_metadata(instr, local_kind) => continue,
+
+          InstructionOpcode::AtomicRMW => {
+            atomic::lower_rmw(module, &builder, instr);
+            one_load_or_store = true;
+          },
+
+          InstructionOpcode::AtomicCmpXchg => {
+            atomic::lower_cmpxchg(module, &builder, instr);
+            one_load_or_store = true;
+          },
+
+          // copies and fills run in the runtime, as bulk transfers at the owners of the memory
+          InstructionOpcode::Call if has_metadata(instr, local_kind) => continue,
+
+          // masked gathers and scatters run in the runtime, one request per owner of the lanes
+          InstructionOpcode::Call if gather::is_gather_or_scatter(instr) => {
+            one_load_or_store = true;
+            gather::lower(module, &builder, f, &mut scratch_slots, globalify_func, self.options.fast_path, instr);
+          },
+
+          InstructionOpcode::Call => {
+            one_load_or_store = true;
+            memory::lower(module, &builder, instr);
+          },
+
+          // private stack slot, its address never leaves the function
+          InstructionOpcode::Alloca if has_metadata(instr, local_kind) => continue,
+
           InstructionOpcode::Alloca => {
             one_load_or_store = true;
             builder.position_at(b, &instr.get_next_instruction().unwrap());
@@ -273,6 +768,12 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
                 Either::Right(instr_value) => instr_value,
             };
 
+            // allocas only count how often their slot is globalized
+            if let Some(profiler) = &profiler {
+              let globalized_ptr = PointerValue::try_from(next_instr).unwrap();
+              profiler.end(module, &builder, instr, function_name, None, globalized_ptr, cx.i64_type().const_zero());
+            }
+
             instr.replace_all_uses_with(&next_instr);
             next_instr.set_operand(0, ptr_val);
           }, // end: InstructionOpcode::Alloca
@@ -283,8 +784,34 @@ fn run_pass(&self, module: &mut Module, _manager: &ModuleAnalysisManager) -> Pre
 
       } // end: iterating over INSTRUCTIONS
     } // end: iterating over BASIC BLOCKS
+
+    // buffered remote stores must be visible before atomics, fences, unknown code and returns
+    if let Some(fence_func) = fence_func {
+      if fence::insert_release_fences(module, &builder, f, fence_func) > 0 {
+        one_load_or_store = true;
+      }
+    }
+
+    // pointer chasing (the address is the result of the previous load) leaves nothing to overlap
+    if num_unsplit > 0 {
+      println!(
+        "[LOAD-STORE PASS] {}: {} of {} loads could not be split",
+        f.get_name().to_str().unwrap(),
+        num_unsplit,
+        num_loads
+      );
+    }
   } // end: iterating over FUNCTIONS
 
+  if site_profile.is_some() {
+    println!(
+      "[LOAD-STORE PASS] profile: {} sites native, {} guarded, {} lowered as remote",
+      num_native_sites,
+      num_guarded_sites,
+      num_remote_sites
+    );
+  }
+
   one_load_or_store
     .then_some(PreservedAnalyses::None)
     .unwrap_or(PreservedAnalyses::All)
@@ -0,0 +1,100 @@
+use llvm_plugin::inkwell::builder::Builder;
+use llvm_plugin::inkwell::module::Module;
+use llvm_plugin::inkwell::types::AnyTypeEnum;
+use llvm_plugin::inkwell::values::{BasicValue, BasicValueEnum, FunctionValue, InstructionOpcode, InstructionValue};
+
+use crate::utils::called_function_name;
+
+// runtime entry points of copies (memcpy and memmove) and fills. both return dst, like libc.
+pub const MEMCPY_FUNC: &str = "__pando__memcpy";
+pub const MEMSET_FUNC: &str = "__pando__memset";
+
+// what a copy or fill call does
+enum Transfer {
+  Copy,
+  Fill,
+}
+
+// returns what the call `instr` does if it copies or fills memory: llvm.memcpy, llvm.memmove and
+// llvm.memset (and their .inline forms, but not the element-wise atomic ones), or the libc functions.
+// invokes are left alone, a call could not keep their unwind edge.
+fn transfer(module: &Module, instr: InstructionValue) -> Option<Transfer> {
+  if instr.get_opcode() != InstructionOpcode::Call {
+    return None;
+  }
+  let name = called_function_name(instr)?;
+  if let Some(intrinsic) = name.strip_prefix("llvm.") {
+    if intrinsic.contains(".element.") {
+      return None;
+    }
+    return if intrinsic.starts_with("memcpy.") || intrinsic.starts_with("memmove.") {
+      Some(Transfer::Copy)
+    } else if intrinsic.starts_with("memset.") {
+      Some(Transfer::Fill)
+    } else {
+      None
+    };
+  }
+
+  // a function of the module with a libc name is not the libc one
+  let is_declaration = module.get_function(&name).map_or(false, |func| func.as_global_value().is_declaration());
+  match name.as_str() {
+    "memcpy" | "memmove" if is_declaration => Some(Transfer::Copy),
+    "memset" if is_declaration => Some(Transfer::Fill),
+    _ => None,
+  }
+}
+
+// returns true if `instr` is a copy or fill that `lower` replaces
+pub fn is_memory_transfer(module: &Module, instr: InstructionValue) -> bool {
+  transfer(module, instr).is_some()
+}
+
+fn runtime_func<'ctx>(module: &Module<'ctx>, name: &str) -> FunctionValue<'ctx> {
+  module.get_function(name).unwrap_or_else(|| {
+    println!("[LOAD-STORE PASS] memory copies and fills need the runtime to define {}", name);
+    panic!("missing memory transfer function")
+  })
+}
+
+fn operand<'ctx>(instr: InstructionValue<'ctx>, index: u32) -> BasicValueEnum<'ctx> {
+  instr.get_operand(index).unwrap().left().unwrap()
+}
+
+// Replaces a copy `memcpy(dst, src, n)` / `memmove(dst, src, n)` with `__pando__memcpy(dst, src, n)`
+// and a fill `memset(dst, value, n)` with `__pando__memset(dst, value, n)`. The runtime does the
+// transfer natively, as one bulk get or put, or at the owner of the memory. The intrinsics' volatile
+// flag is dropped: the runtime call is opaque to the optimizer.
+pub fn lower<'ctx>(module: &Module<'ctx>, builder: &Builder<'ctx>, instr: InstructionValue<'ctx>) {
+  builder.position_before(&instr);
+  let cx = module.get_context();
+  let i64_type = cx.i64_type();
+
+  let dst = operand(instr, 0);
+  // the intrinsics take an i32 or i64 length, libc a size_t
+  let n = builder
+    .build_int_z_extend_or_bit_cast(operand(instr, 2).into_int_value(), i64_type, "transfer_size")
+    .unwrap();
+
+  let call = match transfer(module, instr).unwrap() {
+    Transfer::Copy => {
+      let src = operand(instr, 1);
+      builder.build_direct_call(runtime_func(module, MEMCPY_FUNC), &[dst.into(), src.into(), n.into()], "memcpy")
+    },
+    Transfer::Fill => {
+      // llvm.memset takes an i8, memset an int
+      let value = builder
+        .build_int_z_extend_or_bit_cast(operand(instr, 1).into_int_value(), cx.i32_type(), "fill_value")
+        .unwrap();
+      builder.build_direct_call(runtime_func(module, MEMSET_FUNC), &[dst.into(), value.into(), n.into()], "memset")
+    },
+  }
+  .unwrap();
+
+  // libc's copies and fills return dst, like the runtime's
+  if !matches!(instr.get_type(), AnyTypeEnum::VoidType(_)) {
+    let result = call.try_as_basic_value().left().unwrap().as_instruction_value().unwrap();
+    instr.replace_all_uses_with(&result);
+  }
+  instr.erase_from_basic_block();
+}
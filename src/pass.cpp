@@ -1,141 +1,352 @@
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "pando_passes.h"
+
 using namespace llvm;
 
+static cl::opt<std::string> ProfileUse(
+    "pando-profile-use", cl::init(""),
+    cl::desc("Profile of load-store-pass<profile> runs. Loads and stores of this module's globals "
+             "that were always local in it are left native"));
+
+static cl::opt<bool> SymHeapGlobals(
+    "pando-symheap-globals", cl::init(false),
+    cl::desc("Place the globalized mutable globals in the pando_symheap section, which the GASNet "
+             "runtime moves to its symmetric heap so other nodes access them with RMA"));
+
 namespace {
 
 struct GlobalizePass : public PassInfoMixin<GlobalizePass> {
 
-static bool processInstruction(Module &m, IRBuilder<> &builder,
-                               Function *globalifyFunc, Function *deglobalifyFunc, Instruction &instr) {
-    bool oneConstGlobalified = false;
+// Returns the index of the address operand of a load or store that was always local in the profile
+// and accesses a global of this module (whose address is local by construction), or -1.
+static int profiledLocalOperand(const SiteProfile *profile, Instruction &instr) {
+    if (!profile || profile->classify(instr) != SiteClass::Local) {
+        return -1;
+    }
 
-    unsigned numOperands = instr.getNumOperands();
-    uint64_t instrOpcode = instr.getOpcode();
+    int operandIndex = -1;
+    if (auto *load = dyn_cast<LoadInst>(&instr)) {
+        operandIndex = load->getPointerOperandIndex();
+    } else if (auto *store = dyn_cast<StoreInst>(&instr)) {
+        operandIndex = store->getPointerOperandIndex();
+    } else {
+        return -1;
+    }
 
-    // iterate through the operands
-    for (unsigned operandIndex = 0; operandIndex < numOperands; operandIndex++) {
-        Value *operand = instr.getOperand(operandIndex);
-        assert(operand);
+    // globals moved to the symmetric heap are only reached through globalify
+    auto *gv = dyn_cast<GlobalVariable>(instr.getOperand(operandIndex)->stripInBoundsConstantOffsets());
+    return (gv && !gv->getName().empty() && !gv->isThreadLocal() && gv->getSection() != SymHeapSection)
+               ? operandIndex : -1;
+}
 
-        Type *type = operand->getType();
-        assert(type);
+// Returns true if every user of c is an instruction, or a constant GEP or icmp that is rebuilt as
+// one (whose users are too). Any other user, e.g. the initializer of another global
+// (`int *p = array;`) or a cast, would keep the address c had before it moved.
+static bool onlyRewrittenUsers(Constant &c) {
+    for (User *user : c.users()) {
+        if (isa<Instruction>(user)) {
+            continue;
+        }
+        auto *constExpr = dyn_cast<ConstantExpr>(user);
+        if (!constExpr || !isLoweredConstantExpr(constExpr) || !onlyRewrittenUsers(*constExpr)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        if (auto *constExpr = dyn_cast<ConstantExpr>(operand)) {
-            // handle the constexpr-as-an-operand case. 
-            // the constexpr can contain references to globals.
+// Returns true if gv can move to the symmetric heap: a mutable global defined here, in no section,
+// whose address is only taken by instructions that globalize-pass rewrites
+static bool isSymHeapCandidate(GlobalVariable &gv) {
+    return !gv.isDeclaration() && !gv.isConstant() && !gv.isThreadLocal() && !gv.hasSection() &&
+           !gv.hasCommonLinkage() && !gv.getName().empty() && !gv.getName().starts_with("llvm.") &&
+           onlyRewrittenUsers(gv);
+}
 
-            // so far, we only care about ICmp and GEP instructions as constexpr operands.
-                // *there likely will be more.*
+// Returns true if the address ptr cannot be written through: every use, through GEPs and casts,
+// loads from it, compares it, or passes it to a read-only, non-capturing parameter of a function
+// declared outside the module.
+static bool isReadOnlyAddress(Value *ptr) {
+    for (Use &use : ptr->uses()) {
+        User *user = use.getUser();
+        if (isa<LoadInst>(user) || isa<ICmpInst>(user)) {
+            continue;
+        }
+        if (auto *call = dyn_cast<CallInst>(user)) {
+            Function *callee = call->getCalledFunction();
+            if (callee && callee->isDeclaration() && call->isArgOperand(&use)) {
+                unsigned argNo = call->getArgOperandNo(&use);
+                if (call->onlyReadsMemory(argNo) && call->doesNotCapture(argNo)) {
+                    continue;
+                }
+            }
+            return false;
+        }
+        if (auto *constExpr = dyn_cast<ConstantExpr>(user)) {
             if (constExpr->getOpcode() == Instruction::ICmp) {
-
-                Value* lhs = constExpr->getOperand(0);
-                Value* rhs = constExpr->getOperand(1);
-
-                if (!isa<GlobalVariable>(lhs) && !isa<GlobalVariable>(rhs)) {
+                continue;
+            }
+            if ((constExpr->getOpcode() == Instruction::GetElementPtr && use.getOperandNo() == 0) ||
+                constExpr->getOpcode() == Instruction::BitCast) {
+                if (isReadOnlyAddress(constExpr)) {
                     continue;
                 }
+            }
+            return false;
+        }
+        if ((isa<GetElementPtrInst>(user) && use.getOperandNo() == 0) || isa<BitCastInst>(user) ||
+            isa<AddrSpaceCastInst>(user)) {
+            if (isReadOnlyAddress(user)) {
+                continue;
+            }
+        }
+        // stored, merged with other pointers, cast to an integer, passed to code of this module...
+        return false;
+    }
+    return true;
+}
+
+// Returns true if every node can keep its own copy of gv: it is constant, or it is internal and
+// nothing in the module writes it.
+static bool isReplicated(GlobalVariable &gv) {
+    if (gv.getName().empty() || gv.isThreadLocal() || gv.getName().starts_with("llvm.")) {
+        return false;
+    }
+    return gv.isConstant() || (gv.hasLocalLinkage() && !gv.isDeclaration() && isReadOnlyAddress(&gv));
+}
 
-                builder.SetInsertPoint(&instr);
+// Returns true if the address ptr of a replicated global is only read natively: every use, through
+// GEP and cast instructions, is a load of a non-pointer value or an argument of a function declared
+// outside the module (which got a deglobalified address before). The loads are added to loads.
+// Loaded pointers are left to the globalified path, since they must carry a tag.
+static bool readsNatively(Value *ptr, SmallVectorImpl<LoadInst *> &loads) {
+    for (Use &use : ptr->uses()) {
+        User *user = use.getUser();
+        if (auto *load = dyn_cast<LoadInst>(user)) {
+            if (load->getType()->isPtrOrPtrVectorTy()) {
+                return false;
+            }
+            loads.push_back(load);
+        } else if (auto *call = dyn_cast<CallInst>(user)) {
+            Function *callee = call->getCalledFunction();
+            if (!callee || !callee->isDeclaration() || !call->isArgOperand(&use)) {
+                return false;
+            }
+        } else if ((isa<GetElementPtrInst>(user) && use.getOperandNo() == 0) || isa<BitCastInst>(user) ||
+                   isa<AddrSpaceCastInst>(user)) {
+            if (!readsNatively(user, loads)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
 
-                if (isa<GlobalVariable>(lhs)) {
-                    lhs = builder.CreateCall(globalifyFunc, {lhs}, "globalified_lhs");
-                }
+// Returns true if operand `operandIndex` of instr, the address of a replicated global, can stay
+// native, and marks the loads through it `pando.local`.
+static bool replicatedOperand(Instruction &instr, unsigned operandIndex) {
+    SmallVector<LoadInst *, 8> loads;
+    if (auto *load = dyn_cast<LoadInst>(&instr)) {
+        if (load->getType()->isPtrOrPtrVectorTy()) {
+            return false;
+        }
+        loads.push_back(load);
+    } else if (auto *call = dyn_cast<CallInst>(&instr)) {
+        Function *callee = call->getCalledFunction();
+        if (!callee || !callee->isDeclaration() || !call->isArgOperand(&call->getOperandUse(operandIndex))) {
+            return false;
+        }
+    } else if ((isa<GetElementPtrInst>(&instr) && operandIndex == 0) || isa<BitCastInst>(&instr) ||
+               isa<AddrSpaceCastInst>(&instr)) {
+        if (!readsNatively(&instr, loads)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
 
-                if (isa<GlobalVariable>(rhs)) {
-                    rhs = builder.CreateCall(globalifyFunc, {rhs}, "globalified_rhs");
-                }
+    for (LoadInst *load : loads) {
+        load->setMetadata(LocalMetadata, MDNode::get(load->getContext(), {}));
+    }
+    return true;
+}
 
-                Value* newInstr = builder.CreateICmp(
-                    static_cast<ICmpInst::Predicate>(constExpr->getPredicate()), 
-                    lhs, 
-                    rhs, 
-                    "lowered_icmp"
-                );
-
-                instr.setOperand(operandIndex, newInstr);
-            } else if (constExpr->getOpcode() == Instruction::GetElementPtr) {
-                Value* gep_ptr = constExpr->getOperand(0);
-                Type* gep_ptr_type = gep_ptr->getType();
-
-                if (auto gv = dyn_cast<GlobalVariable>(gep_ptr)) {
-                    gep_ptr = builder.CreateCall(globalifyFunc, {gep_ptr}, "globalified_gep_ptr");
-                    gep_ptr_type = gv->getValueType();
-                }
-                    
-                std::vector<Value*> idxList;
-                for(uint64_t i = 1; i < constExpr->getNumOperands(); i++) {
-                    idxList.push_back(constExpr->getOperand(i));
-                }
+// Returns where a value for operand `operandIndex` of instr is computed: right before instr, or for
+// a phi at the end of the incoming block.
+static Instruction *insertionPoint(Instruction &instr, unsigned operandIndex) {
+    if (auto *phi = dyn_cast<PHINode>(&instr)) {
+        return phi->getIncomingBlock(operandIndex)->getTerminator();
+    }
+    return &instr;
+}
 
-                Value* newGepInstr = builder.CreateInBoundsGEP(gep_ptr_type, gep_ptr, idxList);
+// Replaces operand `operandIndex` of instr, the global gv, by its globalified address.
+static void globalizeOperand(IRBuilder<> &builder, Function *globalifyFunc, Function *deglobalifyFunc,
+                             Instruction &instr, unsigned operandIndex, GlobalVariable *gv) {
+    builder.SetInsertPoint(insertionPoint(instr, operandIndex));
 
-                instr.setOperand(operandIndex, newGepInstr);
-            }
-        } else if (type->isPointerTy()) {
-            if (!isa<Constant>(operand)) {
-                // operand is not const. do not globalify.
-                continue;
-            }
+    Value *globalifyInvocationInstr = builder.CreateCall(
+        globalifyFunc, {gv}, "globalified_ptr");
 
-            auto *gv = dyn_cast<GlobalVariable>(operand);
-            if (!gv || gv->getName().empty()) {
-                // operand is not a global variable. do not globalify.
-                continue;
-            }
+    // @Sun: this logic may not be correct long-term depending on how we implement
+    // global/local addresses across function boundaries, especially regarding
+    // library functions.
+    // copies and fills keep the tagged address: the load-store pass lowers them to the runtime
+    if (instr.getOpcode() == Instruction::Call && !isMemoryTransfer(cast<CallInst>(instr))) {
+        if (gv->getType()->isPointerTy()) {
+            // we just deglobalize it for use inside the function
 
-            // operand is a const global pointer. globalify it.
+            // @Sun: this is kinda gross and we should change this later.
 
-            oneConstGlobalified = true;
-            builder.SetInsertPoint(&instr);
-
-            Value *globalifyInvocationInstr = builder.CreateCall(
-                globalifyFunc, {operand}, "globalified_ptr");
-
-            // @Sun: this logic may not be correct long-term depending on how we implement
-            // global/local addresses across function boundaries, especially regarding
-            // library functions.
-            if (instrOpcode == Instruction::Call) {
-                if (operand->getType()->isPointerTy()) {
-                    // we just deglobalize it for use inside the function
-
-                    // @Sun: this is kinda gross and we should change this later.
-                    
-                    Value* deglobalifyInvocationInstr = builder.CreateCall(
-                        deglobalifyFunc, 
-                        {globalifyInvocationInstr}, 
-                        "deglobalified_ptr"
-                    );
-
-                    instr.setOperand(operandIndex, deglobalifyInvocationInstr);
-                } else {
-                    // add a load which will get transformed by the load/store pass
-                    LoadInst* load_instr = builder.CreateLoad(
-                    type, globalifyInvocationInstr, "globalified_ptr_loaded");
-
-                    instr.setOperand(operandIndex, load_instr);
-                }
-            } else {
-                instr.setOperand(operandIndex, globalifyInvocationInstr);
-            }
+            Value* deglobalifyInvocationInstr = builder.CreateCall(
+                deglobalifyFunc,
+                {globalifyInvocationInstr},
+                "deglobalified_ptr"
+            );
+
+            instr.setOperand(operandIndex, deglobalifyInvocationInstr);
+        } else {
+            // add a load which will get transformed by the load/store pass
+            LoadInst* load_instr = builder.CreateLoad(
+            gv->getType(), globalifyInvocationInstr, "globalified_ptr_loaded");
+
+            instr.setOperand(operandIndex, load_instr);
         }
+    } else {
+        instr.setOperand(operandIndex, globalifyInvocationInstr);
     }
-    return oneConstGlobalified;
 }
 
-static bool processBasicBlock(Module &m, IRBuilder<> &builder,
-                              Function *globalifyFunc, Function *deglobalifyFunc, BasicBlock &bb) {
+// Returns true for the constant expressions over globals that are rebuilt as instructions: GEPs
+// and icmps. so far, we only care about those. *there likely will be more.*
+static bool isLoweredConstantExpr(ConstantExpr *constExpr) {
+    if (constExpr->getOpcode() == Instruction::GetElementPtr) {
+        return true;
+    }
+    return constExpr->getOpcode() == Instruction::ICmp &&
+           (isa<GlobalVariable>(constExpr->getOperand(0)) || isa<GlobalVariable>(constExpr->getOperand(1)));
+}
+
+// Rebuilds operand `operandIndex` of instr, the constant GEP or icmp constExpr, as an instruction
+// over the globalified globals. the constexpr can contain references to globals.
+static void lowerConstantExpr(IRBuilder<> &builder, Function *globalifyFunc, Instruction &instr,
+                              unsigned operandIndex, ConstantExpr *constExpr) {
+    builder.SetInsertPoint(insertionPoint(instr, operandIndex));
+
+    if (constExpr->getOpcode() == Instruction::ICmp) {
+        Value* lhs = constExpr->getOperand(0);
+        Value* rhs = constExpr->getOperand(1);
+
+        if (isa<GlobalVariable>(lhs)) {
+            lhs = builder.CreateCall(globalifyFunc, {lhs}, "globalified_lhs");
+        }
+
+        if (isa<GlobalVariable>(rhs)) {
+            rhs = builder.CreateCall(globalifyFunc, {rhs}, "globalified_rhs");
+        }
+
+        Value* newInstr = builder.CreateICmp(
+            static_cast<ICmpInst::Predicate>(constExpr->getPredicate()),
+            lhs,
+            rhs,
+            "lowered_icmp"
+        );
+
+        instr.setOperand(operandIndex, newInstr);
+        return;
+    }
+
+    Value* gep_ptr = constExpr->getOperand(0);
+    if (isa<GlobalVariable>(gep_ptr)) {
+        gep_ptr = builder.CreateCall(globalifyFunc, {gep_ptr}, "globalified_gep_ptr");
+    }
+
+    std::vector<Value*> idxList;
+    for(uint64_t i = 1; i < constExpr->getNumOperands(); i++) {
+        idxList.push_back(constExpr->getOperand(i));
+    }
+
+    Type* gep_ptr_type = cast<GEPOperator>(constExpr)->getSourceElementType();
+    Value* newGepInstr = builder.CreateInBoundsGEP(gep_ptr_type, gep_ptr, idxList);
+
+    instr.setOperand(operandIndex, newGepInstr);
+}
+
+// Globalifies every use of gv by an instruction outside the runtime, directly or through a constant
+// GEP or icmp. Each use is visited once, and instructions that do not use a global are never looked at.
+// Reads of a replicated gv stay native.
+static bool processGlobal(IRBuilder<> &builder, Function *globalifyFunc, Function *deglobalifyFunc,
+                          const SiteProfile *profile, GlobalVariable &gv, bool replicated) {
     bool oneConstGlobalified = false;
-    for (Instruction &i : bb) {
-        oneConstGlobalified |= processInstruction(m, builder, globalifyFunc, deglobalifyFunc, i);
+
+    SmallVector<Use *, 16> worklist;
+    for (Use &use : gv.uses()) {
+        worklist.push_back(&use);
+    }
+
+    while (!worklist.empty()) {
+        Use *use = worklist.pop_back_val();
+        Value *operand = use->get();
+
+        // constant expressions are rebuilt where instructions use them
+        if (auto *constExpr = dyn_cast<ConstantExpr>(use->getUser())) {
+            if (isLoweredConstantExpr(constExpr)) {
+                for (Use &constExprUse : constExpr->uses()) {
+                    worklist.push_back(&constExprUse);
+                }
+            }
+            continue;
+        }
+
+        auto *instr = dyn_cast<Instruction>(use->getUser());
+        // the runtime's own globals (e.g. the test runtime's call counter) stay native
+        if (!instr || isPandoRuntimeFunction(instr->getFunction()->getName())) {
+            continue;
+        }
+
+        // already globalified, when an icmp or GEP over another global was lowered
+        if (auto *call = dyn_cast<CallInst>(instr); call && call->getCalledFunction() == globalifyFunc) {
+            continue;
+        }
+
+        // this node's copy of a replicated global is read directly
+        unsigned operandIndex = use->getOperandNo();
+        if (replicated && replicatedOperand(*instr, operandIndex)) {
+            oneConstGlobalified = true;
+            continue;
+        }
+
+        // the access stays native. the load-store pass leaves `pando.local` accesses alone.
+        if (profiledLocalOperand(profile, *instr) == int(operandIndex)) {
+            instr->setMetadata(LocalMetadata, MDNode::get(instr->getContext(), {}));
+            oneConstGlobalified = true;
+            continue;
+        }
+
+        // a use may be queued twice (e.g. `icmp eq (@g, @g)`), the first visit already rewrote it
+        if (auto *constExpr = dyn_cast<ConstantExpr>(operand)) {
+            lowerConstantExpr(builder, globalifyFunc, *instr, operandIndex, constExpr);
+            oneConstGlobalified = true;
+        } else if (operand == &gv && !gv.getName().empty()) {
+            // operand is a const global pointer. globalify it.
+            globalizeOperand(builder, globalifyFunc, deglobalifyFunc, *instr, operandIndex, &gv);
+            oneConstGlobalified = true;
+        }
     }
     return oneConstGlobalified;
 }
@@ -150,35 +361,42 @@ PreservedAnalyses run(Module &m, ModuleAnalysisManager &mam) {
     }
 
     Function *deglobalifyFunc = m.getFunction("deglobalify");
-    if (!globalifyFunc) {
+    if (!deglobalifyFunc) {
         errs() << "[GLOBALIZE PASS] -- deglobalify function not found. exiting early.\n";
         return PreservedAnalyses::all();
     }
 
     IRBuilder<> builder(m.getContext());
 
-    for (Function &f : m) {
-        if (f.getName() == "__pando__replace_load_int64" ||
-            f.getName() == "__pando__replace_load_int32" ||
-            f.getName() == "__pando__replace_load_int8" ||
-            f.getName() == "__pando__replace_load_float32" ||
-            f.getName() == "__pando__replace_load_ptr" ||
-            f.getName() == "__pando__replace_load_vector" ||
-            f.getName() == "__pando__replace_store_int64" ||
-            f.getName() == "__pando__replace_store_int32" ||
-            f.getName() == "__pando__replace_store_int8" ||
-            f.getName() == "__pando__replace_store_float32" ||
-            f.getName() == "__pando__replace_store_ptr" ||
-            f.getName() == "__pando__replace_store_vector" ||
-            f.getName() == "check_if_global" || 
-            f.getName() == "deglobalify" ||
-            f.getName() == "globalify") {
-            continue;
+    // sites are numbered before any instrumentation, so the load-store pass sees the same ids
+    SiteProfile siteProfile;
+    const SiteProfile *profile = nullptr;
+    if (!ProfileUse.empty() && siteProfile.load(ProfileUse, "GLOBALIZE PASS")) {
+        for (Function &f : m) {
+            if (!f.isDeclaration() && !isPandoRuntimeFunction(f.getName())) {
+                SiteProfile::assignSites(f);
+            }
         }
+        siteProfile.check(m, "GLOBALIZE PASS");
+        profile = &siteProfile;
+    }
 
-        for (BasicBlock &bb : f) {
-            oneConstGlobalified |= processBasicBlock(m, builder, globalifyFunc, deglobalifyFunc, bb);
+    for (GlobalVariable &gv : m.globals()) {
+        // decided before the uses are rewritten, which hides the reads and writes
+        bool replicated = isReplicated(gv);
+        if (replicated) {
+            gv.setMetadata(ReplicatedMetadata, MDNode::get(m.getContext(), {}));
         }
+        bool toSymHeap = !replicated && SymHeapGlobals && isSymHeapCandidate(gv);
+        if (toSymHeap) {
+            gv.setSection(SymHeapSection);
+        }
+        bool globalized = processGlobal(builder, globalifyFunc, deglobalifyFunc, profile, gv, replicated);
+        if (toSymHeap && !globalized) {
+            // only the runtime uses it (e.g. the test runtime's call counter)
+            gv.setSection("");
+        }
+        oneConstGlobalified |= globalized;
     }
 
     return oneConstGlobalified ? PreservedAnalyses::none()
@@ -200,6 +418,26 @@ extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo llvmGetPassPluginIn
                         mpm.addPass(GlobalizePass());
                         return true;
                     }
+                    if (name == "coalesce-pass") {
+                        mpm.addPass(CoalescePass());
+                        return true;
+                    }
+                    if (name == "clone-local-pass") {
+                        mpm.addPass(CloneLocalPass());
+                        return true;
+                    }
+                    if (name == "provenance-pass") {
+                        mpm.addPass(ProvenancePass());
+                        return true;
+                    }
+                    if (name == "ship-pass") {
+                        mpm.addPass(ShipPass());
+                        return true;
+                    }
+                    if (name == "globalize-cleanup-pass") {
+                        mpm.addPass(GlobalizeCleanupPass());
+                        return true;
+                    }
                     return false;
                 }
             );
@@ -0,0 +1,354 @@
+use std::collections::HashMap;
+use std::ffi::CStr;
+use std::fs;
+
+use llvm_plugin::inkwell::builder::Builder;
+use llvm_plugin::inkwell::context::ContextRef;
+use llvm_plugin::inkwell::module::{Linkage, Module};
+use llvm_plugin::inkwell::values::{
+  AsValueRef, BasicMetadataValueEnum, FunctionValue, InstructionOpcode, InstructionValue, IntValue, PointerValue,
+};
+use llvm_sys::core::{LLVMGetDebugLocFilename, LLVMGetDebugLocLine};
+
+use crate::utils::is_runtime_function;
+
+// metadata kind holding the site id of a load, store or alloca: !{i64 id}
+pub const SITE_METADATA: &str = "pando.site";
+// runtime entry points of the profile mode: begin returns a start time that end turns into the
+// access's latency
+pub const PROFILE_BEGIN_FUNC: &str = "__pando__profile_begin";
+pub const PROFILE_END_FUNC: &str = "__pando__profile_end";
+
+// 32-bit FNV-1a hash
+fn fnv1a32(bytes: &[u8]) -> u32 {
+  bytes
+    .iter()
+    .fold(0x811c_9dc5u32, |hash, byte| (hash ^ u32::from(*byte)).wrapping_mul(0x0100_0193))
+}
+
+// Site id of the `ordinal`-th load, store or alloca of function `function_name`. Ids stay the
+// same across builds as long as the function's accesses do.
+pub fn site_id(function_name: &str, ordinal: u32) -> u64 {
+  (u64::from(fnv1a32(function_name.as_bytes())) << 32) | u64::from(ordinal)
+}
+
+// splits a site id into its function hash and ordinal
+fn split_site_id(site: u64) -> (u32, u32) {
+  ((site >> 32) as u32, site as u32)
+}
+
+fn is_site(instr: InstructionValue) -> bool {
+  matches!(
+    instr.get_opcode(),
+    InstructionOpcode::Load | InstructionOpcode::Store | InstructionOpcode::Alloca
+  )
+}
+
+// the loads, stores and allocas of `f`, in site order
+fn sites<'ctx>(f: FunctionValue<'ctx>) -> impl Iterator<Item = InstructionValue<'ctx>> {
+  f.get_basic_block_iter().flat_map(|b| b.get_instructions()).filter(|instr| is_site(*instr))
+}
+
+// Numbers the loads, stores and allocas of `f` in order and records each id as `pando.site`
+// metadata. Sites numbered by an earlier pass keep their id.
+pub fn assign_sites(cx: &ContextRef, f: FunctionValue) {
+  let function_name = f.get_name().to_str().unwrap();
+  let site_kind = cx.get_kind_id(SITE_METADATA);
+
+  for (ordinal, instr) in sites(f).enumerate() {
+    if instr.get_metadata(site_kind).is_some() {
+      continue;
+    }
+    let id = cx.i64_type().const_int(site_id(function_name, ordinal as u32), false);
+    instr.set_metadata(cx.metadata_node(&[id.into()]), site_kind).unwrap();
+  }
+}
+
+// returns the site id recorded on `instr`
+pub fn site(instr: InstructionValue, site_kind: u32) -> Option<u64> {
+  match instr.get_metadata(site_kind)?.get_node_values().first()? {
+    BasicMetadataValueEnum::IntValue(id) => id.get_zero_extended_constant(),
+    _ => None,
+  }
+}
+
+// returns the source file and line of `instr` from its debug location
+fn source_location(instr: InstructionValue) -> Option<(String, u32)> {
+  let mut length = 0;
+  // SAFETY: both only read the instruction's debug location, the name stays owned by the module
+  let (file, line) = unsafe {
+    let file = LLVMGetDebugLocFilename(instr.as_value_ref(), &mut length);
+    (file, LLVMGetDebugLocLine(instr.as_value_ref()))
+  };
+  if file.is_null() || line == 0 {
+    return None;
+  }
+  let file = unsafe { CStr::from_ptr(file) }.to_string_lossy().into_owned();
+  Some((file, line))
+}
+
+// Emits the profiling calls around instrumented accesses
+pub struct Profiler<'ctx> {
+  begin_func: FunctionValue<'ctx>,
+  end_func: FunctionValue<'ctx>,
+  site_kind: u32,
+}
+
+impl<'ctx> Profiler<'ctx> {
+  pub fn new(module: &Module<'ctx>) -> Profiler<'ctx> {
+    let get_function = |name: &str| {
+      module.get_function(name).unwrap_or_else(|| {
+        println!("[LOAD-STORE PASS] the profile mode needs the runtime to define {}", name);
+        panic!("missing profile function")
+      })
+    };
+    Profiler {
+      begin_func: get_function(PROFILE_BEGIN_FUNC),
+      end_func: get_function(PROFILE_END_FUNC),
+      site_kind: module.get_context().get_kind_id(SITE_METADATA),
+    }
+  }
+
+  pub fn site(&self, instr: InstructionValue) -> Option<u64> {
+    site(instr, self.site_kind)
+  }
+
+  // Copies the site id of `access` to the instruction that replaced it
+  pub fn tag(&self, access: InstructionValue, replacement: InstructionValue) {
+    if let Some(node) = access.get_metadata(self.site_kind) {
+      replacement.set_metadata(node, self.site_kind).unwrap();
+    }
+  }
+
+  // Starts timing an access at the builder's position. Returns the start time for end().
+  pub fn begin(&self, builder: &Builder<'ctx>) -> IntValue<'ctx> {
+    builder
+      .build_direct_call(self.begin_func, &[], "profile_start")
+      .unwrap()
+      .try_as_basic_value()
+      .left()
+      .unwrap()
+      .into_int_value()
+  }
+
+  // Records an access of `bytes` at `addr` by the site of `access`, in function `function_name`,
+  // at the builder's position. Without a `start` no latency is recorded.
+  pub fn end(
+    &self,
+    module: &Module<'ctx>,
+    builder: &Builder<'ctx>,
+    access: InstructionValue<'ctx>,
+    function_name: &str,
+    start: Option<IntValue<'ctx>>,
+    addr: PointerValue<'ctx>,
+    bytes: IntValue<'ctx>,
+  ) {
+    let Some(site) = self.site(access) else {
+      return;
+    };
+    let cx = module.get_context();
+    let i64_type = cx.i64_type();
+    let location = self.location(module, site, function_name, access);
+    let call = builder
+      .build_direct_call(
+        self.end_func,
+        &[
+          i64_type.const_int(site, false).into(),
+          start.unwrap_or_else(|| i64_type.const_zero()).into(),
+          addr.into(),
+          bytes.into(),
+          location.into(),
+        ],
+        "",
+      )
+      .unwrap()
+      .try_as_basic_value()
+      .right()
+      .unwrap();
+    self.tag(access, call);
+  }
+
+  // Returns the constant "function,file,line" string describing site `site`, which the runtime
+  // writes next to the site's counters
+  fn location(
+    &self,
+    module: &Module<'ctx>,
+    site: u64,
+    function_name: &str,
+    access: InstructionValue<'ctx>,
+  ) -> PointerValue<'ctx> {
+    let name = format!("__pando__site.{:016x}", site);
+    if let Some(global) = module.get_global(&name) {
+      return global.as_pointer_value();
+    }
+
+    let (file, line) = source_location(access).unwrap_or_default();
+    let text = format!("{},{},{}", function_name, file, line);
+    let value = module.get_context().const_string(text.as_bytes(), true);
+    let global = module.add_global(value.get_type(), None, &name);
+    global.set_initializer(&value);
+    global.set_constant(true);
+    global.set_linkage(Linkage::Private);
+    global.set_unnamed_addr(true);
+    global.as_pointer_value()
+  }
+}
+
+// How a site behaved in the training runs of a profile
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum SiteClass {
+  // every access was to this node's memory
+  Local,
+  // most accesses went to other nodes
+  Remote,
+  // anything in between
+  Mixed,
+}
+
+// one line of a profile written by the GASNet runtime
+struct SiteCounts {
+  function: String,
+  line: u32,
+  local_hits: u64,
+  remote_hits: u64,
+}
+
+impl SiteCounts {
+  fn class(&self) -> SiteClass {
+    if self.remote_hits == 0 {
+      SiteClass::Local
+    } else if self.remote_hits > self.local_hits {
+      SiteClass::Remote
+    } else {
+      SiteClass::Mixed
+    }
+  }
+}
+
+// Per-site counts read from the `pando_profile.<rank>.csv` files of `load-store-pass<profile>`
+// runs, which guide `load-store-pass<profile-use=...>`
+pub struct SiteProfile {
+  sites: HashMap<u64, SiteCounts>,
+  site_kind: u32,
+}
+
+// parses `site,function,file,line,local_hits,remote_hits,bytes,latency_ns`. the file name may
+// hold commas, so the fields after it are taken from the end.
+fn parse_profile_line(line: &str) -> Option<(u64, SiteCounts)> {
+  let fields: Vec<&str> = line.trim().split(',').collect();
+  if fields.len() < 8 {
+    return None;
+  }
+  let site = u64::from_str_radix(fields[0].trim_start_matches("0x"), 16).ok()?;
+  let counts = SiteCounts {
+    function: fields[1].to_string(),
+    line: fields[fields.len() - 5].parse().ok()?,
+    local_hits: fields[fields.len() - 4].parse().ok()?,
+    remote_hits: fields[fields.len() - 3].parse().ok()?,
+  };
+  Some((site, counts))
+}
+
+impl SiteProfile {
+  // Reads a profile. The profiles of several ranks (or runs) may be concatenated into one file,
+  // their counts are summed.
+  pub fn load(module: &Module, path: &str) -> Result<SiteProfile, String> {
+    let text = fs::read_to_string(path).map_err(|error| format!("cannot read {}: {}", path, error))?;
+
+    let mut sites: HashMap<u64, SiteCounts> = HashMap::new();
+    for (number, line) in text.lines().enumerate() {
+      if line.is_empty() || line.starts_with("site,") {
+        continue;
+      }
+      let (site, counts) =
+        parse_profile_line(line).ok_or_else(|| format!("{}:{}: malformed profile line", path, number + 1))?;
+      match sites.get_mut(&site) {
+        Some(total) => {
+          total.local_hits += counts.local_hits;
+          total.remote_hits += counts.remote_hits;
+        },
+        None => {
+          sites.insert(site, counts);
+        },
+      }
+    }
+
+    Ok(SiteProfile {
+      sites,
+      site_kind: module.get_context().get_kind_id(SITE_METADATA),
+    })
+  }
+
+  // Returns how the site of `instr` behaved, or None if it was never reached in training
+  pub fn class(&self, instr: InstructionValue) -> Option<SiteClass> {
+    self.sites.get(&site(instr, self.site_kind)?).map(SiteCounts::class)
+  }
+
+  // Compares the profile against the (already numbered) sites of `module`, warning about
+  // functions that changed since the training runs. Their counts are dropped, so the function is
+  // instrumented as if it had no profile.
+  pub fn check(&mut self, module: &Module) {
+    let mut profiled = 0;
+    let mut missing = 0;
+
+    // the profiled sites of each function, so every function only looks at its own
+    let mut function_sites: HashMap<String, Vec<u64>> = HashMap::new();
+    for (site, counts) in &self.sites {
+      function_sites.entry(counts.function.clone()).or_default().push(*site);
+    }
+
+    for f in module.get_functions() {
+      let function_name = f.get_name().to_str().unwrap();
+      if is_runtime_function(function_name) || f.count_basic_blocks() == 0 {
+        continue;
+      }
+      let function_hash = fnv1a32(function_name.as_bytes());
+      let lines: Vec<u32> = sites(f).map(|instr| source_location(instr).map_or(0, |(_, line)| line)).collect();
+
+      let profiled_sites = function_sites.get(function_name).map_or(&[][..], Vec::as_slice);
+      let mut stale = Vec::new();
+      for site in profiled_sites {
+        let counts = &self.sites[site];
+        let (hash, ordinal) = split_site_id(*site);
+        let problem = if hash != function_hash {
+          Some("has an id of another function".to_string())
+        } else if ordinal as usize >= lines.len() {
+          Some(format!("is past the function's {} sites", lines.len()))
+        } else if counts.line != 0 && lines[ordinal as usize] != 0 && counts.line != lines[ordinal as usize] {
+          Some(format!("moved from line {} to {}", counts.line, lines[ordinal as usize]))
+        } else {
+          None
+        };
+        if let Some(problem) = problem {
+          println!(
+            "[LOAD-STORE PASS] profile: {} changed since profiling, site {:016x} {}",
+            function_name, site, problem
+          );
+          stale.push(*site);
+        }
+      }
+
+      if !stale.is_empty() {
+        for site in profiled_sites {
+          self.sites.remove(site);
+        }
+        continue;
+      }
+      for ordinal in 0..lines.len() {
+        if self.sites.contains_key(&site_id(function_name, ordinal as u32)) {
+          profiled += 1;
+        } else {
+          missing += 1;
+        }
+      }
+    }
+
+    if missing > 0 {
+      println!(
+        "[LOAD-STORE PASS] profile: {} of {} sites are missing from the profile",
+        missing,
+        profiled + missing
+      );
+    }
+  }
+}
@@ -0,0 +1,331 @@
+#include "pando_passes.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+
+#define DEBUG_TYPE "provenance"
+
+using namespace llvm;
+
+STATISTIC(NumAccessesLocal, "Number of loads and stores proven local");
+STATISTIC(NumAccessesGlobal, "Number of loads and stores proven to use a tagged address");
+STATISTIC(NumTransfersLocal, "Number of memory copies and fills proven local");
+
+namespace {
+
+// Where a pointer may point. None (no value reaches it yet) is below Local and Global, which are
+// below Unknown.
+enum class Provenance {
+    None,
+    Local,   // memory of this node: an untagged address, or one globalify tagged on this node
+    Global,  // a tagged address, of any node
+    Unknown, // anything, e.g. an untagged address of another node's memory
+};
+
+Provenance join(Provenance a, Provenance b) {
+    if (a == Provenance::None || a == b) {
+        return b;
+    }
+    return (b == Provenance::None) ? a : Provenance::Unknown;
+}
+
+// Propagates provenance through the module to a fixpoint, starting from what every node computes
+// itself: its globals and stack slots are local, globalify tags an address and loaded pointers come
+// back tagged from the load-store pass. Arguments of internal functions join their call sites'
+// values, and direct calls get the join of their callee's returns.
+class ProvenanceAnalysis {
+public:
+    explicit ProvenanceAnalysis(Module &m) {
+        for (Function &f : m) {
+            if (!f.isDeclaration() && !isPandoRuntimeFunction(f.getName())) {
+                tracked.insert(&f);
+                functions.push_back(&f);
+            }
+        }
+        for (const Function *f : functions) {
+            if (hasKnownCallers(*f)) {
+                knownCallers.insert(f);
+            }
+        }
+    }
+
+    void solve() {
+        for (Function *f : functions) {
+            if (!knownCallers.contains(f)) {
+                for (Argument &arg : f->args()) {
+                    if (arg.getType()->isPointerTy()) {
+                        raise(&arg, Provenance::Unknown);
+                    }
+                }
+            }
+            // values that never change (constants, allocas, globalify of globals) are seeded here
+            for (Instruction &instr : instructions(*f)) {
+                update(instr);
+            }
+        }
+
+        while (!worklist.empty()) {
+            Value *changed = worklist.pop_back_val();
+            for (User *user : changed->users()) {
+                auto *instr = dyn_cast<Instruction>(user);
+                if (instr && tracked.contains(instr->getFunction())) {
+                    update(*instr);
+                }
+            }
+        }
+    }
+
+    // Returns the provenance of ptr, a value of a tracked function or a constant
+    Provenance valueOf(const Value *ptr) const {
+        if (isa<Instruction>(ptr) || isa<Argument>(ptr)) {
+            auto found = state.find(ptr);
+            return (found != state.end()) ? found->second : Provenance::None;
+        }
+        return constantOf(ptr);
+    }
+
+    // Returns true if f is instrumented and its results are recorded
+    bool isTracked(Function &f) const {
+        return tracked.contains(&f);
+    }
+
+private:
+    // Returns true if every caller of f is known: f is internal and only called directly, with its
+    // own type, by tracked functions
+    bool hasKnownCallers(const Function &f) const {
+        if (!f.hasLocalLinkage()) {
+            return false;
+        }
+        for (const Use &use : f.uses()) {
+            auto *call = dyn_cast<CallBase>(use.getUser());
+            if (!call || !call->isCallee(&use) || call->getFunctionType() != f.getFunctionType() ||
+                !tracked.contains(call->getFunction())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Returns true if calls to f run the body in this module
+    bool hasKnownReturns(const Function &f) const {
+        return tracked.contains(&f) && !f.isInterposable();
+    }
+
+    static Provenance constantOf(const Value *ptr) {
+        if (isa<ConstantPointerNull>(ptr) || isa<UndefValue>(ptr)) {
+            return Provenance::None;
+        }
+        // globals moved to the symmetric heap are only valid through globalify
+        if (auto *gv = dyn_cast<GlobalVariable>(ptr)) {
+            return (gv->getSection() == SymHeapSection) ? Provenance::Unknown : Provenance::Local;
+        }
+        if (isa<GlobalValue>(ptr)) {
+            return Provenance::Local;
+        }
+        if (auto *constExpr = dyn_cast<ConstantExpr>(ptr)) {
+            switch (constExpr->getOpcode()) {
+                case Instruction::GetElementPtr:
+                case Instruction::BitCast:
+                case Instruction::AddrSpaceCast:
+                    return constantOf(constExpr->getOperand(0));
+            }
+        }
+        return Provenance::Unknown;
+    }
+
+    // Returns the provenance of the pointer computed by instr from the current state
+    Provenance transfer(const Instruction &instr) const {
+        if (isa<AllocaInst>(instr)) {
+            // native, or globalified on this node by the load-store pass
+            return Provenance::Local;
+        }
+        if (isa<LoadInst>(instr)) {
+            return Provenance::Global;
+        }
+        if (auto *gep = dyn_cast<GetElementPtrInst>(&instr)) {
+            return valueOf(gep->getPointerOperand());
+        }
+        if (isa<BitCastInst>(instr) || isa<AddrSpaceCastInst>(instr)) {
+            return valueOf(instr.getOperand(0));
+        }
+        if (auto *phi = dyn_cast<PHINode>(&instr)) {
+            Provenance result = Provenance::None;
+            for (const Value *incoming : phi->incoming_values()) {
+                result = join(result, valueOf(incoming));
+            }
+            return result;
+        }
+        if (auto *select = dyn_cast<SelectInst>(&instr)) {
+            return join(valueOf(select->getTrueValue()), valueOf(select->getFalseValue()));
+        }
+        if (auto *call = dyn_cast<CallBase>(&instr)) {
+            return callOf(*call);
+        }
+        return Provenance::Unknown;
+    }
+
+    Provenance callOf(const CallBase &call) const {
+        Function *callee = call.getCalledFunction();
+        if (!callee || call.getFunctionType() != callee->getFunctionType()) {
+            return Provenance::Unknown;
+        }
+        StringRef name = callee->getName();
+        if (name == "globalify") {
+            Provenance arg = valueOf(call.getArgOperand(0));
+            return (arg == Provenance::None || arg == Provenance::Local) ? arg : Provenance::Global;
+        }
+        // deglobalify and ptrmask strip this node's tag, which leaves other nodes' addresses invalid
+        if (name == "deglobalify" || callee->getIntrinsicID() == Intrinsic::ptrmask) {
+            Provenance arg = valueOf(call.getArgOperand(0));
+            return (arg == Provenance::None || arg == Provenance::Local) ? arg : Provenance::Unknown;
+        }
+        if (hasKnownReturns(*callee)) {
+            auto found = returns.find(callee);
+            return (found != returns.end()) ? found->second : Provenance::None;
+        }
+        return Provenance::Unknown;
+    }
+
+    // Raises the state of instr and of the arguments and returns it feeds
+    void update(Instruction &instr) {
+        if (instr.getType()->isPointerTy()) {
+            raise(&instr, transfer(instr));
+        }
+
+        if (auto *ret = dyn_cast<ReturnInst>(&instr)) {
+            Value *value = ret->getReturnValue();
+            Function &f = *instr.getFunction();
+            if (value && value->getType()->isPointerTy() && hasKnownReturns(f)) {
+                raiseReturn(f, valueOf(value));
+            }
+        } else if (auto *call = dyn_cast<CallBase>(&instr)) {
+            Function *callee = call->getCalledFunction();
+            if (callee && knownCallers.contains(callee)) {
+                for (Argument &arg : callee->args()) {
+                    if (arg.getType()->isPointerTy()) {
+                        raise(&arg, valueOf(call->getArgOperand(arg.getArgNo())));
+                    }
+                }
+            }
+        }
+    }
+
+    void raise(Value *value, Provenance provenance) {
+        Provenance &current = state[value];
+        Provenance joined = join(current, provenance);
+        if (joined != current) {
+            current = joined;
+            worklist.push_back(value);
+        }
+    }
+
+    // Raises the returns of f, and the direct calls to f with them
+    void raiseReturn(Function &f, Provenance provenance) {
+        Provenance &current = returns[&f];
+        Provenance joined = join(current, provenance);
+        if (joined == current) {
+            return;
+        }
+        current = joined;
+        for (User *user : f.users()) {
+            auto *call = dyn_cast<CallBase>(user);
+            if (call && call->getCalledFunction() == &f && tracked.contains(call->getFunction()) &&
+                call->getType()->isPointerTy()) {
+                raise(call, transfer(*call));
+            }
+        }
+    }
+
+    SmallVector<Function *, 32> functions;
+    SmallPtrSet<const Function *, 32> tracked;
+    // tracked functions whose arguments join their call sites' values
+    SmallPtrSet<const Function *, 32> knownCallers;
+    DenseMap<const Value *, Provenance> state;
+    DenseMap<const Function *, Provenance> returns;
+    SmallVector<Value *, 64> worklist;
+};
+
+// Leaves a copy or fill native when all its addresses are local: masks them and marks the call
+// `pando.local`, so the load-store pass does not lower it to the runtime. Returns true if it did.
+bool markLocalTransfer(const ProvenanceAnalysis &analysis, IRBuilder<> &builder, CallInst &call) {
+    SmallVector<unsigned, 2> ptrArgs;
+    for (unsigned i = 0; i < call.arg_size(); ++i) {
+        if (call.getArgOperand(i)->getType()->isPointerTy()) {
+            if (analysis.valueOf(call.getArgOperand(i)) != Provenance::Local) {
+                return false;
+            }
+            ptrArgs.push_back(i);
+        }
+    }
+
+    builder.SetInsertPoint(&call);
+    for (unsigned i : ptrArgs) {
+        call.setArgOperand(i, nativePointer(builder, call.getArgOperand(i)));
+    }
+    call.setMetadata(LocalMetadata, MDNode::get(call.getContext(), {}));
+    ++NumTransfersLocal;
+    return true;
+}
+
+} // end anonymous namespace
+
+PreservedAnalyses ProvenancePass::run(Module &m, ModuleAnalysisManager &) {
+    ProvenanceAnalysis analysis(m);
+    analysis.solve();
+
+    LLVMContext &ctx = m.getContext();
+    MDNode *emptyNode = MDNode::get(ctx, {});
+    IRBuilder<> builder(ctx);
+    bool changed = false;
+
+    for (Function &f : m) {
+        if (!analysis.isTracked(f)) {
+            continue;
+        }
+        for (Instruction &instr : instructions(f)) {
+            auto *call = dyn_cast<CallInst>(&instr);
+            if (call && isMemoryTransfer(*call) && !instr.hasMetadata(LocalMetadata)) {
+                changed |= markLocalTransfer(analysis, builder, *call);
+                continue;
+            }
+
+            Value *ptr = getLoadStorePointerOperand(&instr);
+            if (!ptr || instr.hasMetadata(LocalMetadata)) {
+                continue;
+            }
+
+            switch (analysis.valueOf(ptr)) {
+                case Provenance::Local: {
+                    // the access stays native. the address may still carry this node's tag.
+                    builder.SetInsertPoint(&instr);
+                    Value *native = nativePointer(builder, ptr);
+                    instr.setOperand(isa<LoadInst>(instr) ? LoadInst::getPointerOperandIndex()
+                                                          : StoreInst::getPointerOperandIndex(),
+                                     native);
+                    instr.setMetadata(LocalMetadata, emptyNode);
+                    ++NumAccessesLocal;
+                    changed = true;
+                    break;
+                }
+                case Provenance::Global:
+                    instr.setMetadata(GlobalMetadata, emptyNode);
+                    ++NumAccessesGlobal;
+                    changed = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
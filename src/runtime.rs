@@ -0,0 +1,129 @@
+use llvm_plugin::inkwell::module::Module;
+use llvm_plugin::inkwell::types::{AnyTypeEnum, BasicTypeEnum, VectorType};
+use llvm_plugin::inkwell::values::{BasicValueEnum, FunctionValue};
+
+// returns the name suffix of the by-value vector entry points for `vec_type`, e.g. v4i32
+fn vector_suffix(vec_type: VectorType) -> Option<String> {
+  let cx = vec_type.get_context();
+  let element = match vec_type.get_element_type() {
+    BasicTypeEnum::IntType(int_type) => format!("i{}", int_type.get_bit_width()),
+    BasicTypeEnum::FloatType(float_type) if float_type == cx.f32_type() => "f32".to_string(),
+    BasicTypeEnum::FloatType(float_type) if float_type == cx.f64_type() => "f64".to_string(),
+    _ => return None,
+  };
+  Some(format!("v{}{}", vec_type.get_size(), element))
+}
+
+// The runtime functions plain loads and stores are lowered to, looked up once per module
+pub struct RuntimeFunctions<'ctx> {
+  pub globalify: FunctionValue<'ctx>,
+  load_int64: FunctionValue<'ctx>,
+  load_int32: FunctionValue<'ctx>,
+  load_int8: FunctionValue<'ctx>,
+  load_float32: FunctionValue<'ctx>,
+  load_ptr: FunctionValue<'ctx>,
+  load_vector: FunctionValue<'ctx>,
+  store_int64: FunctionValue<'ctx>,
+  store_int32: FunctionValue<'ctx>,
+  store_int8: FunctionValue<'ctx>,
+  store_float32: FunctionValue<'ctx>,
+  store_ptr: FunctionValue<'ctx>,
+  store_vector: FunctionValue<'ctx>,
+}
+
+impl<'ctx> RuntimeFunctions<'ctx> {
+  pub fn new(module: &Module<'ctx>) -> RuntimeFunctions<'ctx> {
+    let get_function = |name: &str| {
+      module.get_function(name).unwrap_or_else(|| {
+        println!("[LOAD-STORE PASS] the runtime does not define {}", name);
+        panic!("missing runtime function")
+      })
+    };
+    RuntimeFunctions {
+      globalify: get_function("globalify"),
+      load_int64: get_function("__pando__replace_load_int64"),
+      load_int32: get_function("__pando__replace_load_int32"),
+      load_int8: get_function("__pando__replace_load_int8"),
+      load_float32: get_function("__pando__replace_load_float32"),
+      load_ptr: get_function("__pando__replace_load_ptr"),
+      load_vector: get_function("__pando__replace_load_vector"),
+      store_int64: get_function("__pando__replace_store_int64"),
+      store_int32: get_function("__pando__replace_store_int32"),
+      store_int8: get_function("__pando__replace_store_int8"),
+      store_float32: get_function("__pando__replace_store_float32"),
+      store_ptr: get_function("__pando__replace_store_ptr"),
+      store_vector: get_function("__pando__replace_store_vector"),
+    }
+  }
+
+  // returns the function loading a value of type `value_type`
+  pub fn load(&self, value_type: AnyTypeEnum<'ctx>) -> FunctionValue<'ctx> {
+    match value_type {
+      AnyTypeEnum::PointerType(_) => self.load_ptr,
+      AnyTypeEnum::IntType(int_type) => match int_type.get_bit_width() {
+        64 => self.load_int64,
+        32 => self.load_int32,
+        8 => self.load_int8,
+        _ => {
+          println!(
+            "[LOAD-STORE PASS] we are attempting to instrument a LOAD 
+            with a non-supported bit-width of {}. add this!", 
+            int_type.get_bit_width()
+          );
+          panic!("need to add new supported load behavior")
+        },
+      },
+      AnyTypeEnum::FloatType(_) => self.load_float32,
+      AnyTypeEnum::VectorType(_) => self.load_vector,
+      _ => self.load_int64,
+    }
+  }
+
+  // returns the variant of the runtime load/store `func` that skips the tag check, for addresses
+  // known to be tagged, or `func` itself if the runtime does not define one
+  pub fn unchecked(&self, module: &Module<'ctx>, func: FunctionValue<'ctx>) -> FunctionValue<'ctx> {
+    let name = format!("{}_nocheck", func.get_name().to_str().unwrap());
+    module.get_function(&name).unwrap_or(func)
+  }
+
+  // returns the function loading a `vec_type` by value (e.g. `__pando__replace_load_v4i32`), if the
+  // runtime defines one that returns the vector in registers
+  pub fn load_by_value(&self, module: &Module<'ctx>, vec_type: VectorType<'ctx>) -> Option<FunctionValue<'ctx>> {
+    let func = module.get_function(&format!("__pando__replace_load_{}", vector_suffix(vec_type)?))?;
+    let func_type = func.get_type();
+    (func_type.get_return_type() == Some(vec_type.into()) && func_type.count_param_types() == 1).then_some(func)
+  }
+
+  // returns the function storing a `vec_type` by value (e.g. `__pando__replace_store_v4i32`), if the
+  // runtime defines one that takes the vector in registers
+  pub fn store_by_value(&self, module: &Module<'ctx>, vec_type: VectorType<'ctx>) -> Option<FunctionValue<'ctx>> {
+    let func = module.get_function(&format!("__pando__replace_store_{}", vector_suffix(vec_type)?))?;
+    let value_type = func.get_nth_param(0).map(|param| param.get_type());
+    (value_type == Some(vec_type.into()) && func.count_params() == 2).then_some(func)
+  }
+
+  // returns the function storing `value`
+  pub fn store(&self, value: BasicValueEnum<'ctx>) -> FunctionValue<'ctx> {
+    match value {
+      BasicValueEnum::PointerValue(_) => self.store_ptr,
+      BasicValueEnum::IntValue(int_value) => match int_value.get_type().get_bit_width() {
+        64 => self.store_int64,
+        32 => self.store_int32,
+        8 => self.store_int8,
+        _ => {
+          println!(
+            "[LOAD-STORE PASS] we are attempting to instrument a STORE 
+            with a non-supported bit-width of {}. add this!", 
+            int_value.get_type().get_bit_width()
+          );
+          panic!("need to add new supported store behavior")
+        },
+      },
+      BasicValueEnum::FloatValue(_) => self.store_float32,
+      BasicValueEnum::VectorValue(_) => self.store_vector,
+      _ => {
+        panic!("Unreachable {:#?}", value)
+      },
+    }
+  }
+}
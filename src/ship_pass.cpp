@@ -0,0 +1,274 @@
+#include "pando_passes.h"
+
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include <string>
+
+#define DEBUG_TYPE "ship"
+
+using namespace llvm;
+
+static cl::list<std::string> ShipFunctions(
+    "pando-ship", cl::CommaSeparated,
+    cl::desc("Functions to run at the owner of their first pointer argument, in addition to "
+             "those annotated pando_ship"));
+
+STATISTIC(NumFunctionsShipped, "Number of functions run at the owner of their data");
+STATISTIC(NumCallsShipped, "Number of calls lowered to __pando__ship");
+
+namespace {
+
+// annotation (`__attribute__((annotate("pando_ship")))`) marking a function to ship
+constexpr const char *ShipAnnotation = "pando_ship";
+
+// 64-bit FNV-1a hash. Identifies a thunk across ranks, which may load the binary at different
+// addresses.
+uint64_t fnv1a64(StringRef bytes) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char byte : bytes) {
+        hash ^= byte;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Adds the functions annotated pando_ship (in llvm.global.annotations) to functions
+void collectAnnotated(Module &m, SmallSetVector<Function *, 8> &functions) {
+    GlobalVariable *annotations = m.getGlobalVariable("llvm.global.annotations");
+    if (!annotations || !annotations->hasInitializer()) {
+        return;
+    }
+    auto *entries = dyn_cast<ConstantArray>(annotations->getInitializer());
+    if (!entries) {
+        return;
+    }
+    // each entry is { function, annotation string, file, line, args }
+    for (Value *entry : entries->operands()) {
+        auto *fields = dyn_cast<ConstantStruct>(entry);
+        if (!fields || fields->getNumOperands() < 2) {
+            continue;
+        }
+        auto *f = dyn_cast<Function>(fields->getOperand(0)->stripPointerCasts());
+        auto *text = dyn_cast<GlobalVariable>(fields->getOperand(1)->stripPointerCasts());
+        if (!f || !text || !text->hasInitializer()) {
+            continue;
+        }
+        auto *data = dyn_cast<ConstantDataSequential>(text->getInitializer());
+        if (data && data->isCString() && data->getAsCString() == ShipAnnotation) {
+            functions.insert(f);
+        }
+    }
+}
+
+class Shipper {
+public:
+    Shipper(Module &m, Function *shipFunc, Function *registerFunc)
+        : m(m), dataLayout(m.getDataLayout()), shipFunc(shipFunc), registerFunc(registerFunc) {}
+
+    // Returns the argument whose owner runs f (its first pointer argument), or null if f cannot be
+    // shipped. Arguments passed in memory (byval, sret, ...) would point into the caller's stack.
+    static Argument *ownerArgument(Function &f) {
+        if (f.isDeclaration() || f.isVarArg() || isPandoRuntimeFunction(f.getName())) {
+            return nullptr;
+        }
+        Argument *owner = nullptr;
+        for (Argument &arg : f.args()) {
+            if (arg.hasPassPointeeByValueCopyAttr() || arg.hasStructRetAttr() ||
+                arg.hasAttribute(Attribute::InAlloca) || arg.hasAttribute(Attribute::Preallocated)) {
+                return nullptr;
+            }
+            if (!owner && arg.getType()->isPointerTy()) {
+                owner = &arg;
+            }
+        }
+        return owner;
+    }
+
+    // Lowers the direct calls to f into `__pando__ship`, which runs f at the owner of owner's
+    // address. Returns the number of calls lowered.
+    unsigned ship(Function &f, Argument &owner) {
+        SmallVector<CallInst *, 8> calls;
+        for (User *user : f.users()) {
+            auto *call = dyn_cast<CallInst>(user);
+            if (call && call->getCalledFunction() == &f && !call->isMustTailCall() &&
+                !isPandoRuntimeFunction(call->getFunction()->getName())) {
+                calls.push_back(call);
+            }
+        }
+        if (calls.empty()) {
+            return 0;
+        }
+
+        SmallVector<Type *, 8> argTypes;
+        for (Argument &arg : f.args()) {
+            argTypes.push_back(arg.getType());
+        }
+        StructType *argsType = StructType::get(m.getContext(), argTypes);
+        Function *thunk = createThunk(f, argsType);
+        thunks.push_back({fnv1a64(f.getName()), thunk});
+
+        for (CallInst *call : calls) {
+            lowerCall(*call, argsType, owner.getArgNo(), thunks.back());
+        }
+        return calls.size();
+    }
+
+    // Registers the thunks with the runtime from a module constructor, before main
+    void registerThunks() {
+        if (thunks.empty()) {
+            return;
+        }
+        LLVMContext &ctx = m.getContext();
+        Function *ctor = Function::Create(FunctionType::get(Type::getVoidTy(ctx), false),
+                                          GlobalValue::InternalLinkage, "pando.ship.register", m);
+        IRBuilder<> builder(BasicBlock::Create(ctx, "entry", ctor));
+        for (const Thunk &thunk : thunks) {
+            builder.CreateCall(registerFunc, {builder.getInt64(thunk.id), thunk.func});
+        }
+        builder.CreateRetVoid();
+        appendToGlobalCtors(m, ctor, 0);
+    }
+
+private:
+    struct Thunk {
+        uint64_t id;
+        Function *func;
+    };
+
+    static void markLocal(Instruction *instr) {
+        instr->setMetadata(LocalMetadata, MDNode::get(instr->getContext(), {}));
+    }
+
+    // Creates `void <name>.pando.thunk(ptr args, ptr result)`, which calls f with the arguments
+    // packed at args and stores its result at result. The buffers are local to the rank running
+    // the thunk but may be unaligned, since the runtime copies them out of messages.
+    Function *createThunk(Function &f, StructType *argsType) {
+        LLVMContext &ctx = m.getContext();
+        Type *ptrType = PointerType::getUnqual(ctx);
+        FunctionType *thunkType = FunctionType::get(Type::getVoidTy(ctx), {ptrType, ptrType}, false);
+        Function *thunk = Function::Create(thunkType, GlobalValue::InternalLinkage,
+                                           f.getName() + ".pando.thunk", m);
+        Argument *args = thunk->getArg(0);
+        Argument *result = thunk->getArg(1);
+        args->setName("args");
+        result->setName("result");
+
+        IRBuilder<> builder(BasicBlock::Create(ctx, "entry", thunk));
+        SmallVector<Value *, 8> callArgs;
+        for (unsigned i = 0; i < argsType->getNumElements(); ++i) {
+            Value *slot = builder.CreateStructGEP(argsType, args, i);
+            LoadInst *arg = builder.CreateAlignedLoad(argsType->getElementType(i), slot, Align(1));
+            markLocal(arg);
+            callArgs.push_back(arg);
+        }
+        CallInst *call = builder.CreateCall(&f, callArgs);
+        if (!f.getReturnType()->isVoidTy()) {
+            markLocal(builder.CreateAlignedStore(call, result, Align(1)));
+        }
+        builder.CreateRetVoid();
+        return thunk;
+    }
+
+    // Replaces call with `__pando__ship(id, thunk, owner, args, args_size, result, result_size)`,
+    // the arguments and result going through stack slots that stay native
+    void lowerCall(CallInst &call, StructType *argsType, unsigned ownerIndex, const Thunk &thunk) {
+        LLVMContext &ctx = m.getContext();
+        Function &caller = *call.getFunction();
+        Type *resultType = call.getType();
+
+        IRBuilder<> entryBuilder(&caller.getEntryBlock(), caller.getEntryBlock().getFirstInsertionPt());
+        AllocaInst *argsSlot = entryBuilder.CreateAlloca(argsType, nullptr, "ship_args");
+        markLocal(argsSlot);
+        AllocaInst *resultSlot = nullptr;
+        if (!resultType->isVoidTy()) {
+            resultSlot = entryBuilder.CreateAlloca(resultType, nullptr, "ship_result");
+            markLocal(resultSlot);
+        }
+
+        IRBuilder<> builder(&call);
+        for (unsigned i = 0; i < argsType->getNumElements(); ++i) {
+            Value *slot = builder.CreateStructGEP(argsType, argsSlot, i);
+            markLocal(builder.CreateStore(call.getArgOperand(i), slot));
+        }
+
+        Type *i64Type = builder.getInt64Ty();
+        Value *result = resultSlot ? static_cast<Value *>(resultSlot)
+                                   : ConstantPointerNull::get(PointerType::getUnqual(ctx));
+        uint64_t resultSize = resultSlot ? dataLayout.getTypeStoreSize(resultType).getFixedValue() : 0;
+        CallInst *ship = builder.CreateCall(shipFunc, {
+            builder.getInt64(thunk.id),
+            thunk.func,
+            call.getArgOperand(ownerIndex),
+            argsSlot,
+            ConstantInt::get(i64Type, dataLayout.getTypeAllocSize(argsType).getFixedValue()),
+            result,
+            ConstantInt::get(i64Type, resultSize),
+        });
+        ship->setDebugLoc(call.getDebugLoc());
+
+        if (resultSlot) {
+            LoadInst *value = builder.CreateLoad(resultType, resultSlot, "shipped");
+            markLocal(value);
+            call.replaceAllUsesWith(value);
+        }
+        call.eraseFromParent();
+    }
+
+    Module &m;
+    const DataLayout &dataLayout;
+    Function *shipFunc;
+    Function *registerFunc;
+    SmallVector<Thunk, 8> thunks;
+};
+
+} // end anonymous namespace
+
+PreservedAnalyses ShipPass::run(Module &m, ModuleAnalysisManager &) {
+    SmallSetVector<Function *, 8> functions;
+    collectAnnotated(m, functions);
+    for (const std::string &name : ShipFunctions) {
+        if (Function *f = m.getFunction(name)) {
+            functions.insert(f);
+        } else {
+            errs() << "[SHIP PASS] -- " << name << " not found in the module.\n";
+        }
+    }
+    if (functions.empty()) {
+        return PreservedAnalyses::all();
+    }
+
+    Function *shipFunc = m.getFunction("__pando__ship");
+    Function *registerFunc = m.getFunction("__pando__ship_register");
+    if (!shipFunc || !registerFunc) {
+        errs() << "[SHIP PASS] -- __pando__ship or __pando__ship_register not found. exiting early.\n";
+        return PreservedAnalyses::all();
+    }
+
+    Shipper shipper(m, shipFunc, registerFunc);
+    bool changed = false;
+    for (Function *f : functions) {
+        Argument *owner = Shipper::ownerArgument(*f);
+        if (!owner) {
+            errs() << "[SHIP PASS] -- " << f->getName()
+                   << " is not shipped: it needs a body, a pointer argument and no arguments passed in memory.\n";
+            continue;
+        }
+        if (unsigned numCalls = shipper.ship(*f, *owner)) {
+            ++NumFunctionsShipped;
+            NumCallsShipped += numCalls;
+            changed = true;
+        }
+    }
+    shipper.registerThunks();
+
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
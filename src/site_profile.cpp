@@ -0,0 +1,196 @@
+#include "pando_passes.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace {
+
+// 32-bit FNV-1a hash, the function half of a site id
+uint32_t fnv1a32(StringRef bytes) {
+    uint32_t hash = 0x811c9dc5;
+    for (unsigned char byte : bytes) {
+        hash = (hash ^ byte) * 0x01000193;
+    }
+    return hash;
+}
+
+uint64_t siteId(StringRef functionName, uint32_t ordinal) {
+    return (uint64_t(fnv1a32(functionName)) << 32) | ordinal;
+}
+
+bool isSite(const Instruction &instr) {
+    return isa<LoadInst>(instr) || isa<StoreInst>(instr) || isa<AllocaInst>(instr);
+}
+
+// returns the site id recorded on instr
+std::optional<uint64_t> siteOf(const Instruction &instr) {
+    MDNode *node = instr.getMetadata(SiteMetadata);
+    if (!node || node->getNumOperands() == 0) {
+        return std::nullopt;
+    }
+    if (auto *id = mdconst::dyn_extract<ConstantInt>(node->getOperand(0))) {
+        return id->getZExtValue();
+    }
+    return std::nullopt;
+}
+
+} // end anonymous namespace
+
+bool SiteProfile::load(StringRef path, StringRef passName) {
+    auto buffer = MemoryBuffer::getFile(path);
+    if (!buffer) {
+        errs() << "[" << passName << "] -- cannot read profile " << path << ": "
+               << buffer.getError().message() << ". instrumenting without it.\n";
+        return false;
+    }
+
+    // site,function,file,line,local_hits,remote_hits,bytes,latency_ns. the file name may hold
+    // commas, so the fields after it are taken from the end.
+    for (line_iterator line(**buffer); !line.is_at_eof(); ++line) {
+        if (line->starts_with("site,")) {
+            continue;
+        }
+
+        SmallVector<StringRef, 8> fields;
+        line->split(fields, ',');
+        uint64_t site = 0;
+        Counts counts;
+        StringRef siteField = fields[0];
+        siteField.consume_front("0x");
+        if (fields.size() < 8 || siteField.getAsInteger(16, site) ||
+            fields[fields.size() - 5].getAsInteger(10, counts.line) ||
+            fields[fields.size() - 4].getAsInteger(10, counts.localHits) ||
+            fields[fields.size() - 3].getAsInteger(10, counts.remoteHits)) {
+            errs() << "[" << passName << "] -- " << path << ":" << line.line_number()
+                   << ": malformed profile line. instrumenting without the profile.\n";
+            sites.clear();
+            return false;
+        }
+        counts.function = fields[1].str();
+
+        auto [entry, inserted] = sites.try_emplace(site, counts);
+        if (!inserted) {
+            entry->second.localHits += counts.localHits;
+            entry->second.remoteHits += counts.remoteHits;
+        }
+    }
+    return true;
+}
+
+void SiteProfile::assignSites(Function &f) {
+    LLVMContext &ctx = f.getContext();
+    Type *i64Type = Type::getInt64Ty(ctx);
+
+    uint32_t ordinal = 0;
+    for (Instruction &instr : instructions(f)) {
+        if (!isSite(instr)) {
+            continue;
+        }
+        if (!instr.getMetadata(SiteMetadata)) {
+            Constant *id = ConstantInt::get(i64Type, siteId(f.getName(), ordinal));
+            instr.setMetadata(SiteMetadata, MDNode::get(ctx, {ConstantAsMetadata::get(id)}));
+        }
+        ordinal++;
+    }
+}
+
+std::optional<SiteClass> SiteProfile::classify(const Instruction &instr) const {
+    std::optional<uint64_t> site = siteOf(instr);
+    if (!site) {
+        return std::nullopt;
+    }
+    auto entry = sites.find(*site);
+    if (entry == sites.end()) {
+        return std::nullopt;
+    }
+
+    const Counts &counts = entry->second;
+    if (counts.remoteHits == 0) {
+        return SiteClass::Local;
+    }
+    return counts.remoteHits > counts.localHits ? SiteClass::Remote : SiteClass::Mixed;
+}
+
+void SiteProfile::check(Module &m, StringRef passName) {
+    unsigned profiled = 0;
+    unsigned missing = 0;
+
+    // the profiled sites of each function, so every function only looks at its own
+    StringMap<SmallVector<uint64_t, 8>> functionSites;
+    for (const auto &[site, counts] : sites) {
+        functionSites[counts.function].push_back(site);
+    }
+
+    for (Function &f : m) {
+        if (f.isDeclaration() || isPandoRuntimeFunction(f.getName())) {
+            continue;
+        }
+
+        SmallVector<unsigned, 32> lines;
+        for (Instruction &instr : instructions(f)) {
+            if (isSite(instr)) {
+                lines.push_back(instr.getDebugLoc() ? instr.getDebugLoc().getLine() : 0);
+            }
+        }
+
+        auto profiledSites = functionSites.find(f.getName());
+        if (profiledSites == functionSites.end()) {
+            missing += lines.size();
+            continue;
+        }
+
+        SmallVector<uint64_t, 4> staleSites;
+        for (uint64_t site : profiledSites->second) {
+            const Counts &counts = sites.find(site)->second;
+            uint32_t hash = site >> 32;
+            uint32_t ordinal = uint32_t(site);
+
+            std::string problem;
+            raw_string_ostream os(problem);
+            if (hash != fnv1a32(f.getName())) {
+                os << "has an id of another function";
+            } else if (ordinal >= lines.size()) {
+                os << "is past the function's " << lines.size() << " sites";
+            } else if (counts.line != 0 && lines[ordinal] != 0 && counts.line != lines[ordinal]) {
+                os << "moved from line " << counts.line << " to " << lines[ordinal];
+            } else {
+                continue;
+            }
+            errs() << "[" << passName << "] -- profile: " << f.getName()
+                   << " changed since profiling, site " << format_hex_no_prefix(site, 16) << " "
+                   << os.str() << "\n";
+            staleSites.push_back(site);
+        }
+
+        if (!staleSites.empty()) {
+            // the function's other counts no longer line up with its sites either
+            for (uint64_t site : profiledSites->second) {
+                sites.erase(site);
+            }
+            continue;
+        }
+        for (uint32_t ordinal = 0; ordinal < lines.size(); ordinal++) {
+            if (sites.count(siteId(f.getName(), ordinal))) {
+                profiled++;
+            } else {
+                missing++;
+            }
+        }
+    }
+
+    if (missing > 0) {
+        errs() << "[" << passName << "] -- profile: " << missing << " of " << (profiled + missing)
+               << " sites are missing from the profile\n";
+    }
+}
@@ -0,0 +1,78 @@
+use llvm_plugin::inkwell::values::{InstructionOpcode, InstructionValue};
+use llvm_plugin::inkwell::AtomicOrdering;
+
+use crate::utils::{called_function_name, operand_instruction};
+
+// runtime entry points of a split-phase load: the issue returns a handle that the wait consumes
+pub const LOAD_ISSUE_FUNC: &str = "__pando__load_issue";
+pub const LOAD_WAIT_PREFIX: &str = "__pando__load_wait_";
+
+// returns the wait function matching the blocking runtime load `runtime_name`,
+// e.g. __pando__replace_load_int64 -> __pando__load_wait_int64
+pub fn wait_func_name(runtime_name: &str) -> Option<String> {
+  runtime_name
+    .strip_prefix("__pando__replace_load_")
+    .map(|suffix| format!("{}{}", LOAD_WAIT_PREFIX, suffix))
+}
+
+// plain (non-volatile, non-atomic) loads and stores
+fn is_simple_access(instr: InstructionValue) -> bool {
+  instr.get_volatile() == Ok(false)
+    && matches!(instr.get_atomic_ordering(), Ok(AtomicOrdering::NotAtomic))
+}
+
+// returns true if a load can be issued ahead of `instr`, i.e. `instr` does not write memory,
+// order memory, or start the block
+fn can_issue_past(instr: InstructionValue) -> bool {
+  match instr.get_opcode() {
+    // native loads only read memory
+    InstructionOpcode::Load => is_simple_access(instr),
+    InstructionOpcode::Call => match called_function_name(instr) {
+      // the tag functions and other remote loads do not write program memory
+      Some(name) => {
+        name == "globalify"
+          || name == "deglobalify"
+          || name == "check_if_global"
+          || name == LOAD_ISSUE_FUNC
+          || name.starts_with(LOAD_WAIT_PREFIX)
+          || name.starts_with("__pando__replace_load_")
+          || name.starts_with("__pando__fast_load_")
+          || name.starts_with("llvm.dbg.")
+      },
+      None => false,
+    },
+    InstructionOpcode::Store
+    | InstructionOpcode::Fence
+    | InstructionOpcode::AtomicRMW
+    | InstructionOpcode::AtomicCmpXchg
+    | InstructionOpcode::VAArg
+    | InstructionOpcode::Invoke
+    | InstructionOpcode::CallBr
+    | InstructionOpcode::Phi
+    | InstructionOpcode::LandingPad
+    | InstructionOpcode::CatchPad
+    | InstructionOpcode::CleanupPad => false,
+    _ => true,
+  }
+}
+
+// Returns the earliest instruction of the load's block that the issue of `load` can be placed
+// before: below the definition of its address and below anything that may write memory.
+// Returns None if the issue would land right before the load (e.g. the address is the result of
+// the previous load, as in pointer chasing), so there is nothing to overlap with.
+pub fn issue_point<'ctx>(load: InstructionValue<'ctx>) -> Option<InstructionValue<'ctx>> {
+  if !is_simple_access(load) {
+    return None;
+  }
+
+  let address = operand_instruction(load, 0);
+  let mut point = load;
+  while let Some(prev) = point.get_previous_instruction() {
+    if Some(prev) == address || !can_issue_past(prev) {
+      break;
+    }
+    point = prev;
+  }
+
+  (point != load).then_some(point)
+}
@@ -0,0 +1,80 @@
+use llvm_plugin::inkwell::builder::Builder;
+use llvm_plugin::inkwell::context::ContextRef;
+use llvm_plugin::inkwell::types::BasicTypeEnum;
+use llvm_plugin::inkwell::values::{AnyValueEnum, BasicValue, BasicValueEnum, FunctionValue, InstructionOpcode, InstructionValue, PointerValue};
+use either::Either;
+
+// metadata kind marking an access (or alloca) the load-store pass must leave native
+pub const LOCAL_METADATA: &str = "pando.local";
+
+// metadata kind marking an access whose address is known to carry a tag (see `provenance-pass`)
+pub const GLOBAL_METADATA: &str = "pando.global";
+
+// returns the instruction behind a use's user, if the user is an instruction
+pub fn user_instruction(user: AnyValueEnum) -> Option<InstructionValue> {
+  match user {
+    AnyValueEnum::InstructionValue(instr) => Some(instr),
+    AnyValueEnum::PhiValue(phi) => Some(phi.as_instruction()),
+    other => BasicValueEnum::try_from(other).ok().and_then(|value| value.as_instruction_value()),
+  }
+}
+
+// returns the instruction behind operand `index`, if that operand is an instruction
+pub fn operand_instruction<'ctx>(instr: InstructionValue<'ctx>, index: u32) -> Option<InstructionValue<'ctx>> {
+  match instr.get_operand(index)? {
+    Either::Left(value) => value.as_instruction_value(),
+    Either::Right(_) => None,
+  }
+}
+
+// returns the name of the function called by a direct call or invoke (the callee is the last operand)
+pub fn called_function_name(instr: InstructionValue) -> Option<String> {
+  if !matches!(instr.get_opcode(), InstructionOpcode::Call | InstructionOpcode::Invoke) {
+    return None;
+  }
+
+  match instr.get_operand(instr.get_num_operands() - 1)? {
+    Either::Left(BasicValueEnum::PointerValue(callee)) => {
+      let name = callee.get_name().to_str().ok()?;
+      (!name.is_empty()).then(|| name.to_string())
+    },
+    _ => None,
+  }
+}
+
+// returns true if `instr` carries the metadata kind `kind_id`
+pub fn has_metadata(instr: InstructionValue, kind_id: u32) -> bool {
+  instr.get_metadata(kind_id).is_some()
+}
+
+// returns true for the runtime's address-tag functions and `__pando__` entry points, whose
+// loads/stores are never instrumented
+pub fn is_runtime_function(name: &str) -> bool {
+  name.starts_with("__pando__") || name == "check_if_global" || name == "deglobalify" || name == "globalify"
+}
+
+// Returns the entry-block stack slot of `f` that values of `slot_type` are spilled to for the
+// runtime, creating it on first use. A slot at each access would be one more alloca per access, and
+// in a loop block one more per iteration.
+pub fn scratch_slot<'ctx>(
+  cx: &ContextRef<'ctx>,
+  builder: &Builder<'ctx>,
+  f: FunctionValue<'ctx>,
+  slots: &mut Vec<(BasicTypeEnum<'ctx>, PointerValue<'ctx>)>,
+  slot_type: BasicTypeEnum<'ctx>,
+) -> PointerValue<'ctx> {
+  if let Some((_, slot)) = slots.iter().find(|(existing, _)| *existing == slot_type) {
+    return *slot;
+  }
+
+  let entry_block = f.get_first_basic_block().unwrap();
+  match entry_block.get_first_instruction() {
+    Some(first_instr) => builder.position_before(&first_instr),
+    None => builder.position_at_end(entry_block),
+  }
+  let slot = builder.build_alloca(slot_type, "scratch").unwrap();
+  // the runtime reads and writes it natively
+  slot.as_instruction().unwrap().set_metadata(cx.metadata_node(&[]), cx.get_kind_id(LOCAL_METADATA)).unwrap();
+  slots.push((slot_type, slot));
+  slot
+}
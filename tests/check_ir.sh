@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# usage: ./check_ir.sh <ir file> [-f <function>] [-n] <pattern>... [-f <function> ...]
+#
+# checks the output of a pass: fails unless every pattern (an extended regex) matches a line of the
+# ir file. a pattern after `-n` must match no line instead. patterns after `-f <function>` only
+# look at the definition of that function.
+
+file="$1"
+shift
+
+scope="$file"
+text=$(cat "$file")
+ret=0
+while [[ $# -gt 0 ]];
+do
+    if [[ "$1" == "-f" ]]; then
+        scope="$file (@$2)"
+        text=$(awk -v name="@$2(" 'index($0, "define ") == 1 && index($0, name) { body = 1 } body { print } /^}/ { body = 0 }' "$file")
+        if [[ -z "$text" ]]; then
+            echo "$file: missing function @$2"
+            ret=1
+        fi
+        shift 2
+        continue
+    fi
+
+    if [[ "$1" == "-n" ]]; then
+        if grep -qE -- "$2" <<< "$text"; then
+            echo "$scope: unexpected '$2'"
+            ret=1
+        fi
+        shift 2
+        continue
+    fi
+
+    pattern="$1"
+    shift
+    if ! grep -qE -- "$pattern" <<< "$text"; then
+        echo "$scope: missing '$pattern'"
+        ret=1
+    fi
+done
+
+if [[ $ret -eq 0 ]]; then
+    echo "$file" passed
+fi
+exit $ret
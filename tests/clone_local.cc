@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <stdint.h>
+
+// `make test_clone_local` checks that clone-local-pass gives the hot leaf function sum a
+// `.pando.local` clone, which sum calls when its pointer argument is local
+extern "C" __attribute__((noinline)) int64_t sum(int64_t *values, int64_t n) {
+  int64_t total = 0;
+  for (int64_t i = 0; i < n; i++) {
+    total += values[i];
+  }
+  return total;
+}
+
+int main(int argc, char **argv) {
+  int64_t values[8];
+  for (int64_t i = 0; i < 8; i++) {
+    values[i] = i * argc;
+  }
+  // the length changes with every call, so the call stays in the loop
+  int64_t total = 0;
+  for (int64_t i = 0; i < 100; i++) {
+    total += sum(values, i % 8 + 1);
+  }
+  printf("total: %lld\n", (long long) total);
+}
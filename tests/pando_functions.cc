@@ -1,103 +1,573 @@
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+// every runtime call prints a trace, which the tests compare against the expected output.
+// benchmarks build with -DPANDO_QUIET, which counts the calls instead.
+static uint64_t num_calls = 0;
+#ifdef PANDO_QUIET
+#define TRACE(message) ((void) num_calls++)
+#else
+#define TRACE(message) printf(message)
+#endif
+
 extern "C" {
 
+// address tag of this node's global addresses. the load-store pass's fast path
+// compares against this inline instead of calling check_if_global.
+uint64_t __pando__local_tag = 0xFFFF;
+
 int check_if_global(void* ptr) {
-  printf("   >> check_if_global() invoked\n");
+  TRACE("   >> check_if_global() invoked\n");
   uintptr_t p = (uintptr_t) ptr;
   return (p >> 48) == 0xFFFF;
 }
 
 void* deglobalify(void* ptr) {
-  printf("   >> deglobalify() invoked\n");
+  TRACE("   >> deglobalify() invoked\n");
   uintptr_t p = (uintptr_t) ptr;
   uintptr_t mask = ((uintptr_t)0xFFFF) << 48;
   return (void *) (p & ~mask);
 }
 
+// an address that already carries a tag is left unchanged
 void* globalify(void* ptr) {
-  printf("   >> globalify() invoked\n");
+  TRACE("   >> globalify() invoked\n");
   uintptr_t p = (uintptr_t) ptr;
+  if ((p >> 48) != 0x0) {
+    return ptr;
+  }
   uintptr_t mask = ((uintptr_t)0xFFFF) << 48;
   return (void *) (p | mask);
 }
 
 void __pando__replace_store_int64(uint64_t val, uint64_t* dst) {
-  printf("   >> __pando__replace_store_int64() invoked\n");
+  TRACE("   >> __pando__replace_store_int64() invoked\n");
   assert(check_if_global(dst));
   *(uint64_t*) deglobalify(dst) = val;
 }
 
 void __pando__replace_store_int32(uint32_t val, uint32_t* dst) {
-  printf("   >> __pando__replace_store_int32() invoked\n");
+  TRACE("   >> __pando__replace_store_int32() invoked\n");
   assert(check_if_global(dst));
   *(uint32_t*) deglobalify(dst) = val;
 }
 
 void __pando__replace_store_int8(uint8_t val, uint8_t* dst) {
-  printf("   >> __pando__replace_store_int8() invoked\n");
+  TRACE("   >> __pando__replace_store_int8() invoked\n");
   assert(check_if_global(dst));
   *(uint8_t*) deglobalify(dst) = val;
 }
 
 void __pando__replace_store_float32(float val, float* dst) {
-  printf("   >> __pando__replace_store_float32() invoked\n");
+  TRACE("   >> __pando__replace_store_float32() invoked\n");
   assert(check_if_global(dst));
   *(float*) deglobalify(dst) = val;
 }
 
 void __pando__replace_store_ptr(void* val, void** dst) {
-  printf("   >> __pando__replace_store_ptr() invoked\n");
+  TRACE("   >> __pando__replace_store_ptr() invoked\n");
   assert(check_if_global(dst));
   *(void**) deglobalify(dst) = val;
 }
 
 void __pando__replace_store_vector(void* val, void* dst, size_t element_size,
                                    size_t num_elements) {
-  printf("  >> __pando__replace_store_vector invoked\n");
+  TRACE("  >> __pando__replace_store_vector invoked\n");
   assert(check_if_global(dst));
   memcpy(deglobalify(dst), val, element_size * num_elements);
 }
 
 uint64_t __pando__replace_load_int64(uint64_t* src) {
-  printf("   >> __pando__replace_load_int64() invoked\n");
+  TRACE("   >> __pando__replace_load_int64() invoked\n");
   assert(check_if_global(src));
   return *(uint64_t*) deglobalify(src);
 }
 
 uint32_t __pando__replace_load_int32(uint32_t* src) {
-  printf("   >> __pando__replace_load_int32() invoked\n");
+  TRACE("   >> __pando__replace_load_int32() invoked\n");
   assert(check_if_global(src));
   return *(uint32_t*) deglobalify(src);
 }
 
 uint8_t __pando__replace_load_int8(uint8_t* src) {
-  printf("   >> __pando__replace_load_int8() invoked\n");
+  TRACE("   >> __pando__replace_load_int8() invoked\n");
   assert(check_if_global(src));
   return *(uint8_t*) deglobalify(src);
 }
 
 float __pando__replace_load_float32(float* src) {
-  printf("   >> __pando__replace_load_float32() invoked\n");
+  TRACE("   >> __pando__replace_load_float32() invoked\n");
   assert(check_if_global(src));
   return *(float*) deglobalify(src);
 }
 
 void* __pando__replace_load_ptr(void** src) {
-  printf("   >> __pando__replace_load_ptr() invoked\n");
+  TRACE("   >> __pando__replace_load_ptr() invoked\n");
   assert(check_if_global(src));
   return globalify(*(uint64_t**) deglobalify(src));
 }
 
 void* __pando__replace_load_vector(void* src, size_t element_size, 
                                    size_t num_elements) {
-  printf("  >> __pando__replace_load_vector invoked\n");
+  TRACE("  >> __pando__replace_load_vector invoked\n");
+  assert(check_if_global(src));
+  // copy into a scratch buffer like a remote load would. the pass loads the
+  // vector from it right after the call.
+  alignas(64) static thread_local char scratch[256];
+  assert(element_size * num_elements <= sizeof(scratch));
+  memcpy(scratch, deglobalify(src), element_size * num_elements);
+  return scratch;
+}
+
+// vectors passed by value, in SIMD registers. the load-store pass calls these for the widths
+// defined here and falls back to the buffer functions above for the others.
+typedef int8_t v16i8 __attribute__((vector_size(16)));
+typedef int16_t v8i16 __attribute__((vector_size(16)));
+typedef int32_t v4i32 __attribute__((vector_size(16)));
+typedef int64_t v2i64 __attribute__((vector_size(16)));
+typedef float v4f32 __attribute__((vector_size(16)));
+typedef double v2f64 __attribute__((vector_size(16)));
+
+v16i8 __pando__replace_load_v16i8(v16i8* src) {
+  TRACE("   >> __pando__replace_load_v16i8() invoked\n");
+  assert(check_if_global(src));
+  v16i8 val;
+  memcpy(&val, deglobalify(src), sizeof(val));
+  return val;
+}
+
+void __pando__replace_store_v16i8(v16i8 val, v16i8* dst) {
+  TRACE("   >> __pando__replace_store_v16i8() invoked\n");
+  assert(check_if_global(dst));
+  memcpy(deglobalify(dst), &val, sizeof(val));
+}
+
+v8i16 __pando__replace_load_v8i16(v8i16* src) {
+  TRACE("   >> __pando__replace_load_v8i16() invoked\n");
+  assert(check_if_global(src));
+  v8i16 val;
+  memcpy(&val, deglobalify(src), sizeof(val));
+  return val;
+}
+
+void __pando__replace_store_v8i16(v8i16 val, v8i16* dst) {
+  TRACE("   >> __pando__replace_store_v8i16() invoked\n");
+  assert(check_if_global(dst));
+  memcpy(deglobalify(dst), &val, sizeof(val));
+}
+
+v4i32 __pando__replace_load_v4i32(v4i32* src) {
+  TRACE("   >> __pando__replace_load_v4i32() invoked\n");
+  assert(check_if_global(src));
+  v4i32 val;
+  memcpy(&val, deglobalify(src), sizeof(val));
+  return val;
+}
+
+void __pando__replace_store_v4i32(v4i32 val, v4i32* dst) {
+  TRACE("   >> __pando__replace_store_v4i32() invoked\n");
+  assert(check_if_global(dst));
+  memcpy(deglobalify(dst), &val, sizeof(val));
+}
+
+v2i64 __pando__replace_load_v2i64(v2i64* src) {
+  TRACE("   >> __pando__replace_load_v2i64() invoked\n");
+  assert(check_if_global(src));
+  v2i64 val;
+  memcpy(&val, deglobalify(src), sizeof(val));
+  return val;
+}
+
+void __pando__replace_store_v2i64(v2i64 val, v2i64* dst) {
+  TRACE("   >> __pando__replace_store_v2i64() invoked\n");
+  assert(check_if_global(dst));
+  memcpy(deglobalify(dst), &val, sizeof(val));
+}
+
+v4f32 __pando__replace_load_v4f32(v4f32* src) {
+  TRACE("   >> __pando__replace_load_v4f32() invoked\n");
+  assert(check_if_global(src));
+  v4f32 val;
+  memcpy(&val, deglobalify(src), sizeof(val));
+  return val;
+}
+
+void __pando__replace_store_v4f32(v4f32 val, v4f32* dst) {
+  TRACE("   >> __pando__replace_store_v4f32() invoked\n");
+  assert(check_if_global(dst));
+  memcpy(deglobalify(dst), &val, sizeof(val));
+}
+
+v2f64 __pando__replace_load_v2f64(v2f64* src) {
+  TRACE("   >> __pando__replace_load_v2f64() invoked\n");
+  assert(check_if_global(src));
+  v2f64 val;
+  memcpy(&val, deglobalify(src), sizeof(val));
+  return val;
+}
+
+void __pando__replace_store_v2f64(v2f64 val, v2f64* dst) {
+  TRACE("   >> __pando__replace_store_v2f64() invoked\n");
+  assert(check_if_global(dst));
+  memcpy(deglobalify(dst), &val, sizeof(val));
+}
+
+// loads and stores through addresses the provenance pass proved tagged (`pando.global`), which
+// skip check_if_global
+
+void __pando__replace_store_int64_nocheck(uint64_t val, uint64_t* dst) {
+  TRACE("   >> __pando__replace_store_int64_nocheck() invoked\n");
+  *(uint64_t*) deglobalify(dst) = val;
+}
+
+void __pando__replace_store_int32_nocheck(uint32_t val, uint32_t* dst) {
+  TRACE("   >> __pando__replace_store_int32_nocheck() invoked\n");
+  *(uint32_t*) deglobalify(dst) = val;
+}
+
+void __pando__replace_store_int8_nocheck(uint8_t val, uint8_t* dst) {
+  TRACE("   >> __pando__replace_store_int8_nocheck() invoked\n");
+  *(uint8_t*) deglobalify(dst) = val;
+}
+
+void __pando__replace_store_float32_nocheck(float val, float* dst) {
+  TRACE("   >> __pando__replace_store_float32_nocheck() invoked\n");
+  *(float*) deglobalify(dst) = val;
+}
+
+void __pando__replace_store_ptr_nocheck(void* val, void** dst) {
+  TRACE("   >> __pando__replace_store_ptr_nocheck() invoked\n");
+  *(void**) deglobalify(dst) = val;
+}
+
+uint64_t __pando__replace_load_int64_nocheck(uint64_t* src) {
+  TRACE("   >> __pando__replace_load_int64_nocheck() invoked\n");
+  return *(uint64_t*) deglobalify(src);
+}
+
+uint32_t __pando__replace_load_int32_nocheck(uint32_t* src) {
+  TRACE("   >> __pando__replace_load_int32_nocheck() invoked\n");
+  return *(uint32_t*) deglobalify(src);
+}
+
+uint8_t __pando__replace_load_int8_nocheck(uint8_t* src) {
+  TRACE("   >> __pando__replace_load_int8_nocheck() invoked\n");
+  return *(uint8_t*) deglobalify(src);
+}
+
+float __pando__replace_load_float32_nocheck(float* src) {
+  TRACE("   >> __pando__replace_load_float32_nocheck() invoked\n");
+  return *(float*) deglobalify(src);
+}
+
+void* __pando__replace_load_ptr_nocheck(void** src) {
+  TRACE("   >> __pando__replace_load_ptr_nocheck() invoked\n");
+  return globalify(*(uint64_t**) deglobalify(src));
+}
+
+// split-phase loads: the issue reads the value into a handle that the matching wait consumes
+void* __pando__load_issue(void* src, size_t n) {
+  TRACE("   >> __pando__load_issue() invoked\n");
   assert(check_if_global(src));
-  // later, if not local, we will need to allocate memory 
-  // and actually do the remote load.
-  return deglobalify(src);
+  assert(n <= sizeof(uint64_t));
+  uint64_t* handle = (uint64_t*) malloc(sizeof(uint64_t));
+  memcpy(handle, deglobalify(src), n);
+  return handle;
+}
+
+uint64_t __pando__load_wait_int64(void* handle) {
+  uint64_t val;
+  memcpy(&val, handle, sizeof(val));
+  free(handle);
+  return val;
+}
+
+uint32_t __pando__load_wait_int32(void* handle) {
+  uint32_t val;
+  memcpy(&val, handle, sizeof(val));
+  free(handle);
+  return val;
+}
+
+uint8_t __pando__load_wait_int8(void* handle) {
+  uint8_t val;
+  memcpy(&val, handle, sizeof(val));
+  free(handle);
+  return val;
+}
+
+float __pando__load_wait_float32(void* handle) {
+  float val;
+  memcpy(&val, handle, sizeof(val));
+  free(handle);
+  return val;
+}
+
+void* __pando__load_wait_ptr(void* handle) {
+  void* val;
+  memcpy(&val, handle, sizeof(val));
+  free(handle);
+  return globalify(val);
+}
+
+} // extern "C"
+
+// atomicrmw operations, numbered like the `op` argument the load-store pass passes
+// (11 is cmpxchg in the GASNet runtime)
+enum AtomicOp : uint32_t {
+  ATOMIC_XCHG, ATOMIC_ADD, ATOMIC_SUB, ATOMIC_AND, ATOMIC_NAND, ATOMIC_OR,
+  ATOMIC_XOR, ATOMIC_MAX, ATOMIC_MIN, ATOMIC_UMAX, ATOMIC_UMIN,
+  ATOMIC_FADD = 12, ATOMIC_FSUB, ATOMIC_FMAX, ATOMIC_FMIN, ATOMIC_UINC_WRAP, ATOMIC_UDEC_WRAP,
+};
+
+// applies a floating-point op to the bits of a float (T of 4 bytes) or double (8 bytes)
+template <typename T, typename F>
+static T float_rmw(T old_bits, T val_bits, uint32_t op) {
+  if (sizeof(T) != sizeof(F)) {
+    assert(false && "float atomics are 4 or 8 bytes");
+    return old_bits;
+  }
+  F old, val, next;
+  memcpy(&old, &old_bits, sizeof(F));
+  memcpy(&val, &val_bits, sizeof(F));
+  switch (op) {
+    case ATOMIC_FADD: next = old + val; break;
+    case ATOMIC_FSUB: next = old - val; break;
+    case ATOMIC_FMAX: next = __builtin_fmax(old, val); break;
+    case ATOMIC_FMIN: next = __builtin_fmin(old, val); break;
+    default: assert(false && "unknown atomic op"); return old_bits;
+  }
+  T next_bits;
+  memcpy(&next_bits, &next, sizeof(F));
+  return next_bits;
+}
+
+// applies op to *ptr atomically and returns the old value. S is the signed
+// counterpart of T, for max/min.
+template <typename T, typename S>
+static T atomic_rmw(T* ptr, T val, uint32_t op) {
+  switch (op) {
+    case ATOMIC_XCHG: return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+    case ATOMIC_ADD: return __atomic_fetch_add(ptr, val, __ATOMIC_SEQ_CST);
+    case ATOMIC_SUB: return __atomic_fetch_sub(ptr, val, __ATOMIC_SEQ_CST);
+    case ATOMIC_AND: return __atomic_fetch_and(ptr, val, __ATOMIC_SEQ_CST);
+    case ATOMIC_NAND: return __atomic_fetch_nand(ptr, val, __ATOMIC_SEQ_CST);
+    case ATOMIC_OR: return __atomic_fetch_or(ptr, val, __ATOMIC_SEQ_CST);
+    case ATOMIC_XOR: return __atomic_fetch_xor(ptr, val, __ATOMIC_SEQ_CST);
+  }
+
+  T old = __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+  T next;
+  do {
+    switch (op) {
+      case ATOMIC_MAX: next = ((S) old > (S) val) ? old : val; break;
+      case ATOMIC_MIN: next = ((S) old < (S) val) ? old : val; break;
+      case ATOMIC_UMAX: next = (old > val) ? old : val; break;
+      case ATOMIC_UMIN: next = (old < val) ? old : val; break;
+      case ATOMIC_UINC_WRAP: next = (old >= val) ? 0 : old + 1; break;
+      case ATOMIC_UDEC_WRAP: next = (old == 0 || old > val) ? val : old - 1; break;
+      case ATOMIC_FADD: case ATOMIC_FSUB: case ATOMIC_FMAX: case ATOMIC_FMIN:
+        next = (sizeof(T) == sizeof(double)) ? float_rmw<T, double>(old, val, op)
+                                             : float_rmw<T, float>(old, val, op);
+        break;
+      default: assert(false && "unknown atomic op"); return old;
+    }
+  } while (!__atomic_compare_exchange_n(ptr, &old, next, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+  return old;
+}
+
+extern "C" {
+
+uint64_t __pando__atomic_rmw_int64(uint64_t* ptr, uint64_t val, uint32_t op) {
+  TRACE("   >> __pando__atomic_rmw_int64() invoked\n");
+  assert(check_if_global(ptr));
+  return atomic_rmw<uint64_t, int64_t>((uint64_t*) deglobalify(ptr), val, op);
+}
+
+uint32_t __pando__atomic_rmw_int32(uint32_t* ptr, uint32_t val, uint32_t op) {
+  TRACE("   >> __pando__atomic_rmw_int32() invoked\n");
+  assert(check_if_global(ptr));
+  return atomic_rmw<uint32_t, int32_t>((uint32_t*) deglobalify(ptr), val, op);
+}
+
+uint16_t __pando__atomic_rmw_int16(uint16_t* ptr, uint16_t val, uint32_t op) {
+  TRACE("   >> __pando__atomic_rmw_int16() invoked\n");
+  assert(check_if_global(ptr));
+  return atomic_rmw<uint16_t, int16_t>((uint16_t*) deglobalify(ptr), val, op);
+}
+
+uint8_t __pando__atomic_rmw_int8(uint8_t* ptr, uint8_t val, uint32_t op) {
+  TRACE("   >> __pando__atomic_rmw_int8() invoked\n");
+  assert(check_if_global(ptr));
+  return atomic_rmw<uint8_t, int8_t>((uint8_t*) deglobalify(ptr), val, op);
+}
+
+// compare-exchange, returns the old value. the pass compares it to expected.
+uint64_t __pando__atomic_cmpxchg_int64(uint64_t* ptr, uint64_t expected, uint64_t desired) {
+  TRACE("   >> __pando__atomic_cmpxchg_int64() invoked\n");
+  assert(check_if_global(ptr));
+  __atomic_compare_exchange_n((uint64_t*) deglobalify(ptr), &expected, desired, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return expected;
+}
+
+uint32_t __pando__atomic_cmpxchg_int32(uint32_t* ptr, uint32_t expected, uint32_t desired) {
+  TRACE("   >> __pando__atomic_cmpxchg_int32() invoked\n");
+  assert(check_if_global(ptr));
+  __atomic_compare_exchange_n((uint32_t*) deglobalify(ptr), &expected, desired, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return expected;
+}
+
+uint16_t __pando__atomic_cmpxchg_int16(uint16_t* ptr, uint16_t expected, uint16_t desired) {
+  TRACE("   >> __pando__atomic_cmpxchg_int16() invoked\n");
+  assert(check_if_global(ptr));
+  __atomic_compare_exchange_n((uint16_t*) deglobalify(ptr), &expected, desired, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return expected;
+}
+
+uint8_t __pando__atomic_cmpxchg_int8(uint8_t* ptr, uint8_t expected, uint8_t desired) {
+  TRACE("   >> __pando__atomic_cmpxchg_int8() invoked\n");
+  assert(check_if_global(ptr));
+  __atomic_compare_exchange_n((uint8_t*) deglobalify(ptr), &expected, desired, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return expected;
+}
+
+// release point of the store buffer. stores here are applied immediately, so there is
+// nothing to flush (and nothing is traced, to keep the runtime call counts comparable).
+void __pando__fence() {}
+
+// per-site profiling calls of `load-store-pass<profile>` (not traced, like the fence). like the
+// GASNet runtime, accesses are counted per site and written to $PANDO_PROFILE.0.csv at exit, but
+// only when PANDO_PROFILE is set. every address is local here and no latency is measured.
+#define PANDO_PROFILE_SITES 1024
+static struct {
+  uint64_t site;
+  const char* location;
+  uint64_t hits;
+  uint64_t bytes;
+} profile_sites[PANDO_PROFILE_SITES];
+static uint64_t num_profile_sites = 0;
+
+uint64_t __pando__profile_begin() {
+  return 0;
+}
+
+void __pando__profile_end(uint64_t site, uint64_t start, void* addr, uint64_t bytes, const char* location) {
+  uint64_t i = 0;
+  while (i < num_profile_sites && profile_sites[i].site != site) {
+    i++;
+  }
+  if (i == PANDO_PROFILE_SITES) {
+    return;
+  }
+  if (i == num_profile_sites) {
+    profile_sites[i].site = site;
+    profile_sites[i].location = location;
+    num_profile_sites++;
+  }
+  profile_sites[i].hits++;
+  profile_sites[i].bytes += bytes;
+}
+
+__attribute__((destructor)) void __pando__profile_write() {
+  const char* prefix = getenv("PANDO_PROFILE");
+  if (prefix == NULL || num_profile_sites == 0) {
+    return;
+  }
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.0.csv", prefix);
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    return;
+  }
+  fprintf(file, "site,function,file,line,local_hits,remote_hits,bytes,latency_ns\n");
+  for (uint64_t i = 0; i < num_profile_sites; i++) {
+    fprintf(file, "0x%016llx,%s,%llu,0,%llu,0\n", (unsigned long long) profile_sites[i].site,
+            profile_sites[i].location ? profile_sites[i].location : ",,0",
+            (unsigned long long) profile_sites[i].hits, (unsigned long long) profile_sites[i].bytes);
+  }
+  fclose(file);
+}
+
+// number of runtime calls so far. only counted with PANDO_QUIET (and not traced itself).
+uint64_t __pando__call_count() {
+  return num_calls;
+}
+
+// calls lowered by the ship pass. every address is owned by this node, so the thunk runs here
+// (untraced: the shipped function's own accesses are).
+void __pando__ship_register(uint64_t id, void (*thunk)(void*, void*)) {}
+
+void __pando__ship(uint64_t id, void (*thunk)(void*, void*), void* owner, void* args,
+                   uint64_t args_size, void* result, uint64_t result_size) {
+  thunk(args, result);
+}
+
+// symmetric heap of the GASNet runtime. there is a single node here, so it is the C heap with
+// this node's tag (untraced, like malloc).
+void* pando_malloc(size_t n) {
+  return (void*) ((uintptr_t) malloc(n) | ((uintptr_t)0xFFFF << 48));
+}
+
+void pando_free(void* ptr) {
+  free((void*) ((uintptr_t) ptr & ~((uintptr_t)0xFFFF << 48)));
+}
+
+void* pando_symmetric_address(void* ptr, uint64_t rank) {
+  assert(rank == 0);
+  return ptr;
+}
+
+// bulk copies emitted by the coalesce pass for loops over global arrays
+void __pando__bulk_get(void* dst, void* src, size_t n) {
+  TRACE("   >> __pando__bulk_get() invoked\n");
+  assert(check_if_global(src));
+  memcpy(dst, deglobalify(src), n);
+}
+
+void __pando__bulk_put(void* dst, void* src, size_t n) {
+  TRACE("   >> __pando__bulk_put() invoked\n");
+  assert(check_if_global(dst));
+  memcpy(deglobalify(dst), src, n);
+}
+
+// memcpy/memmove and memset lowered by the load-store pass. the addresses may be untagged (e.g.
+// from malloc), so they are not checked.
+void* __pando__memcpy(void* dst, const void* src, size_t n) {
+  TRACE("   >> __pando__memcpy() invoked\n");
+  memmove(deglobalify(dst), deglobalify((void*) src), n);
+  return dst;
+}
+
+void* __pando__memset(void* dst, int value, size_t n) {
+  TRACE("   >> __pando__memset() invoked\n");
+  memset(deglobalify(dst), value, n);
+  return dst;
+}
+
+// masked gathers and scatters lowered by the load-store pass: lane i of dst/src is element_size
+// bytes at ptrs[i], accessed if mask[i] is set. like copies, the addresses are not checked.
+void __pando__gather(void* dst, void** ptrs, uint8_t* mask, size_t element_size, size_t num_elements) {
+  TRACE("   >> __pando__gather() invoked\n");
+  for (size_t i = 0; i < num_elements; ++i) {
+    if (mask[i]) {
+      memcpy((char*) dst + i * element_size, deglobalify(ptrs[i]), element_size);
+    }
+  }
+}
+
+void __pando__scatter(void* src, void** ptrs, uint8_t* mask, size_t element_size, size_t num_elements) {
+  TRACE("   >> __pando__scatter() invoked\n");
+  for (size_t i = 0; i < num_elements; ++i) {
+    if (mask[i]) {
+      memcpy(deglobalify(ptrs[i]), (char*) src + i * element_size, element_size);
+    }
+  }
 }
 
 } // extern "C"
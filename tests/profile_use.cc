@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdint.h>
+
+// `make test_profile_use` lowers this file by the fixture profile profile_use.csv, and
+// `make test_profile` checks the sites and the profile of a run. each function has one load,
+// site 0 of its name: always local (through a global and through a pointer), mostly remote and
+// mixed.
+int64_t counter = 7;
+
+extern "C" __attribute__((noinline)) int64_t local_global() {
+  return counter;
+}
+
+extern "C" __attribute__((noinline)) int64_t local_arg(int64_t *value) {
+  return *value;
+}
+
+// the multiply can overlap with the split load
+extern "C" __attribute__((noinline)) int64_t remote_arg(int64_t *value, int64_t scale) {
+  int64_t scaled = scale * scale;
+  return *value + scaled;
+}
+
+extern "C" __attribute__((noinline)) int64_t mixed_arg(int64_t *value) {
+  return *value;
+}
+
+int main(int argc, char **argv) {
+  int64_t value = argc;
+  printf("%lld %lld %lld %lld\n", (long long) local_global(), (long long) local_arg(&value),
+         (long long) remote_arg(&value, argc), (long long) mixed_arg(&value));
+}
@@ -0,0 +1,22 @@
+#include <stdio.h>
+#include <stdint.h>
+
+// `make test_provenance` checks the accesses provenance-pass proves: those to a global are local
+// and stay native, the store through a loaded pointer is global and skips the tag check
+int64_t counter = 0;
+
+extern "C" __attribute__((noinline)) void bump() {
+  counter += 1;
+}
+
+extern "C" __attribute__((noinline)) void store_loaded(int64_t **slot, int64_t value) {
+  **slot = value;
+}
+
+int main() {
+  int64_t value = 0;
+  int64_t *slot = &value;
+  bump();
+  store_loaded(&slot, 5);
+  printf("counter: %lld, value: %lld\n", (long long) counter, (long long) value);
+}
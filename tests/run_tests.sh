@@ -3,6 +3,11 @@
 tests=$(ls | grep 'test_.*cc$')
 for test in $tests;
 do
+    feature=$(make -s feature testfile="$test")
+    if [[ -n "$feature" ]] && ! grep -qw "$feature" /proc/cpuinfo; then
+        echo "$test" skipped "(needs $feature)"
+        continue
+    fi
     make run_test testfile="$test" > /dev/null
     ./"$test".binary > "$test".out
     diff "$test".expected "$test".out
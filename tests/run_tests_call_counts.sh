@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# usage: ./run_tests_call_counts.sh <load-store pipeline> [o0]
+#
+# the globalize pipeline can be changed with GLOBALIZEPIPELINE (default: globalize-pass).
+#
+# builds every test with the given load-store pipeline and checks that
+#  - the program output (everything but the "   >> ..." runtime traces) matches the expected output
+#  - the pipeline makes no more runtime calls than the traces in the expected output
+
+pipeline="$1"
+globalize_pipeline="${GLOBALIZEPIPELINE:-globalize-pass}"
+suffix=""
+if [[ "$2" == "o0" ]]; then
+    suffix="_o0"
+fi
+
+tests=$(ls | grep 'test_.*cc$')
+for test in $tests;
+do
+    feature=$(make -s feature testfile="$test")
+    if [[ -n "$feature" ]] && ! grep -qw "$feature" /proc/cpuinfo; then
+        echo "$test" skipped "(needs $feature)"
+        continue
+    fi
+    make run_test"$suffix" testfile="$test" LOADSTOREPIPELINE="$pipeline" GLOBALIZEPIPELINE="$globalize_pipeline" > /dev/null
+    ./"$test".binary > "$test".out
+
+    diff <(grep -v '>>' "$test".expected"$suffix") <(grep -v '>>' "$test".out)
+    ret=$?
+
+    expected_calls=$(grep -c '>>' "$test".expected"$suffix")
+    calls=$(grep -c '>>' "$test".out)
+
+    if [[ $ret -ne 0 || $calls -gt $expected_calls ]]; then
+        echo "$test" FAILED "($expected_calls -> $calls runtime calls)"
+    else
+        echo "$test" passed "($expected_calls -> $calls runtime calls)"
+    fi
+done
@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include <stdint.h>
+
+int64_t counter = 5;
+int16_t flags = 3;
+float total = 1.5;
+
+int main() {
+  __sync_fetch_and_add(&counter, 3);
+  int64_t old = __sync_val_compare_and_swap(&counter, 8, 42);
+  printf("counter: %lld (was %lld)\n", (long long) counter, (long long) old);
+
+  // 16-bit and floating-point atomics
+  int before = __sync_fetch_and_or(&flags, 4);
+  int after = __sync_fetch_and_xor(&flags, 1);
+  __atomic_fetch_add(&total, 2.0f, __ATOMIC_SEQ_CST);
+  printf("flags: %d -> %d, total: %.1f\n", before, after, total);
+}
@@ -0,0 +1,17 @@
+#include <stdio.h>
+#include <string.h>
+
+struct Record {
+  int id;
+  int scores[15];
+};
+
+Record current = {1, {10, 20, 30}};
+Record saved;
+
+int main() {
+  // a struct copy and a fill, both of whole globals
+  saved = current;
+  memset(&current, 0, sizeof(current));
+  printf("saved: %d %d, current: %d %d\n", saved.id, saved.scores[2], current.id, current.scores[2]);
+}
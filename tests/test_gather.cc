@@ -0,0 +1,20 @@
+#include <stdio.h>
+
+int table[16] = {0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150};
+int indices[8] = {3, 1, 4, 1, 5, 9, 2, 6};
+
+// the indexed loads become one masked gather at -O3. the Makefile builds this test with -mavx2, so
+// the vectorizer may use AVX2 gathers, and the scripts skip it on hosts without AVX2.
+__attribute__((noinline))
+int sum_indexed() {
+  int sum = 0;
+#pragma clang loop vectorize_width(8) interleave_count(1) unroll(disable)
+  for (int i = 0; i < 8; i++) {
+    sum += table[indices[i]];
+  }
+  return sum;
+}
+
+int main() {
+  printf("sum: %d\n", sum_indexed());
+}
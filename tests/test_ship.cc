@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <stdint.h>
+
+int64_t balances[2] = {10, 20};
+int64_t *accounts = balances;
+
+// takes amount out of an account and returns what is left. with ship-pass, the call runs at the
+// owner of the account.
+__attribute__((annotate("pando_ship"), noinline))
+int64_t withdraw(int64_t *account, int64_t amount) {
+  int64_t left = *account - amount;
+  *account = left;
+  return left;
+}
+
+int main() {
+  int64_t left = withdraw(accounts, 5);
+  printf("left: %lld, balances: %lld %lld\n", (long long) left, (long long) balances[0], (long long) balances[1]);
+}